@@ -5,7 +5,11 @@
  * This code is offered without warranty under the MIT License. Use it as you will 
  * personally or commercially, just give credit if you do.
  */
+#include <stdint.h>
+#include <stddef.h>
 #include <image.h>
+#include <image_io.h>
+#include <imageio.h>
 
 #ifndef CA_IMG_BMP
 #define CA_IMG_BMP
@@ -20,6 +24,17 @@ enum bmp_errors {
     BMP_UNSUPPORTED  = -3,   // valid BMP, but unsupported format
 };
 
+/// @brief how the pixels of a BMP are stored when it is saved
+enum bmp_compression {
+    BMP_COMPRESS_NONE = 0,   // uncompressed lines, as save_bmp() writes
+    BMP_COMPRESS_RLE  = 1,   // run length encoded, BI_RLE8 for 256 colours or BI_RLE4 for 16
+};
+
+/// @brief options for save_bmp_opts() and its memory and stream versions
+typedef struct {
+    int compression;         // one of the bmp_compression values
+} bmp_save_opts_t;
+
 /// @brief saves the image pointed to by src as a BMP
 /// @param fn name of the file to create and write to
 /// @param src pointer to a basic_image_t structure containing the image
@@ -31,4 +46,125 @@ int save_bmp(const char *fn, pal_image_t *src);
 /// @return  pointer to a basic_image_t structure containing the image, or null on error (errno is set)
 pal_image_t *load_bmp(const char *fn);
 
+/// @brief encodes the image pointed to by src as a BMP in memory
+/// @param src pointer to a pal_image_t structure containing the image
+/// @param buf pointer to receive the allocated buffer holding the BMP file, release with free()
+/// @param len pointer to receive the length of the BMP file in bytes
+/// @return 0 on success, otherwise an error code
+int save_bmp_mem(pal_image_t *src, uint8_t **buf, size_t *len);
+
+/// @brief decodes a BMP image that is already held in memory
+/// @param buf pointer to the start of the BMP file data
+/// @param len length of the BMP file data in bytes
+/// @return  pointer to a pal_image_t structure containing the image, or null on error (errno is set)
+pal_image_t *load_bmp_mem(const uint8_t *buf, size_t len);
+
+/// @brief loads the BMP image from a file by mapping it into memory rather than reading it,
+///        the image is decoded directly from the mapped pages
+/// @param fn name of file to load
+/// @return  pointer to a pal_image_t structure containing the image, or null on error (errno is set)
+pal_image_t *load_bmp_mmap(const char *fn);
+
+/// @brief saves the image pointed to by src as a BMP to a stream
+/// @param io pointer to the image_io_t to write to
+/// @param src pointer to a pal_image_t structure containing the image
+/// @return 0 on success, otherwise an error code
+int save_bmp_io(image_io_t *io, pal_image_t *src);
+
+/// @brief saves the image pointed to by src as a BMP, with options such as compression
+/// @param fn name of the file to create and write to
+/// @param src pointer to a pal_image_t structure containing the image
+/// @param opts pointer to the options, or NULL to write the same file as save_bmp()
+/// @return 0 on success, otherwise an error code
+int save_bmp_opts(const char *fn, pal_image_t *src, const bmp_save_opts_t *opts);
+
+/// @brief encodes the image pointed to by src as a BMP in memory, with options as for save_bmp_opts()
+/// @param src pointer to a pal_image_t structure containing the image
+/// @param buf pointer to receive the allocated buffer holding the BMP file, release with free()
+/// @param len pointer to receive the length of the BMP file in bytes
+/// @param opts pointer to the options, or NULL to write the same file as save_bmp_mem()
+/// @return 0 on success, otherwise an error code
+int save_bmp_mem_opts(pal_image_t *src, uint8_t **buf, size_t *len, const bmp_save_opts_t *opts);
+
+/// @brief saves the image pointed to by src as a BMP to a stream, with options as for save_bmp_opts()
+/// @param io pointer to the image_io_t to write to
+/// @param src pointer to a pal_image_t structure containing the image
+/// @param opts pointer to the options, or NULL to write the same file as save_bmp_io()
+/// @return 0 on success, otherwise an error code
+int save_bmp_io_opts(image_io_t *io, pal_image_t *src, const bmp_save_opts_t *opts);
+
+/// @brief loads the BMP image from a stream, which does not need to be seekable
+/// @param io pointer to the image_io_t to read from
+/// @return  pointer to a pal_image_t structure containing the image, or null on error (errno is set)
+pal_image_t *load_bmp_io(image_io_t *io);
+
+/// @brief loads the BMP image from a file into an existing image, reusing its pixel and
+///        palette storage when it is large enough and only reallocating when it is too small
+/// @param dst pointer to the image to load into, which may point to NULL. It is replaced with
+///        a new image if it is too small, and is left for the caller to free even on error
+/// @param fn name of file to load
+/// @return 0 on success, otherwise an error code
+int load_bmp_into(pal_image_t **dst, const char *fn);
+
+/// @brief decodes a BMP image that is already held in memory into an existing image, reusing
+///        its pixel and palette storage when it is large enough
+/// @param dst pointer to the image to decode into, as for load_bmp_into()
+/// @param buf pointer to the start of the BMP file data
+/// @param len length of the BMP file data in bytes
+/// @return 0 on success, otherwise an error code
+int load_bmp_mem_into(pal_image_t **dst, const uint8_t *buf, size_t len);
+
+/// @brief decodes a BMP image from a stream a scanline at a time, handing each line to a
+///        callback in top to bottom order. Only a band of scanlines is held in memory when the
+///        stream can seek, or the image is stored top down, otherwise the raster is buffered
+///        so the bottom up lines can be sent in order. A run length encoded image is always
+///        decoded as a whole before the first scanline is sent
+/// @param io pointer to the image_io_t to read from
+/// @param row callback to receive each scanline
+/// @param user pointer passed through to the callback
+/// @return 0 on success, the non zero value returned by the callback, otherwise an error code
+int load_bmp_scanlines(image_io_t *io, image_row_fn row, void *user);
+
+/// @brief starts encoding a BMP image to a stream a few rows at a time, so the whole image
+///        never has to be held in memory. A seekable stream gets a bottom up BMP, with each band of rows
+///        put in place as it arrives, otherwise the BMP is written top down. Only 16 and 256
+///        colour images can be written.
+///        Send the rows with image_write_rows(), then complete the file with image_write_finish()
+/// @param io pointer to the image_io_t to write to
+/// @param info the dimensions, palette and transparent colour of the image
+/// @return pointer to the writer, or null on error (errno is set)
+image_writer_t *save_bmp_begin(image_io_t *io, const image_info_t *info);
+
+/// @brief loads a rectangle out of a BMP file, reading only the part of each line that covers
+///        it rather than the whole image
+/// @param fn name of file to load from
+/// @param x left edge of the rectangle in pixels
+/// @param y top edge of the rectangle in pixels
+/// @param w width of the rectangle in pixels
+/// @param h height of the rectangle in pixels
+/// @return  pointer to a pal_image_t structure containing just the rectangle, or null on error 
+///          (errno is set). The rectangle must be inside the image
+pal_image_t *load_bmp_rect(const char *fn, uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+
+/// @brief loads a BMP image scaled down to 1/scale of its size, without building the full size
+///        image. Each pixel is the top left pixel of the block it stands for, so the palette is
+///        unchanged. Only the lines that are kept are read from the file
+/// @param fn name of file to load
+/// @param scale one of 1, 2, 4 or 8. The scaled size is rounded up
+/// @return  pointer to a pal_image_t structure containing the scaled image, or null on error (errno is set)
+pal_image_t *load_bmp_scaled(const char *fn, int scale);
+
+/// @brief reads only the signature and headers of a BMP file, without decoding the image
+/// @param fn name of file to probe
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int probe_bmp(const char *fn, image_info_t *info);
+
+/// @brief reads only the signature and headers of a BMP image from a seekable stream,
+///        starting at the current position
+/// @param io pointer to the image_io_t to read from
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int probe_bmp_io(image_io_t *io, image_info_t *info);
+
 #endif
@@ -0,0 +1,61 @@
+/*
+ * image_io.h 
+ * interface definitions for pluggable sources and destinations for image data
+ * 
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef CA_IMG_IO
+#define CA_IMG_IO
+
+/// @brief a single piece of a gathered write
+typedef struct {
+    const void *data; // start of the piece
+    size_t len;       // length of the piece in bytes
+} image_iovec_t;
+
+/// @brief a set of callbacks used to read or write encoded image data. Only the 
+///        callbacks needed for the direction of transfer need to be provided, and
+///        seek and size may be NULL for streams that can't seek (pipes, sockets...).
+///        All callbacks return -1 on error with errno set.
+typedef struct image_io {
+    void *user; // passed as the first parameter to every callback
+
+    /// @brief reads up to len bytes into buf
+    /// @return number of bytes read, 0 at end of stream, or -1 on error
+    int64_t (*read)(void *user, void *buf, size_t len);
+
+    /// @brief writes up to len bytes from buf
+    /// @return number of bytes written, or -1 on error
+    int64_t (*write)(void *user, const void *buf, size_t len);
+
+    /// @brief optional, writes the pieces in order as a single gathered write. If NULL
+    ///        the pieces are passed to write one at a time
+    /// @return number of bytes written, or -1 on error
+    int64_t (*writev)(void *user, const image_iovec_t *iov, int count);
+
+    /// @brief moves the stream position, whence is one of SEEK_SET, SEEK_CUR or SEEK_END
+    /// @return the new stream position, or -1 on error (including streams that can't seek)
+    int64_t (*seek)(void *user, int64_t offset, int whence);
+
+    /// @brief gets the total size of the stream if known
+    /// @return size of the stream in bytes, or -1 if unknown
+    int64_t (*size)(void *user);
+} image_io_t;
+
+/// @brief creates an image_io_t that reads from or writes to an open stdio stream
+/// @param fp pointer to an open FILE, which remains owned by the caller
+/// @return the initialized image_io_t
+image_io_t image_io_file(FILE *fp);
+
+/// @brief creates an image_io_t that reads from or writes to an open file descriptor
+///        which can be a regular file, pipe, or socket
+/// @param fd the file descriptor, which remains owned by the caller
+/// @return the initialized image_io_t
+image_io_t image_io_fd(int fd);
+
+#endif
@@ -5,7 +5,11 @@
  * This code is offered without warranty under the MIT License. Use it as you will 
  * personally or commercially, just give credit if you do.
  */
+#include <stdint.h>
+#include <stddef.h>
 #include <image.h>
+#include <image_io.h>
+#include <imageio.h>
 
 #ifndef CA_IMG_PCX
 #define CA_IMG_PCX
@@ -21,4 +25,121 @@ int save_pcx(const char *fn, pal_image_t *src);
 /// @return  pointer to a pal_image_t structure containing the image, or null on error (errno is set)
 pal_image_t *load_pcx(const char *fn);
 
+/// @brief encodes the image pointed to by src as a PCX in memory
+/// @param src pointer to a pal_image_t structure containing the image
+/// @param buf pointer to receive the allocated buffer holding the PCX file, release with free()
+/// @param len pointer to receive the length of the PCX file in bytes
+/// @return 0 on success, otherwise an error code
+int save_pcx_mem(pal_image_t *src, uint8_t **buf, size_t *len);
+
+/// @brief decodes a PCX image that is already held in memory
+/// @param buf pointer to the start of the PCX file data
+/// @param len length of the PCX file data in bytes
+/// @return  pointer to a pal_image_t structure containing the image, or null on error (errno is set)
+pal_image_t *load_pcx_mem(const uint8_t *buf, size_t len);
+
+/// @brief saves the image pointed to by src as a PCX to a stream
+/// @param io pointer to the image_io_t to write to
+/// @param src pointer to a pal_image_t structure containing the image
+/// @return 0 on success, otherwise an error code
+int save_pcx_io(image_io_t *io, pal_image_t *src);
+
+/// @brief loads the PCX image from a stream, which does not need to be seekable
+/// @param io pointer to the image_io_t to read from
+/// @return  pointer to a pal_image_t structure containing the image, or null on error (errno is set)
+pal_image_t *load_pcx_io(image_io_t *io);
+
+/// @brief loads the PCX image from a file into an existing image, reusing its pixel and
+///        palette storage when it is large enough and only reallocating when it is too small
+/// @param dst pointer to the image to load into, which may point to NULL. It is replaced with
+///        a new image if it is too small, and is left for the caller to free even on error
+/// @param fn name of file to load
+/// @return 0 on success, otherwise an error code
+int load_pcx_into(pal_image_t **dst, const char *fn);
+
+/// @brief decodes a PCX image that is already held in memory into an existing image, reusing
+///        its pixel and palette storage when it is large enough
+/// @param dst pointer to the image to decode into, as for load_pcx_into()
+/// @param buf pointer to the start of the PCX file data
+/// @param len length of the PCX file data in bytes
+/// @return 0 on success, otherwise an error code
+int load_pcx_mem_into(pal_image_t **dst, const uint8_t *buf, size_t len);
+
+/// @brief decodes a PCX image from a stream a scanline at a time, handing each line to a
+///        callback in top to bottom order. Only the compressed data for a few lines is held in
+///        memory, except for a 256 colour image on a stream that can't seek, where the
+///        compressed data has to be buffered to get at the palette at the end
+/// @param io pointer to the image_io_t to read from
+/// @param row callback to receive each scanline
+/// @param user pointer passed through to the callback
+/// @return 0 on success, the non zero value returned by the callback, otherwise an error code
+int load_pcx_scanlines(image_io_t *io, image_row_fn row, void *user);
+
+/// @brief starts encoding a PCX image to a stream a few rows at a time, so the whole image
+///        never has to be held in memory. Each row is RLE encoded as it arrives and the encoded data
+///        is written a band at a time. 16 colour images are written at 4 bits per pixel, up to
+///        256 colours at 8 bits per pixel.
+///        Send the rows with image_write_rows(), then complete the file with image_write_finish()
+/// @param io pointer to the image_io_t to write to
+/// @param info the dimensions, palette and transparent colour of the image
+/// @return pointer to the writer, or null on error (errno is set)
+image_writer_t *save_pcx_begin(image_io_t *io, const image_info_t *info);
+
+/// @brief index of where each line of a PCX file starts, see build_pcx_index()
+typedef struct pcx_index pcx_index_t;
+
+/// @brief makes one pass over the RLE data of a PCX file, noting where each line starts so
+///        lines can later be decoded without decoding everything above them
+/// @param fn name of file to index
+/// @return pointer to the index, release with free_pcx_index(), or null on error (errno is set)
+pcx_index_t *build_pcx_index(const char *fn);
+
+/// @brief saves an index as a compact sidecar file, to be loaded again with load_pcx_index()
+/// @param fn name of the sidecar file to create and write to
+/// @param index pointer to the index to save
+/// @return 0 on success, otherwise an error code
+int save_pcx_index(const char *fn, const pcx_index_t *index);
+
+/// @brief loads an index from a sidecar file written by save_pcx_index()
+/// @param fn name of the sidecar file to load
+/// @return pointer to the index, release with free_pcx_index(), or null on error (errno is set)
+pcx_index_t *load_pcx_index(const char *fn);
+
+/// @brief releases an index
+/// @param index pointer to the index, may be NULL
+void free_pcx_index(pcx_index_t *index);
+
+/// @brief loads a run of lines out of a PCX file, using an index to go straight to the first 
+///        one instead of decoding from the top of the image
+/// @param fn name of file to load from
+/// @param index pointer to the index for the file. If the file has changed since it was 
+///        indexed, EINVAL is returned
+/// @param y0 first line to load
+/// @param count number of lines to load
+/// @return  pointer to a pal_image_t structure containing the full width of the lines, or null
+///          on error (errno is set). The lines must be inside the image
+pal_image_t *load_pcx_rows(const char *fn, const pcx_index_t *index, uint32_t y0, uint32_t count);
+
+/// @brief loads a PCX image scaled down to 1/scale of its size, without building the full size
+///        image. Each pixel is the top left pixel of the block it stands for, so the palette is
+///        unchanged. Every line has to be run through the RLE decoder, but the lines that
+///        aren't kept are skipped over without being decoded
+/// @param fn name of file to load
+/// @param scale one of 1, 2, 4 or 8. The scaled size is rounded up
+/// @return  pointer to a pal_image_t structure containing the scaled image, or null on error (errno is set)
+pal_image_t *load_pcx_scaled(const char *fn, int scale);
+
+/// @brief reads only the signature and headers of a PCX file, without decoding the image
+/// @param fn name of file to probe
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int probe_pcx(const char *fn, image_info_t *info);
+
+/// @brief reads only the signature and headers of a PCX image from a seekable stream,
+///        starting at the current position
+/// @param io pointer to the image_io_t to read from
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int probe_pcx_io(image_io_t *io, image_info_t *info);
+
 #endif
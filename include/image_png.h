@@ -5,7 +5,11 @@
  * This code is offered without warranty under the MIT License. Use it as you will 
  * personally or commercially, just give credit if you do.
  */
+#include <stdint.h>
+#include <stddef.h>
 #include <image.h>
+#include <image_io.h>
+#include <imageio.h>
 
 #ifndef CA_IMG_PNG
 #define CA_IMG_PNG
@@ -21,4 +25,82 @@ int save_png(const char *fn, pal_image_t *src);
 /// @return  pointer to a basic_image_t structure containing the image, or null on error (errno is set)
 pal_image_t *load_png(const char *fn);
 
+/// @brief encodes the image pointed to by src as a PNG in memory
+/// @param src pointer to a pal_image_t structure containing the image
+/// @param buf pointer to receive the allocated buffer holding the PNG file, release with free()
+/// @param len pointer to receive the length of the PNG file in bytes
+/// @return 0 on success, otherwise an error code
+int save_png_mem(pal_image_t *src, uint8_t **buf, size_t *len);
+
+/// @brief decodes a PNG image that is already held in memory
+/// @param buf pointer to the start of the PNG file data
+/// @param len length of the PNG file data in bytes
+/// @return  pointer to a pal_image_t structure containing the image, or null on error (errno is set)
+pal_image_t *load_png_mem(const uint8_t *buf, size_t len);
+
+/// @brief saves the image pointed to by src as a PNG to a stream
+/// @param io pointer to the image_io_t to write to
+/// @param src pointer to a pal_image_t structure containing the image
+/// @return 0 on success, otherwise an error code
+int save_png_io(image_io_t *io, pal_image_t *src);
+
+/// @brief loads the PNG image from a stream, which does not need to be seekable
+/// @param io pointer to the image_io_t to read from
+/// @return  pointer to a pal_image_t structure containing the image, or null on error (errno is set)
+pal_image_t *load_png_io(image_io_t *io);
+
+/// @brief loads the PNG image from a file into an existing image, reusing its pixel and
+///        palette storage when it is large enough and only reallocating when it is too small
+/// @param dst pointer to the image to load into, which may point to NULL. It is replaced with
+///        a new image if it is too small, and is left for the caller to free even on error
+/// @param fn name of file to load
+/// @return 0 on success, otherwise an error code
+int load_png_into(pal_image_t **dst, const char *fn);
+
+/// @brief decodes a PNG image that is already held in memory into an existing image, reusing
+///        its pixel and palette storage when it is large enough
+/// @param dst pointer to the image to decode into, as for load_png_into()
+/// @param buf pointer to the start of the PNG file data
+/// @param len length of the PNG file data in bytes
+/// @return 0 on success, otherwise an error code
+int load_png_mem_into(pal_image_t **dst, const uint8_t *buf, size_t len);
+
+/// @brief decodes a PNG image from a stream a scanline at a time, handing each line to a
+///        callback in top to bottom order. Only one line is held in memory, except for
+///        interlaced images which have to be decoded in full before the lines can be sent
+/// @param io pointer to the image_io_t to read from
+/// @param row callback to receive each scanline
+/// @param user pointer passed through to the callback
+/// @return 0 on success, the non zero value returned by the callback, otherwise an error code
+int load_png_scanlines(image_io_t *io, image_row_fn row, void *user);
+
+/// @brief starts encoding a PNG image to a stream a few rows at a time, so the whole image
+///        never has to be held in memory. Each row is compressed as it arrives.
+///        Send the rows with image_write_rows(), then complete the file with image_write_finish()
+/// @param io pointer to the image_io_t to write to
+/// @param info the dimensions, palette and transparent colour of the image
+/// @return pointer to the writer, or null on error (errno is set)
+image_writer_t *save_png_begin(image_io_t *io, const image_info_t *info);
+
+/// @brief loads a PNG image scaled down to 1/scale of its size, without building the full size
+///        image. Each pixel is the top left pixel of the block it stands for, so the palette is
+///        unchanged. Every row has to be inflated, but only one full size row is held at a time
+/// @param fn name of file to load
+/// @param scale one of 1, 2, 4 or 8. The scaled size is rounded up
+/// @return  pointer to a pal_image_t structure containing the scaled image, or null on error (errno is set)
+pal_image_t *load_png_scaled(const char *fn, int scale);
+
+/// @brief reads only the signature and headers of a PNG file, without decoding the image
+/// @param fn name of file to probe
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int probe_png(const char *fn, image_info_t *info);
+
+/// @brief reads only the signature and headers of a PNG image from a seekable stream,
+///        starting at the current position
+/// @param io pointer to the image_io_t to read from
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int probe_png_io(image_io_t *io, image_info_t *info);
+
 #endif
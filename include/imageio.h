@@ -0,0 +1,319 @@
+/*
+ * imageio.h 
+ * interface definitions for format independent access to indexed colour image files
+ * 
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <image.h>
+#include <image_io.h>
+
+#ifndef CA_IMG_IMAGEIO
+#define CA_IMG_IMAGEIO
+
+/// @brief the image file formats supported by this library
+typedef enum {
+    IMAGE_FMT_UNKNOWN = 0,
+    IMAGE_FMT_BMP     = 1,  // Windows BMP
+    IMAGE_FMT_PCX     = 2,  // PC Paintbrush PCX
+    IMAGE_FMT_TGA     = 3,  // Truevision TGA
+    IMAGE_FMT_PNG     = 4,  // Portable Network Graphics
+} image_format_t;
+
+/// @brief information about an image file, gathered from its headers without decoding it
+typedef struct {
+    image_format_t format;   // format of the file
+    uint32_t width;          // image width in pixels
+    uint32_t height;         // image height in pixels
+    int bits_per_pixel;      // bits per pixel of the encoded image data
+    int colours;             // number of palette entries the decoded image will have
+    int transparent;         // index of the transparent colour, or -1 if none
+    uint64_t pixel_offset;   // byte offset from the start of the file to the image data
+                             // (for PCX and PNG this is the start of the compressed data)
+    img_pal_entry_t pal[256]; // the palette, entries beyond colours are 0
+} image_info_t;
+
+/// @brief receives each decoded scanline from the load_*_scanlines() decoders, in top to bottom order
+/// @param user the user pointer that was passed to the decoder
+/// @param info the dimensions and palette of the image being decoded
+/// @param y index of the scanline, starting at 0 for the top line
+/// @param pixels info->width pixels, one byte each, only valid for the duration of the call
+/// @return 0 to carry on decoding, anything else stops the decode and is returned by it
+typedef int (*image_row_fn)(void *user, const image_info_t *info, uint32_t y, const uint8_t *pixels);
+
+/// @brief an encoder that is being fed an image a few rows at a time, from one of the save_*_begin()
+///        functions. It is opaque, rows are added with image_write_rows() and it is completed and
+///        released with image_write_finish()
+typedef struct image_writer image_writer_t;
+
+/// @brief reads only the signature and headers of an image file in any supported format
+/// @param fn name of the file to probe
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int image_probe(const char *fn, image_info_t *info);
+
+/// @brief loads an image in any supported format, the format is detected from the
+///        contents of the file rather than its name
+/// @param fn name of file to load
+/// @return  pointer to a pal_image_t structure containing the image, or null on error (errno is set)
+pal_image_t *load_image(const char *fn);
+
+/// @brief decodes an image in any supported format that is already held in memory
+/// @param buf pointer to the start of the file data
+/// @param len length of the file data in bytes
+/// @return  pointer to a pal_image_t structure containing the image, or null on error (errno is set)
+pal_image_t *load_image_mem(const uint8_t *buf, size_t len);
+
+/// @brief loads an image in any supported format into an existing image, reusing its pixel
+///        and palette storage when it is large enough and only reallocating when it is too small
+/// @param dst pointer to the image to load into, which may point to NULL. It is replaced with
+///        a new image if it is too small, and is left for the caller to free even on error
+/// @param fn name of file to load
+/// @return 0 on success, otherwise an error code
+int load_image_into(pal_image_t **dst, const char *fn);
+
+/// @brief decodes an image in any supported format that is already held in memory into an
+///        existing image, as for load_image_into()
+/// @param dst pointer to the image to decode into
+/// @param buf pointer to the start of the file data
+/// @param len length of the file data in bytes
+/// @return 0 on success, otherwise an error code
+int load_image_mem_into(pal_image_t **dst, const uint8_t *buf, size_t len);
+
+/// @brief decodes an image file in any supported format a scanline at a time, handing each
+///        line to a callback rather than building the whole image
+/// @param fn name of file to decode
+/// @param row callback to receive each scanline
+/// @param user pointer passed through to the callback
+/// @return 0 on success, the non zero value returned by the callback, otherwise an error code
+int load_image_scanlines(const char *fn, image_row_fn row, void *user);
+
+/// @brief loads many image files at once, in any supported format, spreading them across a 
+///        pool of worker threads. Each worker starts with an even share of the files, and a 
+///        worker that runs out steals half of what another has left
+/// @param fns the names of the files to load
+/// @param n number of files
+/// @param out array of n pointers to receive the images, NULL for any that failed
+/// @param errs array of n results, 0 or the error code for each file, may be NULL
+/// @param threads number of workers, or 0 to use one for each processor
+/// @return 0 if every image loaded, EIO if any failed (see errs), otherwise an error code
+int load_images_batch(const char **fns, size_t n, pal_image_t **out, int *errs, int threads);
+
+/// @brief a queue of loads and saves that run in the background, see image_async_new()
+typedef struct image_async image_async_t;
+
+/// @brief the kind of request an image_completion_t is for
+typedef enum {
+    IMAGE_ASYNC_LOAD = 0,
+    IMAGE_ASYNC_SAVE = 1,
+} image_async_op_t;
+
+/// @brief the result of a load or save submitted to an image_async_t
+typedef struct {
+    image_async_op_t op; // the kind of request
+    void *tag;           // the tag given when the request was submitted
+    pal_image_t *img;    // the loaded image (owned by the caller), or the image that was saved
+    int err;             // 0 on success, otherwise an error code
+} image_completion_t;
+
+#define IMAGE_ASYNC_NO_RING (0x0001) // don't use io_uring even where it is available
+
+/// @brief sets up a queue for loading and saving images in the background. Reads and writes
+///        go through io_uring on Linux, so they don't tie up a thread each. Opening, decoding
+///        and encoding run on a pool of worker threads, which also do the reads and writes 
+///        when io_uring isn't available. Requests can be submitted and reaped from any thread
+/// @param threads number of worker threads, or 0 to use one for each processor
+/// @param flags IMAGE_ASYNC_NO_RING or 0
+/// @return pointer to the queue, release with image_async_free(), or null on error (errno is set)
+image_async_t *image_async_new(int threads, unsigned flags);
+
+/// @brief checks whether a queue is using io_uring for its reads and writes
+/// @param a pointer to the queue
+/// @return true if io_uring is in use, false if the workers do the I/O
+bool image_async_uses_ring(const image_async_t *a);
+
+/// @brief submits a file to be loaded, in any supported format
+/// @param a pointer to the queue
+/// @param fn name of file to load
+/// @param tag value handed back with the completion
+/// @return 0 if the request was queued, otherwise an error code
+int image_async_load(image_async_t *a, const char *fn, void *tag);
+
+/// @brief submits an image to be saved, the format is picked from the extension of the file name
+/// @param a pointer to the queue
+/// @param fn name of the file to create and write to
+/// @param img pointer to the image to save, which must not change until the save has been reaped
+/// @param tag value handed back with the completion
+/// @return 0 if the request was queued, otherwise an error code
+int image_async_save(image_async_t *a, const char *fn, pal_image_t *img, void *tag);
+
+/// @brief takes the next completed request off the queue, in the order they complete
+/// @param a pointer to the queue
+/// @param c pointer to an image_completion_t to fill in
+/// @param wait true to wait for a request to complete, false to return straight away
+/// @return 0 if c was filled in, EAGAIN if nothing has completed yet and wait is false,
+///         ENOENT if there is nothing left to reap, otherwise an error code
+int image_async_reap(image_async_t *a, image_completion_t *c, bool wait);
+
+/// @brief waits for everything in flight to complete, then releases the queue. Loaded
+///        images that were never reaped are freed
+/// @param a pointer to the queue, may be NULL
+void image_async_free(image_async_t *a);
+
+/// @brief loads an image file in any supported format scaled down to 1/scale of its size, 
+///        without building the full size image, for thumbnails and previews
+/// @param fn name of file to load
+/// @param scale one of 1, 2, 4 or 8. The scaled size is rounded up
+/// @return  pointer to a pal_image_t structure containing the scaled image, or null on error (errno is set)
+pal_image_t *load_image_scaled(const char *fn, int scale);
+
+/// @brief starts writing an image in the given format to a stream, ready to be given the rows
+///        with image_write_rows()
+/// @param io pointer to the image_io_t to write to, which must stay open until the writer is finished
+/// @param format the format to write
+/// @param info the width, height, colours, transparent colour and palette of the image
+/// @return pointer to the writer, or null on error (errno is set)
+image_writer_t *save_image_begin(image_io_t *io, image_format_t format, const image_info_t *info);
+
+/// @brief adds the next rows, in top to bottom order, to an image being written
+/// @param w pointer to the writer
+/// @param pixels count rows of width pixels each, one byte per pixel, with no padding between them
+/// @param count number of rows
+/// @return 0 on success, otherwise an error code. Once an error has happened every later call returns it
+int image_write_rows(image_writer_t *w, const uint8_t *pixels, uint32_t count);
+
+/// @brief completes an image being written and releases the writer. This must always be called,
+///        even after an error, to release the writer
+/// @param w pointer to the writer
+/// @return 0 on success, EINVAL if not all of the rows were written, otherwise an error code
+int image_write_finish(image_writer_t *w);
+
+/// @brief saves an image, the format is picked from the extension of the file name
+///        (.bmp, .pcx, .tga, or .png)
+/// @param fn name of the file to create and write to
+/// @param img pointer to a pal_image_t structure containing the image
+/// @return 0 on success, otherwise an error code
+int save_image(const char *fn, pal_image_t *img);
+
+/// @brief encodes an image in the given format in memory
+/// @param img pointer to a pal_image_t structure containing the image
+/// @param format the format to encode the image as
+/// @param buf pointer to receive the allocated buffer holding the file, release with free()
+/// @param len pointer to receive the length of the file in bytes
+/// @return 0 on success, otherwise an error code
+int save_image_mem(pal_image_t *img, image_format_t format, uint8_t **buf, size_t *len);
+
+/// @brief a set of allocation functions for the library to use in place of malloc(), realloc()
+///        and free(). Each is passed the user pointer, and alloc and resize should return NULL
+///        when out of memory
+typedef struct {
+    void *(*alloc)(void *user, size_t size);
+    void *(*resize)(void *user, void *ptr, size_t size);
+    void (*release)(void *user, void *ptr);
+    void *user;
+} image_allocator_t;
+
+/// @brief installs the functions the library uses for its own memory: the temporary buffers of
+///        the decoders and encoders, writers, PCX line indexes, and the batch and async queues.
+///        Images still come from ca-image's image_alloc(), and buffers handed back to be released
+///        with free() still come from malloc(). This must be called before anything else in the
+///        library, or once everything it allocated has been released
+/// @param alloc pointer to the functions, which are copied, or NULL to go back to the C library
+/// @return 0 on success, EINVAL if any of the functions are missing
+int image_set_allocator(const image_allocator_t *alloc);
+
+/// @brief gives the calling thread a region of memory to take the temporary buffers of its
+///        loads and saves from, rather than allocating them (file buffers, line and band buffers,
+///        RLE and libpng state). The region is reused from the start by every call, anything
+///        that doesn't fit comes from the allocator. Together with the load_*_into() functions
+///        this lets a decode run without allocating at all
+/// @param buf pointer to the region, which must stay valid until it is replaced, or NULL to stop using one
+/// @param len size of the region in bytes
+/// @return 0 on success, EBUSY if called from inside a load or save (a scanline callback),
+///         EINVAL if the region is too small to use
+int image_set_scratch(void *buf, size_t len);
+
+/// @brief reports the most of the calling thread's scratch region any one call has wanted,
+///        including anything that didn't fit, for sizing the region
+/// @return the size in bytes, 0 if there is no region
+size_t image_scratch_peak(void);
+
+/// @brief a pool of images kept for reuse rather than being freed, see image_pool_new()
+typedef struct image_pool image_pool_t;
+
+/// @brief sets up a pool that hands out images by size class, and takes them back to hand out
+///        again, so a decode loop keeps reusing pixel buffers that are already paged in instead
+///        of faulting in fresh ones every frame. Images are classed by pixel count, in steps of a
+///        quarter between powers of 2, and by palette size (16 or 256 entries). The pool can be
+///        used from any number of threads
+/// @param max_bytes most memory to keep in images waiting to be reused, or 0 for no limit
+/// @return pointer to the pool, release with image_pool_free(), or null on error (errno is set)
+image_pool_t *image_pool_new(size_t max_bytes);
+
+/// @brief gets an image from a pool, recycling one of the same size class when there is one.
+///        The pixels and palette entries past colours are not cleared
+/// @param pool pointer to the pool
+/// @param width width of the image in pixels
+/// @param height height of the image in pixels
+/// @param colours number of palette entries, up to 256
+/// @return pointer to the image, or null on error (errno is set)
+pal_image_t *image_pool_get(image_pool_t *pool, int width, int height, int colours);
+
+/// @brief gives an image back to a pool instead of freeing it. Any image can be given back, not
+///        just those from the pool. It is freed if the pool is at its limit. Images from the pool
+///        must come back through here to be recycled, image_free() releases them for good
+/// @param pool pointer to the pool, or NULL to just free the image
+/// @param img pointer to the image, may be NULL
+void image_pool_put(image_pool_t *pool, pal_image_t *img);
+
+/// @brief frees the images waiting in a pool, then the pool. Images that are still out are
+///        left for their owners to release with image_free()
+/// @param pool pointer to the pool, may be NULL
+void image_pool_free(image_pool_t *pool);
+
+/// @brief makes the loaders called on this thread take their images from a pool, and give
+///        back any image they would otherwise free (one that is too small for load_*_into(),
+///        or a partly decoded one on error). load_images_batch() and image_async_new() pass
+///        the calling thread's pool on to their workers, so it must outlive them
+/// @param pool pointer to the pool, or NULL to go back to allocating each image
+/// @return the pool that was set before
+image_pool_t *image_set_pool(image_pool_t *pool);
+
+/// @brief converts palette entries to the 3 byte BGR layout used by TGA. Uses SSSE3 or NEON
+///        shuffles when the CPU has them, as do the other image_pal_ functions. The
+///        source and destination must not overlap
+/// @param dst pointer to receive count * 3 bytes
+/// @param pal pointer to the RGB palette entries
+/// @param count number of entries
+void image_pal_to_bgr(uint8_t *dst, const img_pal_entry_t *pal, int count);
+
+/// @brief converts palette entries from the 3 byte BGR layout used by TGA
+/// @param pal pointer to receive count RGB palette entries
+/// @param src pointer to count * 3 bytes
+/// @param count number of entries
+void image_pal_from_bgr(img_pal_entry_t *pal, const uint8_t *src, int count);
+
+/// @brief converts palette entries to the 4 byte BGRA layout used by BMP and 32 bit TGA
+/// @param dst pointer to receive count * 4 bytes
+/// @param pal pointer to the RGB palette entries
+/// @param count number of entries
+/// @param alpha value for the 4th byte of every entry
+/// @param transparent index of an entry to get an alpha of 0 instead, or -1 for none
+void image_pal_to_bgra(uint8_t *dst, const img_pal_entry_t *pal, int count, uint8_t alpha, int transparent);
+
+/// @brief converts palette entries from the 4 byte BGRA layout used by BMP and 32 bit TGA
+/// @param pal pointer to receive count RGB palette entries
+/// @param src pointer to count * 4 bytes
+/// @param count number of entries
+/// @return index of the first entry with an alpha of 0, or -1 if there isn't one
+int image_pal_from_bgra(img_pal_entry_t *pal, const uint8_t *src, int count);
+
+/// @brief works out the image format from the extension of a file name
+/// @param fn name of the file
+/// @return the format, or IMAGE_FMT_UNKNOWN if the extension isn't recognized
+image_format_t image_format_from_name(const char *fn);
+
+#endif
@@ -1,33 +1,66 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <image_bmp.h>
 #include "bmp_priv.h"
+#include "../io/io_priv.h"
 #include <stdbool.h>
 #include <errno.h>
+#include <memstream.h>
 
 /// @brief loads ONLY the image portion of a BMP file with 4bpp encoding
 /// @param img pointer to an allocated basic_image_t structure large enough for the image
 /// @param bmp pointer to a bmp header struct (filled in by calling code)
-/// @param fp  file handle to an open file for the BMP
+/// @param src pointer to a memstream buffer holding the entire BMP file
 /// @return 0 on sucess, otherwise an error code
-static int load_bmp4(pal_image_t *img, bmp_header_t *bmp, FILE *fp);
+static int load_bmp4(pal_image_t *img, bmp_header_t *bmp, memstream_buf_t *src);
 
 /// @brief loads ONLY the image portion of a BMP file with 8bpp encoding
 /// @param img pointer to an allocated basic_image_t structure large enough for the image
 /// @param bmp pointer to a bmp header struct (filled in by calling code)
-/// @param fp  file handle to an open file for the BMP
+/// @param src pointer to a memstream buffer holding the entire BMP file
 /// @return 0 on sucess, otherwise an error code
-static int load_bmp8(pal_image_t *img, bmp_header_t *bmp, FILE *fp);
+static int load_bmp8(pal_image_t *img, bmp_header_t *bmp, memstream_buf_t *src);
 
-/// @brief loads a Windows BMP file into  memory. Must be a uncompressed palletted
-///        4 bit per pixel or 8 bit per pixel image
+/// @brief loads ONLY the image portion of a BMP file with BMP_RLE8 or BMP_RLE4 encoding
+/// @param img pointer to an allocated basic_image_t structure large enough for the image
+/// @param bmp pointer to a bmp header struct (filled in by calling code)
+/// @param src pointer to a memstream buffer holding the entire BMP file
+/// @return 0 on sucess, otherwise an error code
+static int load_bmp_rle(pal_image_t *img, bmp_header_t *bmp, memstream_buf_t *src);
+
+/// @brief loads part of a run length encoded BMP file, optionally scaled down. The lines can't
+///        be found without decoding the ones before them, so the whole image is decoded and
+///        the part picked out of it
+/// @param f pointer to the open BMP file
+/// @param x left edge of the part in pixels
+/// @param y top edge of the part in pixels
+/// @param w width of the part in pixels
+/// @param h height of the part in pixels
+/// @param scale 1, or 2, 4 or 8 to keep the top left pixel of each block
+/// @return pointer to a pal_image_t structure containing the part, or null on error with errno set
+static pal_image_t *load_bmp_rle_part(io_file_t *f, uint32_t x, uint32_t y, uint32_t w, uint32_t h, int scale);
+
+/// @brief decodes a BMP file held in memory into an image, reusing the storage of the
+///        image it is given when that is large enough
+/// @param dst pointer to the image to decode into, may point to NULL to allocate a new one
+/// @param buf pointer to the start of the BMP file data
+/// @param len length of the BMP file data in bytes
+/// @return 0 on success, otherwise an error code
+static int bmp_decode(pal_image_t **dst, const uint8_t *buf, size_t len);
+
+/// @brief loads a Windows BMP file into  memory. Must be a palletted 4 bit per pixel or 
+///        8 bit per pixel image, uncompressed or run length encoded
 /// @param fn pointer to the filename of the BMP to read
 /// @return pointer to a pal_image_t structure containing the image, or null on error with errno set/
 pal_image_t *load_bmp(const char *fn) {
     int rval = 0;
-    FILE *fp = NULL;
-    bmp_header_t *bmp = NULL;
+    io_file_t f = {.fp = NULL, .fd = -1};
+    bmp_header_t bmp;
+    image_info_t info;
+    uint8_t *buf = NULL;
+    size_t len = 0;
     pal_image_t *img = NULL;
-    bmp_palette_entry_t *pal = NULL;
 
     // do some basic error checking on the inputs
     if(NULL == fn) {
@@ -35,107 +68,462 @@ pal_image_t *load_bmp(const char *fn) {
         goto bmp_cleanup;
     }
 
-    // try to open input file
-    if(NULL == (fp = fopen(fn,"rb"))) {
-        rval = errno;  // can't open input file
+    if(0 != (rval = io_open_file(fn, &f))) {
         goto bmp_cleanup;
     }
 
-    bmp_signature_t sig = 0;
-    int nr = fread(&sig, sizeof(bmp_signature_t), 1, fp);
-    if(1 != nr) {
-        rval = errno;  // unable to read file
+    if(BMP_NOERROR != (rval = bmp_read_header(&f.io, &bmp, &info))) {
         goto bmp_cleanup;
     }
-    if(BMPFILESIG != sig) { // not a BMP file
-        rval = BMP_INVALID;
-        goto bmp_cleanup;
+
+    if((4 == info.bits_per_pixel) || (BMP_RGB != bmp.bmi.compression)) {
+        // the pixels have to be unpacked or decompressed, so pull the whole file into memory with a single read
+        if((0 > io_seek(&f.io, 0, SEEK_SET)) || (0 != (rval = io_read_all(&f.io, &buf, &len)))) {
+            if(0 == rval) rval = errno;
+            goto bmp_cleanup;
+        }
+        if(NULL == (img = load_bmp_mem(buf, len))) {
+            rval = errno;
+            goto bmp_cleanup;
+        }
+    } else {
+        // 8 bit scanlines are the pixels as they are, so they are read straight into the image
+        if(NULL == (img = io_image_new(info.width, info.height, info.colours))) {
+            rval = errno;
+            goto bmp_cleanup;
+        }
+        memcpy(img->pal, info.pal, info.colours * sizeof(img_pal_entry_t));
+
+        // the padding on the last line isn't read, but has to be there to match load_bmp_mem
+        uint32_t stride = ((info.width + 3) & (~0x0003)); // padded to a 32 bit boundary
+        int64_t end = (int64_t)bmp.dib.image_offset + ((int64_t)stride * info.height);
+        if((end > io_seek(&f.io, 0, SEEK_END)) || (0 > io_seek(&f.io, bmp.dib.image_offset, SEEK_SET)) || 
+           (0 != io_read_rows(&f.io, img, stride, (0 < bmp.bmi.image_height)))) {
+            rval = BMP_INVALID;  // truncated image data
+            goto bmp_cleanup;
+        }
     }
 
-    // allocate a buffer to hold the header 
-    if(NULL == (bmp = calloc(1, sizeof(bmp_header_t)))) {
-        rval = errno;  // unable to allocate mem
+    free_s(buf);
+    io_close_file(&f);
+    return img;
+bmp_cleanup:
+    free_s(buf);
+    io_close_file(&f);
+    if(NULL != img) io_image_drop(img);
+    errno = rval;
+    return NULL;
+}
+
+/// @brief loads a Windows BMP image from a stream, which does not need to be seekable. 
+///        Must be a palletted 4 bit per pixel or 8 bit per pixel image, uncompressed or RLE
+/// @param io pointer to the image_io_t to read the BMP from
+/// @return pointer to a pal_image_t structure containing the image, or null on error with errno set/
+pal_image_t *load_bmp_io(image_io_t *io) {
+    int rval = 0;
+    pal_image_t *img = NULL;
+    uint8_t *buf = NULL;
+    size_t len = 0;
+
+    if(NULL == io) {
+        rval = BMP_NULL_POINTER;
         goto bmp_cleanup;
     }
-    nr = fread(bmp, sizeof(bmp_header_t), 1, fp);
-    if(1 != nr) {
-        rval = errno;  // unable to read file
+
+    // the stream may not be able to seek, so buffer all of it up front
+    if(0 != (rval = io_read_all(io, &buf, &len))) {
         goto bmp_cleanup;
     }
 
-    // check some basic header vitals to make sure it's in a format we can work with
-    if((1 != bmp->bmi.num_planes) || 
-       (sizeof(bmi_header_t) != bmp->bmi.header_size) || 
-       (0 != bmp->dib.RES)) {  // invalid header
-        rval = BMP_INVALID;
+    if(NULL == (img = load_bmp_mem(buf, len))) {
+        rval = errno;
         goto bmp_cleanup;
     }
 
-    // basic checking for supported BMP formats
-    if((0 != bmp->bmi.compression) || (1 != bmp->bmi.num_planes)) { // we only support uncompressed single plane images
-        rval = BMP_UNSUPPORTED;
+    free_s(buf);
+    return img;
+bmp_cleanup:
+    free_s(buf);
+    errno = rval;
+    return NULL;
+}
+
+/// @brief loads a Windows BMP file by mapping it into memory and decoding the scanlines
+///        directly from the mapped pages. Must be a palletted 4 bit per pixel or 8 bit per
+///        pixel image, uncompressed or RLE
+/// @param fn pointer to the filename of the BMP to read
+/// @return pointer to a pal_image_t structure containing the image, or null on error with errno set/
+pal_image_t *load_bmp_mmap(const char *fn) {
+    int rval = 0;
+    io_map_t map = {NULL, 0, 0};
+    pal_image_t *img = NULL;
+
+    // do some basic error checking on the inputs
+    if(NULL == fn) {
+        rval = BMP_NULL_POINTER;
         goto bmp_cleanup;
     }
 
-    if(((4 != bmp->bmi.bits_per_pixel) && 
-       (8 != bmp->bmi.bits_per_pixel)) ||
-       (0 == bmp->bmi.num_colors)) { // we only support 4 and 8 BPP paletted images
-        rval = BMP_UNSUPPORTED;
+    if(0 != (rval = io_map_file(fn, &map))) {
         goto bmp_cleanup;
     }
 
-    // allocate image struct here
-    if(NULL == (img = image_alloc(bmp->bmi.image_width, bmp->bmi.image_height, (1 << bmp->bmi.bits_per_pixel), 0) )) {
+    if(NULL == (img = load_bmp_mem(map.data, map.len))) {
         rval = errno;
         goto bmp_cleanup;
     }
 
-    // load palette here
-    if(NULL == (pal = calloc(bmp->bmi.num_colors, sizeof(bmp_palette_entry_t)))) {
-        rval = errno;  // unable to allocate mem
+    io_unmap_file(&map);
+    return img;
+bmp_cleanup:
+    io_unmap_file(&map);
+    errno = rval;
+    return NULL;
+}
+
+/// @brief decodes a Windows BMP file that is already held in memory. Must be a palletted
+///        4 bit per pixel or 8 bit per pixel image, uncompressed or RLE
+/// @param buf pointer to the start of the BMP file data
+/// @param len length of the BMP file data in bytes
+/// @return pointer to a pal_image_t structure containing the image, or null on error with errno set/
+pal_image_t *load_bmp_mem(const uint8_t *buf, size_t len) {
+    pal_image_t *img = NULL;
+
+    int rval = bmp_decode(&img, buf, len);
+    if(BMP_NOERROR != rval) {
+        io_image_drop(img);
+        errno = rval;
+        return NULL;
+    }
+    return img;
+}
+
+/// @brief loads a Windows BMP file into an existing image, reusing its storage when it is 
+///        large enough. The file is mapped rather than read so no file buffer is allocated
+/// @param dst pointer to the image to decode into, which is replaced if it is too small
+/// @param fn pointer to the filename of the BMP to read
+/// @return 0 on success, otherwise an error code
+int load_bmp_into(pal_image_t **dst, const char *fn) {
+    int rval = 0;
+    io_map_t map = {NULL, 0, 0};
+
+    if((NULL == dst) || (NULL == fn)) return BMP_NULL_POINTER;
+
+    if(0 != (rval = io_map_file(fn, &map))) return rval;
+    rval = bmp_decode(dst, map.data, map.len);
+    io_unmap_file(&map);
+    return rval;
+}
+
+/// @brief decodes a Windows BMP file that is already held in memory into an existing image,
+///        reusing its storage when it is large enough
+/// @param dst pointer to the image to decode into, which is replaced if it is too small
+/// @param buf pointer to the start of the BMP file data
+/// @param len length of the BMP file data in bytes
+/// @return 0 on success, otherwise an error code
+int load_bmp_mem_into(pal_image_t **dst, const uint8_t *buf, size_t len) {
+    if(NULL == dst) return BMP_NULL_POINTER;
+    return bmp_decode(dst, buf, len);
+}
+
+pal_image_t *load_bmp_rect(const char *fn, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    int rval = BMP_NOERROR;
+    io_file_t f = {.fp = NULL, .fd = -1};
+    bmp_header_t bmp;
+    image_info_t info;
+    pal_image_t *img = NULL;
+    uint8_t *line = NULL;
+    uint8_t *packed = NULL;
+
+    // do some basic error checking on the inputs
+    if(NULL == fn) {
+        rval = BMP_NULL_POINTER;
         goto bmp_cleanup;
     }
 
-    // read the palette from the file
-    nr = fread(pal, sizeof(bmp_palette_entry_t), bmp->bmi.num_colors, fp);
-    if(bmp->bmi.num_colors != nr) {
-        rval = errno;  // can't read file
+    if(0 != (rval = io_open_file(fn, &f))) {
         goto bmp_cleanup;
     }
 
-    // copy the  BMP BGRA palette to the external RGB palette
-    for(int i = 0; i < bmp->bmi.num_colors; i++) {
-        img->pal[i].r = pal[i].r;
-        img->pal[i].g = pal[i].g;
-        img->pal[i].b = pal[i].b;
+    if(BMP_NOERROR != (rval = bmp_read_header(&f.io, &bmp, &info))) {
+        goto bmp_cleanup;
     }
 
-    // load in the image data here
-    rval = BMP_UNSUPPORTED;
-    if(4 == bmp->bmi.bits_per_pixel) rval = load_bmp4(img, bmp, fp);
-    if(8 == bmp->bmi.bits_per_pixel) rval = load_bmp8(img, bmp, fp);
-    if(BMP_NOERROR != rval) goto bmp_cleanup;
+    // the rectangle has to be inside the image
+    if((0 == w) || (0 == h) || (x >= info.width) || (y >= info.height) || 
+       (w > (info.width - x)) || (h > (info.height - y))) {
+        rval = BMP_INVALID;
+        goto bmp_cleanup;
+    }
+
+    if(BMP_RGB != bmp.bmi.compression) {
+        if(NULL == (img = load_bmp_rle_part(&f, x, y, w, h, 1))) {
+            rval = errno;
+            goto bmp_cleanup;
+        }
+        io_close_file(&f);
+        return img;
+    }
+
+    // if height is negative the lines are stored top down
+    bool flip = (bmp.bmi.image_height < 0);
+    uint32_t lw = info.width;
+    uint32_t lh = info.height;
+
+    // stride is the bytes per line in the BMP file, which are padded to 32 bit boundary
+    uint32_t stride = (4 == info.bits_per_pixel) ? ((((lw + 1) / 2) + 3) & (~0x0003)) : ((lw + 3) & (~0x0003));
+
+    // the bytes of each line that cover the rectangle, 4 bit lines start on a whole byte
+    // so an odd x has one extra pixel at the start
+    uint32_t x0 = x;
+    uint32_t nbytes = w;
+    if(4 == info.bits_per_pixel) {
+        x0 = x / 2;
+        nbytes = ((x + w + 1) / 2) - x0;
+        if((NULL == (packed = io_scratch_alloc(nbytes))) || (NULL == (line = io_scratch_alloc((size_t)nbytes * 2)))) {
+            rval = errno;  // unable to allocate mem
+            goto bmp_cleanup;
+        }
+    }
+
+    if(0 != (rval = io_image_reuse(&img, w, h, info.colours))) {
+        goto bmp_cleanup;
+    }
+    memcpy(img->pal, info.pal, info.colours * sizeof(img_pal_entry_t));
+
+    // the lines have a fixed stride, so each one is a single seek and read
+    for(uint32_t i = 0; i < h; i++) {
+        uint32_t fy = flip ? (y + i) : (lh - 1 - (y + i));
+        int64_t pos = (int64_t)bmp.dib.image_offset + ((int64_t)fy * stride) + x0;
+        uint8_t *dp = &img->pixels[(size_t)i * w];
+        uint8_t *rp = (4 == info.bits_per_pixel) ? packed : dp;
+        if((0 > io_seek(&f.io, pos, SEEK_SET)) || (0 != io_read_exact(&f.io, rp, nbytes))) {
+            rval = BMP_INVALID;  // truncated image data
+            goto bmp_cleanup;
+        }
+        if(4 == info.bits_per_pixel) {
+            io_unpack4(line, packed, nbytes * 2);
+            memcpy(dp, &line[x & 1], w);
+        }
+    }
+
+    free_s(packed);
+    free_s(line);
+    io_close_file(&f);
+    return img;
+bmp_cleanup:
+    free_s(packed);
+    free_s(line);
+    io_close_file(&f);
+    if(NULL != img) io_image_drop(img);
+    errno = rval;
+    return NULL;
+}
+
+pal_image_t *load_bmp_scaled(const char *fn, int scale) {
+    int rval = BMP_NOERROR;
+    io_file_t f = {.fp = NULL, .fd = -1};
+    bmp_header_t bmp;
+    image_info_t info;
+    pal_image_t *img = NULL;
+    uint8_t *line = NULL;
+
+    // do some basic error checking on the inputs
+    if(NULL == fn) {
+        rval = BMP_NULL_POINTER;
+        goto bmp_cleanup;
+    }
+    if(!io_scale_ok(scale)) {
+        rval = BMP_INVALID;
+        goto bmp_cleanup;
+    }
+
+    if(0 != (rval = io_open_file(fn, &f))) {
+        goto bmp_cleanup;
+    }
+
+    if(BMP_NOERROR != (rval = bmp_read_header(&f.io, &bmp, &info))) {
+        goto bmp_cleanup;
+    }
+
+    if(BMP_RGB != bmp.bmi.compression) {
+        if(NULL == (img = load_bmp_rle_part(&f, 0, 0, info.width, info.height, scale))) {
+            rval = errno;
+            goto bmp_cleanup;
+        }
+        io_close_file(&f);
+        return img;
+    }
+
+    // if height is negative the lines are stored top down
+    bool flip = (bmp.bmi.image_height < 0);
+    uint32_t lh = info.height;
+    uint32_t ow = IO_SCALED(info.width, scale);
+    uint32_t oh = IO_SCALED(info.height, scale);
+
+    // stride is the bytes per line in the BMP file, which are padded to 32 bit boundary
+    uint32_t stride = (4 == info.bits_per_pixel) ? ((((info.width + 1) / 2) + 3) & (~0x0003)) : ((info.width + 3) & (~0x0003));
+
+    // only read as far into each line as the last pixel we pick
+    uint32_t xl = (ow - 1) * scale;
+    uint32_t nbytes = (4 == info.bits_per_pixel) ? ((xl / 2) + 1) : (xl + 1);
+
+    if(NULL == (line = io_scratch_alloc(nbytes))) {
+        rval = errno;  // unable to allocate mem
+        goto bmp_cleanup;
+    }
 
+    if(0 != (rval = io_image_reuse(&img, ow, oh, info.colours))) {
+        goto bmp_cleanup;
+    }
+    memcpy(img->pal, info.pal, info.colours * sizeof(img_pal_entry_t));
+
+    // the lines have a fixed stride, so the ones we skip are never read
+    for(uint32_t i = 0; i < oh; i++) {
+        uint32_t y = i * scale;
+        uint32_t fy = flip ? y : (lh - 1 - y);
+        int64_t pos = (int64_t)bmp.dib.image_offset + ((int64_t)fy * stride);
+        if((0 > io_seek(&f.io, pos, SEEK_SET)) || (0 != io_read_exact(&f.io, line, nbytes))) {
+            rval = BMP_INVALID;  // truncated image data
+            goto bmp_cleanup;
+        }
 
-    fclose_s(fp);
-    free_s(pal);
-    free_s(bmp);
+        uint8_t *dp = &img->pixels[(size_t)i * ow];
+        if(4 == info.bits_per_pixel) { // scale is even when it is more than 1, so only a scale of 1 uses the low nibbles
+            for(uint32_t x = 0; x < ow; x++) {
+                uint32_t sx = x * scale;
+                uint8_t pix = line[sx / 2];
+                dp[x] = (sx & 1) ? (pix & 0x0f) : ((pix >> 4) & 0x0f);
+            }
+        } else {
+            io_pick(dp, line, ow, scale);
+        }
+    }
+
+    free_s(line);
+    io_close_file(&f);
     return img;
 bmp_cleanup:
-    fclose_s(fp);
-    free_s(pal);
-    free_s(bmp);
-    image_free(img);
+    free_s(line);
+    io_close_file(&f);
+    if(NULL != img) io_image_drop(img);
     errno = rval;
     return NULL;
 }
 
-static int load_bmp4(pal_image_t *img, bmp_header_t *bmp, FILE *fp) {
+static int bmp_decode(pal_image_t **dst, const uint8_t *buf, size_t len) {
+    int rval = 0;
+    pal_image_t *img = NULL;
+
+    // do some basic error checking on the inputs
+    if(NULL == buf) {
+        rval = BMP_NULL_POINTER;
+        goto bmp_cleanup;
+    }
+
+    // the decoder only ever reads from the source buffer
+    memstream_buf_t src = {.pos = 0, .len = len, .data = (uint8_t *)buf};
+
+    bmp_signature_t sig = 0;
+    uint8_t *p = io_take(&src, sizeof(bmp_signature_t));
+    if(NULL == p) {
+        rval = BMP_INVALID;  // too short to be a BMP file
+        goto bmp_cleanup;
+    }
+    memcpy(&sig, p, sizeof(bmp_signature_t));
+    if(BMPFILESIG != sig) { // not a BMP file
+        rval = BMP_INVALID;
+        goto bmp_cleanup;
+    }
+
+    // the header is not 32 bit aligned in the file, so copy it out rather than pointing at it
+    bmp_header_t bmp;
+    if(NULL == (p = io_take(&src, sizeof(bmp_header_t)))) {
+        rval = BMP_INVALID;  // truncated header
+        goto bmp_cleanup;
+    }
+    memcpy(&bmp, p, sizeof(bmp_header_t));
+
+    // make sure it's in a format we can work with
+    if(BMP_NOERROR != (rval = bmp_check_header(&bmp))) {
+        goto bmp_cleanup;
+    }
+
+    // the palette immediately follows the header
+    bmp_palette_entry_t *pal = (bmp_palette_entry_t *)io_take(&src, bmp.bmi.num_colors * sizeof(bmp_palette_entry_t));
+    if(NULL == pal) {
+        rval = BMP_INVALID;  // truncated palette
+        goto bmp_cleanup;
+    }
+
+    // get an image struct here, reusing the one we were given if it's big enough
+    if(0 != (rval = io_image_reuse(dst, bmp.bmi.image_width, abs(bmp.bmi.image_height), (1 << bmp.bmi.bits_per_pixel)))) {
+        goto bmp_cleanup;
+    }
+    img = *dst;
+
+    // copy the  BMP BGRA palette to the external RGB palette
+    image_pal_from_bgra(img->pal, (const uint8_t *)pal, bmp.bmi.num_colors);
+
+    // load in the image data here
+    rval = BMP_UNSUPPORTED;
+    if(BMP_RGB != bmp.bmi.compression) {
+        rval = load_bmp_rle(img, &bmp, &src);
+    } else if(4 == bmp.bmi.bits_per_pixel) {
+        rval = load_bmp4(img, &bmp, &src);
+    } else if(8 == bmp.bmi.bits_per_pixel) {
+        rval = load_bmp8(img, &bmp, &src);
+    }
+
+bmp_cleanup:
+    return rval;
+}
+
+int bmp_check_header(const bmp_header_t *bmp) {
+    // check some basic header vitals to make sure it's in a format we can work with
+    if((1 != bmp->bmi.num_planes) || 
+       (sizeof(bmi_header_t) != bmp->bmi.header_size) || 
+       (0 != bmp->dib.RES)) {  // invalid header
+        return BMP_INVALID;
+    }
+
+    // the image has to have some size, the height is checked before anything takes abs() of it
+    if((0 == bmp->bmi.image_width) || (0 == bmp->bmi.image_height) || 
+       (UINT16_MAX < bmp->bmi.image_width) || 
+       (-UINT16_MAX > bmp->bmi.image_height) || (UINT16_MAX < bmp->bmi.image_height)) {
+        return BMP_INVALID;
+    }
+
+    // basic checking for supported BMP formats
+    if(1 != bmp->bmi.num_planes) { // we only support single plane images
+        return BMP_UNSUPPORTED;
+    }
+
+    if(((4 != bmp->bmi.bits_per_pixel) && 
+       (8 != bmp->bmi.bits_per_pixel)) ||
+       (0 == bmp->bmi.num_colors)) { // we only support 4 and 8 BPP paletted images
+        return BMP_UNSUPPORTED;
+    }
+
+    // uncompressed, or the run length encoding that goes with the depth
+    uint32_t rle = (8 == bmp->bmi.bits_per_pixel) ? BMP_RLE8 : BMP_RLE4;
+    if((BMP_RGB != bmp->bmi.compression) && (rle != bmp->bmi.compression)) {
+        return BMP_UNSUPPORTED;
+    }
+
+    // the palette can't hold more entries than the pixel depth can address
+    if(bmp->bmi.num_colors > (1UL << bmp->bmi.bits_per_pixel)) {
+        return BMP_INVALID;
+    }
+
+    return BMP_NOERROR;
+}
+
+static int load_bmp4(pal_image_t *img, bmp_header_t *bmp, memstream_buf_t *src) {
     int rval = BMP_NOERROR;
-    uint8_t *buf = NULL; // line buffer
 
     // do some basic error checking on the inputs
-    if((NULL == fp) || (NULL == img) || (NULL == bmp)) {
+    if((NULL == src) || (NULL == img) || (NULL == bmp)) {
         rval = BMP_NULL_POINTER;  // NULL pointer error
         goto bmp_cleanup;
     }
@@ -149,17 +537,16 @@ static int load_bmp4(pal_image_t *img, bmp_header_t *bmp, FILE *fp) {
 
     // stride is the bytes per line in the BMP file, which are padded to 32 bit boundary
     // we get 2 pixels per byte for being 16 colour
-    uint32_t stride = ((lw + 3) & (~0x0003)) / 2; 
+    uint32_t stride = ((((lw + 1) / 2) + 3) & (~0x0003)); 
 
-    // allocate our line buffer
-    if(NULL == (buf = calloc(1, stride))) {
-        rval = errno;  // unable to allocate mem
+    // seek to the start of the image data, and make sure all of the scanlines are present
+    src->pos = bmp->dib.image_offset;
+    uint8_t *buf = io_take(src, (size_t)stride * lh);
+    if(NULL == buf) {
+        rval = BMP_INVALID;  // truncated image data
         goto bmp_cleanup;
     }
 
-    // seek to the start of the image data
-    fseek(fp, bmp->dib.image_offset, SEEK_SET);
-
     // now we need to read the image scanlines. 
     // start by pointing to start of last line of data
     size_t img_len = lw * lh;
@@ -167,23 +554,12 @@ static int load_bmp4(pal_image_t *img, bmp_header_t *bmp, FILE *fp) {
     if(flip) px = img->pixels; // if flipped, start at beginning
     // loop through the lines
     for(int y = 0; y < lh; y++) {
-        int nr = fread(buf, stride, 1, fp); // read a line
-        if(1 != nr) {
-            rval = errno;  // unable to read file
-            goto bmp_cleanup;
-        }
-
-        // loop through all the pixels for a line
-        // we are packing 2 pixels per byte, so width is half
-        for(int x = 0; x < ((lw + 1) / 2); x++) {
-            uint8_t sp = buf[x];      // get the pixel pair
-            *px++ = (sp >> 4) & 0x0f; // write the 1st pixel
-            if((x * 2 + 1) < lw) {    // test for odd pixel end
-                *px++ = sp & 0x0f;    // write the 2nd pixel
-            }
-        }
-        if(!flip) { // if not flipped, we have to walk backwards
-            px -= (lw * 2); // move back to start of previous line
+        io_unpack4(px, buf, lw);
+        buf += stride; // advance to the next line in the file
+        if(flip) { // if flipped, lines are in natural order
+            px += lw;
+        } else {   // if not flipped, we have to walk backwards
+            px -= lw; // move back to start of previous line
         }
     }
 
@@ -191,16 +567,14 @@ static int load_bmp4(pal_image_t *img, bmp_header_t *bmp, FILE *fp) {
     img->height = lh;
 
 bmp_cleanup:
-    free_s(buf);
     return rval;
 }
 
-static int load_bmp8(pal_image_t *img, bmp_header_t *bmp, FILE *fp) {
+static int load_bmp8(pal_image_t *img, bmp_header_t *bmp, memstream_buf_t *src) {
     int rval = BMP_NOERROR;
-    uint8_t *buf = NULL; // line buffer
 
     // do some basic error checking on the inputs
-    if((NULL == fp) || (NULL == img) || (NULL == bmp)) {
+    if((NULL == src) || (NULL == img) || (NULL == bmp)) {
         rval = BMP_NULL_POINTER;  // NULL pointer error
         goto bmp_cleanup;
     }
@@ -216,15 +590,14 @@ static int load_bmp8(pal_image_t *img, bmp_header_t *bmp, FILE *fp) {
     // we get 1 pixels per byte for being 256 colour
     uint32_t stride = ((lw + 3) & (~0x0003)); 
 
-    // allocate our line buffer
-    if(NULL == (buf = calloc(1, stride))) {
-        rval = errno;  // unable to allocate mem
+    // seek to the start of the image data, and make sure all of the scanlines are present
+    src->pos = bmp->dib.image_offset;
+    uint8_t *buf = io_take(src, (size_t)stride * lh);
+    if(NULL == buf) {
+        rval = BMP_INVALID;  // truncated image data
         goto bmp_cleanup;
     }
 
-    // seek to the start of the image data
-    fseek(fp, bmp->dib.image_offset, SEEK_SET);
-
     // now we need to read the image scanlines. 
     // start by pointing to start of last line of data
     size_t img_len = lw * lh;
@@ -232,18 +605,12 @@ static int load_bmp8(pal_image_t *img, bmp_header_t *bmp, FILE *fp) {
     if(flip) px = img->pixels; // if flipped, start at beginning
     // loop through the lines
     for(int y = 0; y < lh; y++) {
-        int nr = fread(buf, stride, 1, fp); // read a line
-        if(1 != nr) {
-            rval = errno;  // unable to read file
-            goto bmp_cleanup;
-        }
-
-        // loop through all the pixels for a line
-        for(int x = 0; x < lw; x++) {
-            *px++ = buf[x];
-        }
-        if(!flip) { // if not flipped, we have to walk backwards
-            px -= (lw * 2); // move back to start of previous line
+        memcpy(px, buf, lw);  // copy the pixels for the line
+        buf += stride;        // advance to the next line in the file
+        if(flip) { // if flipped, lines are in natural order
+            px += lw;
+        } else {   // if not flipped, we have to walk backwards
+            px -= lw; // move back to start of previous line
         }
     }
 
@@ -251,6 +618,124 @@ static int load_bmp8(pal_image_t *img, bmp_header_t *bmp, FILE *fp) {
     img->height = lh;
 
 bmp_cleanup:
-    free_s(buf);
     return rval;
 }
+
+static int load_bmp_rle(pal_image_t *img, bmp_header_t *bmp, memstream_buf_t *src) {
+    int rval = BMP_NOERROR;
+
+    // do some basic error checking on the inputs
+    if((NULL == src) || (NULL == img) || (NULL == bmp)) {
+        rval = BMP_NULL_POINTER;  // NULL pointer error
+        goto bmp_cleanup;
+    }
+
+    // if height is negative the lines are stored top down
+    bool flip = (bmp->bmi.image_height < 0);
+
+    // the compressed data runs from the image offset to the end of the file, bitmap_size
+    // isn't always filled in so it isn't relied on
+    if(bmp->dib.image_offset > src->len) {
+        rval = BMP_INVALID;  // truncated image data
+        goto bmp_cleanup;
+    }
+    src->pos = bmp->dib.image_offset;
+    size_t len = src->len - src->pos;
+    uint8_t *buf = io_take(src, len);
+
+    rval = bmp_rle_decode(img->pixels, img->width, img->height, flip, bmp->bmi.bits_per_pixel, buf, len);
+
+bmp_cleanup:
+    return rval;
+}
+
+int bmp_rle_decode(uint8_t *pixels, uint32_t width, uint32_t height, bool flip, int bpp, const uint8_t *src, size_t len) {
+    const uint8_t *end = src + len;
+    uint32_t x = 0;
+    uint32_t y = 0; // line in file order, so the bottom line unless flipped
+
+    // the escapes can skip pixels without setting them
+    memset(pixels, 0, (size_t)width * height);
+
+    // a run or absolute span that goes past the end of the line is cut short rather than 
+    // wrapping onto the next, x never goes beyond the width
+    while(y < height) {
+        if(2 > (end - src)) return BMP_INVALID;  // truncated, there was no end of bitmap
+        uint8_t n = src[0];
+        uint8_t v = src[1];
+        src += 2;
+
+        uint8_t *row = &pixels[(size_t)(flip ? y : (height - 1 - y)) * width];
+        uint32_t room = width - x;
+        if(0 != n) { // a run of n pixels, for RLE4 taking turns between the 2 nibbles of v
+            uint32_t cnt = (n < room) ? n : room;
+            if((8 == bpp) || ((v >> 4) == (v & 0x0f))) {
+                memset(&row[x], (8 == bpp) ? v : (v & 0x0f), cnt);
+            } else {
+                for(uint32_t i = 0; i < cnt; i++) row[x + i] = (i & 1) ? (v & 0x0f) : (v >> 4);
+            }
+            x += cnt;
+        } else if(0 == v) { // end of line
+            x = 0;
+            y++;
+        } else if(1 == v) { // end of bitmap
+            break;
+        } else if(2 == v) { // delta, the next 2 bytes move right and up
+            if(2 > (end - src)) return BMP_INVALID;
+            x = (src[0] < room) ? (x + src[0]) : width;
+            y += src[1];
+            src += 2;
+        } else { // absolute mode, v pixels as they are, padded to a 16 bit boundary
+            size_t nb = (((8 == bpp) ? v : ((v + 1) / 2)) + 1) & ~((size_t)1);
+            if(nb > (size_t)(end - src)) return BMP_INVALID;
+            uint32_t cnt = (v < room) ? v : room;
+            if(8 == bpp) {
+                memcpy(&row[x], src, cnt);
+            } else {
+                io_unpack4(&row[x], src, cnt);
+            }
+            x += cnt;
+            src += nb;
+        }
+    }
+
+    return BMP_NOERROR;
+}
+
+static pal_image_t *load_bmp_rle_part(io_file_t *f, uint32_t x, uint32_t y, uint32_t w, uint32_t h, int scale) {
+    int rval = BMP_NOERROR;
+    uint8_t *buf = NULL;
+    size_t len = 0;
+    pal_image_t *full = NULL;
+    pal_image_t *img = NULL;
+
+    if((0 > io_seek(&f->io, 0, SEEK_SET)) || (0 != (rval = io_read_all(&f->io, &buf, &len)))) {
+        if(0 == rval) rval = errno;
+        goto bmp_cleanup;
+    }
+    if(BMP_NOERROR != (rval = bmp_decode(&full, buf, len))) {
+        goto bmp_cleanup;
+    }
+
+    uint32_t ow = IO_SCALED(w, scale);
+    uint32_t oh = IO_SCALED(h, scale);
+    if(0 != (rval = io_image_reuse(&img, ow, oh, full->colours))) {
+        goto bmp_cleanup;
+    }
+    memcpy(img->pal, full->pal, full->colours * sizeof(img_pal_entry_t));
+
+    for(uint32_t i = 0; i < oh; i++) {
+        const uint8_t *sp = &full->pixels[((size_t)(y + (i * scale)) * full->width) + x];
+        io_pick(&img->pixels[(size_t)i * ow], sp, ow, scale);
+    }
+
+    free_s(buf);
+    io_image_drop(full);
+    return img;
+bmp_cleanup:
+    free_s(buf);
+    if(NULL != full) io_image_drop(full);
+    if(NULL != img) io_image_drop(img);
+    errno = rval;
+    return NULL;
+}
@@ -6,13 +6,14 @@
  * personally or commercially, just give credit if you do.
  */
 #include <stdint.h>
+#include <stdbool.h>
 #include <image_bmp.h>
 
 #ifndef CA_IMG_BMP_INTERNAL
 #define CA_IMG_BMP_INTERNAL
 
 #define fclose_s(A) if(A) fclose(A); A=NULL
-#define free_s(A) if(A) free(A); A=NULL
+#define free_s(A) if(A) io_free(A); A=NULL
 
 typedef struct {
     uint8_t b;
@@ -30,6 +31,10 @@ typedef struct {
 	uint32_t  image_offset;  // File offset to image raster data
 } dib_header_t;
 
+#define BMP_RGB  (0) // uncompressed
+#define BMP_RLE8 (1) // run length encoded 8 bit pixels
+#define BMP_RLE4 (2) // run length encoded 4 bit pixels
+
 #define BMP72DPI (2835) // 72 DPI converted to PPM
 #define BMP96DPI (3780) // 96 DPI converted to PPM
 typedef struct {
@@ -38,7 +43,7 @@ typedef struct {
 	int32_t   image_height;      // bitmap height (can be -ive to flip scan order)
 	uint16_t  num_planes;        // Number of planes (must be 1)
 	uint16_t  bits_per_pixel;    // 1,4,8,18,24 (some versions support 2 and 32)
-	uint32_t  compression;       // 0 = uncompressed
+	uint32_t  compression;       // BMP_RGB, BMP_RLE8 or BMP_RLE4
 	uint32_t  bitmap_size;       // Size of image or can be left at 0
 	uint32_t  horiz_res;         // horizontal Pixels per meter (PPM)
 	uint32_t  vert_res;          // vertical pixels per meter (PPM)
@@ -51,4 +56,43 @@ typedef struct {
     bmi_header_t bmi;
 } bmp_header_t;
 
+#define HDRBUFSZ (sizeof(bmp_signature_t) + sizeof(bmp_header_t)) // bytes before the palette
+
+/// @brief checks the header vitals to make sure the BMP is in a format we can work with
+/// @param bmp pointer to the header read from the file
+/// @return 0 if the BMP is supported, otherwise an error code
+int bmp_check_header(const bmp_header_t *bmp);
+
+/// @brief reads the signature, headers and palette of a BMP from a stream, leaving the
+///        stream just after the palette
+/// @param io pointer to the image_io_t to read from
+/// @param bmp pointer to receive the header read from the file
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int bmp_read_header(image_io_t *io, bmp_header_t *bmp, image_info_t *info);
+
+/// @brief fills in the signature, header and palette at the start of a BMP file buffer
+/// @param buf pointer to the start of the file buffer, with room for HDRBUFSZ plus the palette
+/// @param width width of the image in pixels
+/// @param height height of the image in pixels, negative for lines stored top down
+/// @param pal pointer to the palette, which must have (1 << bpp) entries
+/// @param bpp bits per pixel of the encoded image (4 or 8)
+/// @param compression BMP_RGB, or the BMP_RLE8 or BMP_RLE4 that goes with bpp
+/// @param image_size bytes of image data that will follow the palette
+/// @return number of bytes written to the buffer, which is also the offset to the image data
+size_t bmp_write_header(uint8_t *buf, uint32_t width, int32_t height, const img_pal_entry_t *pal, int bpp, 
+                        uint32_t compression, uint32_t image_size);
+
+/// @brief decodes BMP_RLE8 or BMP_RLE4 image data, with its end of line, end of bitmap and
+///        delta escapes. Pixels the data skips over are left as colour 0
+/// @param pixels pointer to receive the width * height pixels, top line first
+/// @param width width of the image in pixels
+/// @param height height of the image in pixels
+/// @param flip true if the lines are stored top down
+/// @param bpp bits per pixel of the encoded image, 8 for BMP_RLE8 or 4 for BMP_RLE4
+/// @param src pointer to the compressed data
+/// @param len length of the compressed data in bytes
+/// @return 0 on success, otherwise an error code (BMP_INVALID if the data is truncated)
+int bmp_rle_decode(uint8_t *pixels, uint32_t width, uint32_t height, bool flip, int bpp, const uint8_t *src, size_t len);
+
 #endif
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <string.h>
+#include <image_bmp.h>
+#include "bmp_priv.h"
+#include "../io/io_priv.h"
+#include <stdbool.h>
+#include <errno.h>
+
+/// @brief reads only the signature, headers and palette of a Windows BMP file
+/// @param fn pointer to the filename of the BMP to probe
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int probe_bmp(const char *fn, image_info_t *info) {
+    if((NULL == fn) || (NULL == info)) return BMP_NULL_POINTER;
+    return io_probe_file(fn, info, probe_bmp_io);
+}
+
+/// @brief reads only the signature, headers and palette of a Windows BMP image from a stream
+/// @param io pointer to the image_io_t to read from
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int probe_bmp_io(image_io_t *io, image_info_t *info) {
+    bmp_header_t bmp;
+
+    if((NULL == io) || (NULL == info)) return BMP_NULL_POINTER;
+    return bmp_read_header(io, &bmp, info);
+}
+
+int bmp_read_header(image_io_t *io, bmp_header_t *bmp, image_info_t *info) {
+    int rval = BMP_NOERROR;
+    uint8_t hdr[HDRBUFSZ];
+    bmp_palette_entry_t pal[256];
+
+    // the signature and header are read together
+    if(0 != io_read_exact(io, hdr, HDRBUFSZ)) {
+        return BMP_INVALID;  // too short to be a BMP file
+    }
+
+    bmp_signature_t sig = 0;
+    memcpy(&sig, hdr, sizeof(bmp_signature_t));
+    if(BMPFILESIG != sig) { // not a BMP file
+        return BMP_INVALID;
+    }
+
+    memcpy(bmp, &hdr[sizeof(bmp_signature_t)], sizeof(bmp_header_t));
+
+    // make sure it's in a format we can work with
+    if(BMP_NOERROR != (rval = bmp_check_header(bmp))) {
+        return rval;
+    }
+
+    // the palette immediately follows the header
+    if(0 != io_read_exact(io, pal, bmp->bmi.num_colors * sizeof(bmp_palette_entry_t))) {
+        return BMP_INVALID;  // truncated palette
+    }
+
+    memset(info, 0, sizeof(image_info_t));
+    info->format = IMAGE_FMT_BMP;
+    info->width = bmp->bmi.image_width;
+    info->height = abs(bmp->bmi.image_height);
+    info->bits_per_pixel = bmp->bmi.bits_per_pixel;
+    info->colours = (1 << bmp->bmi.bits_per_pixel);
+    info->transparent = -1; // BMP has no transparency
+    info->pixel_offset = bmp->dib.image_offset;
+
+    // copy the  BMP BGRA palette to the external RGB palette
+    image_pal_from_bgra(info->pal, (const uint8_t *)pal, bmp->bmi.num_colors);
+
+    return BMP_NOERROR;
+}
@@ -1,117 +1,192 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "bmp_priv.h"
+#include "../io/io_priv.h"
 #include <image_bmp.h>
 #include <stdbool.h>
 #include <errno.h>
 
-#define HDRBUFSZ (sizeof(bmp_signature_t) + sizeof(bmp_header_t))
+/// @brief encodes the image pointed to by src as a BMP, assumes 256 colour 1 byte per pixel image data
+/// @param src pointer to a structure containing the image
+/// @param segs pointer to an empty segment list to receive the pieces of the BMP file
+/// @return 0 on success, otherwise an error code
+static int save_bmp8(pal_image_t *src, io_segs_t *segs);
 
-/// @brief saves the image pointed to by src as a BMP, assumes 256 colour 1 byte per pixel image data
-/// @param fn name of the file to create and write to
+/// @brief encodes the image pointed to by src as a BMP, assumes 16 colour 1 byte per pixel image data
 /// @param src pointer to a structure containing the image
+/// @param segs pointer to an empty segment list to receive the pieces of the BMP file
 /// @return 0 on success, otherwise an error code
-static int save_bmp8(const char *fn, pal_image_t *src);
+static int save_bmp4(pal_image_t *src, io_segs_t *segs);
 
-/// @brief saves the image pointed to by src as a BMP, assumes 16 colour 1 byte per pixel image data
-/// @param fn name of the file to create and write to
+/// @brief encodes the image pointed to by src as a run length encoded BMP, BI_RLE8 for 256
+///        colours or BI_RLE4 for 16, assumes 1 byte per pixel image data
 /// @param src pointer to a structure containing the image
+/// @param segs pointer to an empty segment list to receive the pieces of the BMP file
 /// @return 0 on success, otherwise an error code
-static int save_bmp4(const char *fn, pal_image_t *src);
+static int save_bmp_rle(pal_image_t *src, io_segs_t *segs);
+
+/// @brief encodes an image as a 4 bit or 8 bit BMP into a list of pieces to be written
+/// @param img pointer to the pal_image_t structure containing the image
+/// @param opts pointer to the save options, or NULL for the defaults
+/// @param segs pointer to an empty segment list to receive the pieces of the BMP file
+/// @return 0 on success otherwise an error value
+static int bmp_encode(pal_image_t *img, const bmp_save_opts_t *opts, io_segs_t *segs);
 
 /// @brief saves an image as a 4 bit or 8 bit Windows BMP image
 /// @param fn pointer to the name of the file to save the image as
 /// @param img pointer to the pal_image_t structure containing the image
 /// @return 0 on success otherwise an error value
 int save_bmp(const char *fn, pal_image_t *img) {
+    return save_bmp_opts(fn, img, NULL);
+}
+
+/// @brief saves an image as a 4 bit or 8 bit Windows BMP image, optionally run length encoded
+/// @param fn pointer to the name of the file to save the image as
+/// @param img pointer to the pal_image_t structure containing the image
+/// @param opts pointer to the save options, or NULL for the defaults
+/// @return 0 on success otherwise an error value
+int save_bmp_opts(const char *fn, pal_image_t *img, const bmp_save_opts_t *opts) {
+    io_segs_t segs = {0};
+
     if((NULL == img) || (NULL == fn)) return BMP_NULL_POINTER;
 
-    if((0 == img->width) || (0 == img->height)) return BMP_INVALID;
+    // build the pieces of the file, then send them out in one go
+    int rval = bmp_encode(img, opts, &segs);
+    if(BMP_NOERROR == rval) {
+        rval = io_write_file(fn, &segs);
+    }
 
-    if(16 == img->colours) return save_bmp4(fn, img);
-    if(256 == img->colours) return save_bmp8(fn, img);
-    return BMP_INVALID;
+    io_segs_free(&segs);
+    return rval;
 }
 
-static int save_bmp8(const char *fn, pal_image_t *img) {
-    int rval = 0;
-    FILE *fp = NULL;
-    uint8_t *buf = NULL; // line buffer, also holds header info
-    bmp_palette_entry_t *pal = NULL;
+/// @brief saves an image as a 4 bit or 8 bit Windows BMP image to a stream
+/// @param io pointer to the image_io_t to write the BMP to
+/// @param img pointer to the pal_image_t structure containing the image
+/// @return 0 on success otherwise an error value
+int save_bmp_io(image_io_t *io, pal_image_t *img) {
+    return save_bmp_io_opts(io, img, NULL);
+}
 
-    // try to open/create output file
-    if(NULL == (fp = fopen(fn,"wb"))) {
-        rval = errno;  // can't open/create output file
-        goto bmp_cleanup;
+/// @brief saves an image as a 4 bit or 8 bit Windows BMP image to a stream, optionally run length encoded
+/// @param io pointer to the image_io_t to write the BMP to
+/// @param img pointer to the pal_image_t structure containing the image
+/// @param opts pointer to the save options, or NULL for the defaults
+/// @return 0 on success otherwise an error value
+int save_bmp_io_opts(image_io_t *io, pal_image_t *img, const bmp_save_opts_t *opts) {
+    io_segs_t segs = {0};
+
+    if((NULL == img) || (NULL == io)) return BMP_NULL_POINTER;
+
+    // build the pieces of the file, then send them out in one go
+    int rval = bmp_encode(img, opts, &segs);
+    if(BMP_NOERROR == rval) {
+        rval = io_write_segs(io, &segs);
     }
 
-    // stride is the bytes per line in the BMP file, which are padded
-    // out to 32 bit boundaries
-    uint32_t stride = ((img->width + 3) & (~0x0003)); 
-    uint32_t bmp_img_sz = (stride) * img->height;
+    io_segs_free(&segs);
+    return rval;
+}
 
-    // allocate a buffer to hold the header and a single scanline of data
-    // this could be optimized if necessary to only allocate the larger of
-    // the line buffer, or the header + padding as they are used at mutually
-    // exclusive times
-    if(NULL == (buf = calloc(1, HDRBUFSZ + stride + 2))) {
-        rval = errno;  // unable to allocate mem
-        goto bmp_cleanup;
+/// @brief encodes an image as a 4 bit or 8 bit Windows BMP image in memory
+/// @param img pointer to the pal_image_t structure containing the image
+/// @param buf pointer to receive the allocated buffer holding the BMP file, release with free()
+/// @param len pointer to receive the length of the BMP file in bytes
+/// @return 0 on success otherwise an error value
+int save_bmp_mem(pal_image_t *img, uint8_t **buf, size_t *len) {
+    return save_bmp_mem_opts(img, buf, len, NULL);
+}
+
+/// @brief encodes an image as a 4 bit or 8 bit Windows BMP image in memory, optionally run length encoded
+/// @param img pointer to the pal_image_t structure containing the image
+/// @param buf pointer to receive the allocated buffer holding the BMP file, release with free()
+/// @param len pointer to receive the length of the BMP file in bytes
+/// @param opts pointer to the save options, or NULL for the defaults
+/// @return 0 on success otherwise an error value
+int save_bmp_mem_opts(pal_image_t *img, uint8_t **buf, size_t *len, const bmp_save_opts_t *opts) {
+    io_segs_t segs = {0};
+
+    if((NULL == img) || (NULL == buf) || (NULL == len)) return BMP_NULL_POINTER;
+
+    int rval = bmp_encode(img, opts, &segs);
+    if(BMP_NOERROR == rval) {
+        rval = io_segs_flatten(&segs, buf, len);
     }
 
-    // signature starts after padding to maintain 32bit alignment for the rest of the header
-    bmp_signature_t *sig = (bmp_signature_t *)&buf[stride + 2];
+    io_segs_free(&segs);
+    return rval;
+}
+
+static int bmp_encode(pal_image_t *img, const bmp_save_opts_t *opts, io_segs_t *segs) {
+    if((0 == img->width) || (0 == img->height)) return BMP_INVALID;
+    if((16 != img->colours) && (256 != img->colours)) return BMP_INVALID;
 
-    // bmp header starts after signature
-    bmp_header_t *bmp = (bmp_header_t *)&buf[stride + 2 + sizeof(bmp_signature_t)];
+    int compression = (NULL != opts) ? opts->compression : BMP_COMPRESS_NONE;
+    if(BMP_COMPRESS_RLE == compression) return save_bmp_rle(img, segs);
+    if(BMP_COMPRESS_NONE != compression) return BMP_INVALID;
+
+    if(16 == img->colours) return save_bmp4(img, segs);
+    return save_bmp8(img, segs);
+}
+
+size_t bmp_write_header(uint8_t *buf, uint32_t width, int32_t height, const img_pal_entry_t *pal, int bpp, 
+                        uint32_t compression, uint32_t image_size) {
+    int colours = (1 << bpp);
+    uint32_t bmp_img_sz = image_size;
+    size_t palsz = sizeof(bmp_palette_entry_t) * colours;
 
     // setup the signature and DIB header fields
-    *sig = BMPFILESIG;
-    size_t palsz = sizeof(bmp_palette_entry_t) * 256;
-    bmp->dib.image_offset = HDRBUFSZ + palsz;
-    bmp->dib.file_size = bmp->dib.image_offset + bmp_img_sz;
+    bmp_signature_t sig = BMPFILESIG;
+    bmp_header_t bmp;
+    memset(&bmp, 0, sizeof(bmp_header_t));
+    bmp.dib.image_offset = HDRBUFSZ + palsz;
+    bmp.dib.file_size = bmp.dib.image_offset + bmp_img_sz;
 
     // setup the bmi header fields
-    bmp->bmi.header_size = sizeof(bmi_header_t);
-    bmp->bmi.image_width = img->width;
-    bmp->bmi.image_height = img->height;
-    bmp->bmi.num_planes = 1;           // always 1
-    bmp->bmi.bits_per_pixel = 8;       // 256 colour image
-    bmp->bmi.compression = 0;          // uncompressed
-    bmp->bmi.bitmap_size = bmp_img_sz;
-    bmp->bmi.horiz_res = BMP96DPI;
-    bmp->bmi.vert_res = BMP96DPI;
-    bmp->bmi.num_colors = 256;         // palette has 256 colours
-    bmp->bmi.important_colors = 0;     // all colours are important
-
-    // write out the header
-    int nr = fwrite(sig, HDRBUFSZ, 1, fp);
-    if(1 != nr) {
-        rval = errno;  // unable to write file
-        goto bmp_cleanup;
-    }
-
-    pal = calloc(256, sizeof(bmp_palette_entry_t));
-    if(NULL == pal) {
-        rval = errno;  // unable to allocate mem
-        goto bmp_cleanup;
-    }
+    bmp.bmi.header_size = sizeof(bmi_header_t);
+    bmp.bmi.image_width = width;
+    bmp.bmi.image_height = height;
+    bmp.bmi.num_planes = 1;           // always 1
+    bmp.bmi.bits_per_pixel = bpp;     // 16 or 256 colour image
+    bmp.bmi.compression = compression; // uncompressed, or RLE to suit the depth
+    bmp.bmi.bitmap_size = bmp_img_sz;
+    bmp.bmi.horiz_res = BMP96DPI;
+    bmp.bmi.vert_res = BMP96DPI;
+    bmp.bmi.num_colors = colours;     // palette has 16 or 256 colours
+    bmp.bmi.important_colors = 0;     // all colours are important
+
+    // the header is not 32 bit aligned in the file, so copy it in rather than pointing at it
+    memcpy(buf, &sig, sizeof(bmp_signature_t));
+    memcpy(buf + sizeof(bmp_signature_t), &bmp, sizeof(bmp_header_t));
 
     // copy the external RGB palette to the BMP BGRA palette
-    for(int i = 0; i < 256; i++) {
-        pal[i].r = img->pal[i].r;
-        pal[i].g = img->pal[i].g;
-        pal[i].b = img->pal[i].b;
-    }
+    image_pal_to_bgra(buf + HDRBUFSZ, pal, colours, 0, -1);
 
-    // write out the palette
-    nr = fwrite(pal, palsz, 1, fp);
-    if(1 != nr) {
-        rval = errno;  // can't write file
+    return bmp.dib.image_offset;
+}
+
+static int save_bmp8(pal_image_t *img, io_segs_t *segs) {
+    int rval = 0;
+
+    // stride is the bytes per line in the BMP file, which are padded
+    // out to 32 bit boundaries
+    uint32_t stride = ((img->width + 3) & (~0x0003)); 
+    size_t hdrsz = HDRBUFSZ + (sizeof(bmp_palette_entry_t) * 256);
+
+    // when there is no padding the scanlines can be written straight from the image,
+    // otherwise we need room to build the padded lines after the header
+    bool direct = (stride == img->width);
+    size_t bufsz = hdrsz + (direct ? 0 : ((size_t)stride * img->height));
+
+    // zeroed, so any line padding is already taken care of
+    if(NULL == (segs->buf = io_scratch_calloc(1, bufsz))) {
+        rval = errno;  // unable to allocate mem
         goto bmp_cleanup;
     }
-    // we can free the BMP palette now as we don't need it anymore
-    free_s(pal);
+
+    uint8_t *dp = segs->buf + bmp_write_header(segs->buf, img->width, img->height, img->pal, 8, BMP_RGB, stride * img->height);
+    if(0 != (rval = io_segs_add(segs, segs->buf, hdrsz))) goto bmp_cleanup;
 
     // now we need to output the image scanlines. For maximum
     // compatibility we do so in the natural order for BMP
@@ -121,105 +196,37 @@ static int save_bmp8(const char *fn, pal_image_t *img) {
     uint8_t *px = &img->pixels[img_len - img->width];
     // loop through the lines
     for(int y = 0; y < img->height; y++) {
-        memset(buf, 0, stride); // zero out the line in the output buffer
-        // loop through all the pixels for a line
-        for(int x = 0; x < img->width; x++) {
-            buf[x] = *px++;
-        }
-        nr = fwrite(buf, stride, 1, fp); // write out the line
-        if(1 != nr) {
-            rval = errno;  // unable to write file
-            goto bmp_cleanup;
+        if(direct) { // point straight at the line in the image
+            rval = io_segs_add(segs, px, stride);
+        } else {     // copy the pixels for the line into the padded line
+            memcpy(dp, px, img->width);
+            rval = io_segs_add(segs, dp, stride);
+            dp += stride;
         }
-        px -= (img->width * 2); // move back to start of previous line
+        if(0 != rval) goto bmp_cleanup;
+        px -= img->width; // move back to start of previous line
     }
 
 bmp_cleanup:
-    free_s(pal);
-    fclose_s(fp);
-    free_s(buf);
     return rval;
 }
 
-static int save_bmp4(const char *fn, pal_image_t *img) {
+static int save_bmp4(pal_image_t *img, io_segs_t *segs) {
     int rval = 0;
-    FILE *fp = NULL;
-    uint8_t *buf = NULL; // line buffer, also holds header info
-    bmp_palette_entry_t *pal = NULL;
-    
-    // try to open/create output file
-    if(NULL == (fp = fopen(fn,"wb"))) {
-        rval = errno;  // can't open/create output file
-        goto bmp_cleanup;
-    }
 
     // stride is the bytes per line in the BMP file, which are padded
     // out to 32 bit boundaries
     uint32_t stride = ((((img->width + 1) / 2) + 3) & (~0x0003)); // we get 2 pixels per byte for being 16 colour
-    uint32_t bmp_img_sz = (stride) * img->height;
-
-    // allocate a buffer to hold the header and a single scanline of data
-    // this could be optimized if necessary to only allocate the larger of
-    // the line buffer, or the header + padding as they are used at mutually
-    // exclusive times
-    if(NULL == (buf = calloc(1, HDRBUFSZ + stride + 2))) {
-        rval = errno;  // unable to allocate mem
-        goto bmp_cleanup;
-    }
-
-    // signature starts after padding to maintain 32bit alignment for the rest of the header
-    bmp_signature_t *sig = (bmp_signature_t *)&buf[stride + 2];
-
-    // bmp header starts after signature
-    bmp_header_t *bmp = (bmp_header_t *)&buf[stride + 2 + sizeof(bmp_signature_t)];
-
-    // setup the signature and DIB header fields
-    *sig = BMPFILESIG;
-    size_t palsz = sizeof(bmp_palette_entry_t) * 16;
-    bmp->dib.image_offset = HDRBUFSZ + palsz;
-    bmp->dib.file_size = bmp->dib.image_offset + bmp_img_sz;
-
-    // setup the bmi header fields
-    bmp->bmi.header_size = sizeof(bmi_header_t);
-    bmp->bmi.image_width = img->width;
-    bmp->bmi.image_height = img->height;
-    bmp->bmi.num_planes = 1;           // always 1
-    bmp->bmi.bits_per_pixel = 4;       // 16 colour image
-    bmp->bmi.compression = 0;          // uncompressed
-    bmp->bmi.bitmap_size = bmp_img_sz;
-    bmp->bmi.horiz_res = BMP96DPI;
-    bmp->bmi.vert_res = BMP96DPI;
-    bmp->bmi.num_colors = 16;          // palette has 16 colours
-    bmp->bmi.important_colors = 0;     // all colours are important
-
-    // write out the header
-    int nr = fwrite(sig, HDRBUFSZ, 1, fp);
-    if(1 != nr) {
-        rval = errno;  // unable to write file
-        goto bmp_cleanup;
-    }
+    size_t fsz = HDRBUFSZ + (sizeof(bmp_palette_entry_t) * 16) + ((size_t)stride * img->height);
 
-    pal = calloc(16, sizeof(bmp_palette_entry_t));
-    if(NULL == pal) {
+    // the pixels have to be packed, so the whole file is built in the scratch buffer
+    // zeroed, so any line padding is already taken care of
+    if(NULL == (segs->buf = io_scratch_calloc(1, fsz))) {
         rval = errno;  // unable to allocate mem
         goto bmp_cleanup;
     }
 
-    // copy the external RGB palette to the BMP BGRA palette
-    for(int i = 0; i < 16; i++) {
-        pal[i].r = img->pal[i].r;
-        pal[i].g = img->pal[i].g;
-        pal[i].b = img->pal[i].b;
-    }
-
-    // write out the palette
-    nr = fwrite(pal, palsz, 1, fp);
-    if(1 != nr) {
-        rval = errno;  // can't write file
-        goto bmp_cleanup;
-    }
-    // we can free the palette now as we don't need it anymore
-    free_s(pal);
+    uint8_t *dp = segs->buf + bmp_write_header(segs->buf, img->width, img->height, img->pal, 4, BMP_RGB, stride * img->height);
 
     // now we need to output the image scanlines. For maximum
     // compatibility we do so in the natural order for BMP
@@ -231,28 +238,105 @@ static int save_bmp4(const char *fn, pal_image_t *img) {
     uint8_t *px = &img->pixels[img_len - img->width];
     // loop through the lines
     for(int y = 0; y < img->height; y++) {
-        memset(buf, 0, stride); // zero out the line in the output buffer
-        // loop through all the pixels for a line
-        // we are packing 2 pixels per byte, so width is half
-        for(int x = 0; x < ((img->width + 1) / 2); x++) {
-            uint8_t sp = *px++;          // get the first pixel
-            sp <<= 4;                    // shift to make room
-            if((x * 2 + 1) < img->width) {    // test for odd pixel end
-                sp |= (*px++) & 0x0f;    // get the next pixel
+        io_pack4(dp, px, img->width);
+        dp += stride;
+        px -= img->width; // move back to start of previous line
+    }
+
+    rval = io_segs_add(segs, segs->buf, fsz);
+
+bmp_cleanup:
+    return rval;
+}
+
+/// @brief run length encodes one line of pixels, BI_RLE8 when bpp is 8 or BI_RLE4 when it is 4.
+///        Runs are found with io_span_eq(), and the stretches between them with io_span_distinct().
+///        A stretch of 3 or more goes out in absolute mode, shorter ones as runs of 1
+/// @param dst pointer to receive the encoded line, which needs room for (2 * width) bytes
+/// @param px pointer to the pixels of the line
+/// @param width number of pixels in the line
+/// @param bpp bits per pixel to encode, 8 or 4
+/// @return number of bytes written to dst, not counting the end of line
+static size_t bmp_rle_line(uint8_t *dst, const uint8_t *px, uint32_t width, int bpp) {
+    uint8_t *d = dst;
+    uint32_t x = 0;
+
+    while(x < width) {
+        // every count is a single byte
+        size_t left = ((width - x) < 255) ? (width - x) : 255;
+        size_t n = io_span_distinct(&px[x], left);
+        if(3 <= n) { // absolute mode, the pixels as they are, padded to a 16 bit boundary
+            size_t nb = (8 == bpp) ? n : ((n + 1) / 2);
+            d[0] = 0;
+            d[1] = (uint8_t)n;
+            if(8 == bpp) {
+                memcpy(&d[2], &px[x], n);
+            } else {
+                io_pack4(&d[2], &px[x], (int)n);
+            }
+            d += 2 + nb;
+            if(nb & 1) *d++ = 0;
+            x += n;
+        } else { // too short for absolute mode, which can't hold fewer than 3
+            for(size_t i = 0; i < n; i++, x++) {
+                d[0] = 1;
+                d[1] = (8 == bpp) ? px[x] : (uint8_t)((px[x] << 4) | (px[x] & 0x0f));
+                d += 2;
             }
-            buf[x] = sp;                 // write it to the line buffer
         }
-        nr = fwrite(buf, stride, 1, fp); // write out the line
-        if(1 != nr) {
-            rval = errno;  // unable to write file
-            goto bmp_cleanup;
+
+        if(x < width) { // a run, for RLE4 both nibbles are the same colour
+            left = ((width - x) < 255) ? (width - x) : 255;
+            size_t r = io_span_eq(&px[x], left);
+            d[0] = (uint8_t)r;
+            d[1] = (8 == bpp) ? px[x] : (uint8_t)((px[x] << 4) | (px[x] & 0x0f));
+            d += 2;
+            x += r;
         }
-        px -= (img->width * 2); // move back to start of previous line
     }
 
+    return d - dst;
+}
+
+static int save_bmp_rle(pal_image_t *img, io_segs_t *segs) {
+    int rval = 0;
+    int bpp = (16 == img->colours) ? 4 : 8;
+    int colours = (1 << bpp);
+    size_t hdrsz = HDRBUFSZ + (sizeof(bmp_palette_entry_t) * colours);
+
+    // a line never takes more than 2 bytes a pixel plus its end of line, but that is
+    // twice the size of the image, so start with a quarter of it and grow as needed
+    size_t worst = ((size_t)img->width * 2) + 2;
+    size_t cap = hdrsz + ((size_t)img->width * img->height / 4) + worst;
+    if(NULL == (segs->buf = io_scratch_alloc(cap))) {
+        rval = errno;  // unable to allocate mem
+        goto bmp_cleanup;
+    }
+
+    // For maximum compatibility we write the lines in the natural 
+    // order for BMP, which is from bottom to top
+    size_t pos = hdrsz;
+    for(int y = img->height - 1; 0 <= y; y--) {
+        if((cap - pos) < worst) {
+            size_t ncap = cap * 2;
+            uint8_t *nbuf = io_realloc(segs->buf, ncap);
+            if(NULL == nbuf) {
+                rval = errno;  // unable to allocate mem
+                goto bmp_cleanup;
+            }
+            segs->buf = nbuf;
+            cap = ncap;
+        }
+        uint8_t *dp = &segs->buf[pos];
+        pos += bmp_rle_line(dp, &img->pixels[(size_t)y * img->width], img->width, bpp);
+        // each line ends with an end of line, except the last which ends the bitmap
+        segs->buf[pos++] = 0;
+        segs->buf[pos++] = (0 == y) ? 1 : 0;
+    }
+
+    bmp_write_header(segs->buf, img->width, img->height, img->pal, bpp, (8 == bpp) ? BMP_RLE8 : BMP_RLE4, pos - hdrsz);
+    rval = io_segs_add(segs, segs->buf, pos);
+
 bmp_cleanup:
-    free_s(pal);
-    fclose_s(fp);
-    free_s(buf);
     return rval;
 }
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <image_bmp.h>
+#include "bmp_priv.h"
+#include "../io/io_priv.h"
+#include <stdbool.h>
+#include <errno.h>
+
+/// @brief decodes a Windows BMP image from a stream a scanline at a time, handing each line 
+///        to a callback from top to bottom. Must be a palletted 4 bit per pixel or 8 bit per
+///        pixel image, uncompressed or RLE
+/// @param io pointer to the image_io_t to read the BMP from
+/// @param row callback to receive each scanline
+/// @param user pointer passed through to the callback
+/// @return 0 on success, the non zero value returned by the callback, otherwise an error code
+int load_bmp_scanlines(image_io_t *io, image_row_fn row, void *user) {
+    int rval = BMP_NOERROR;
+    uint8_t *band = NULL;
+    uint8_t *line = NULL;
+    bmp_header_t bmp;
+    image_info_t info;
+
+    // do some basic error checking on the inputs
+    if((NULL == io) || (NULL == row)) return BMP_NULL_POINTER;
+
+    if(BMP_NOERROR != (rval = bmp_read_header(io, &bmp, &info))) {
+        return rval;
+    }
+
+    // the image data doesn't have to follow straight on from the palette
+    uint64_t used = HDRBUFSZ + (bmp.bmi.num_colors * sizeof(bmp_palette_entry_t));
+    if((bmp.dib.image_offset < used) || (0 != io_skip(io, bmp.dib.image_offset - used))) {
+        return BMP_INVALID;
+    }
+
+    // if height is negative the lines are stored top down, which is the order we want
+    bool flip = (bmp.bmi.image_height < 0);
+    uint32_t lw = info.width;
+    uint32_t lh = info.height;
+
+    if(BMP_RGB != bmp.bmi.compression) {
+        // the lines can't be found without decoding the ones before them, so the rest of
+        // the stream is decoded into a whole image up front
+        uint8_t *data = NULL;
+        size_t len = 0;
+        if(0 != (rval = io_read_all(io, &data, &len))) {
+            goto bmp_cleanup;
+        }
+        if(NULL == (band = io_scratch_alloc((size_t)lw * lh))) {
+            rval = errno;  // unable to allocate mem
+            free_s(data);
+            goto bmp_cleanup;
+        }
+        rval = bmp_rle_decode(band, lw, lh, flip, info.bits_per_pixel, data, len);
+        free_s(data);
+        for(uint32_t y = 0; (BMP_NOERROR == rval) && (y < lh); y++) {
+            rval = row(user, &info, y, &band[(size_t)y * lw]);
+        }
+        goto bmp_cleanup;
+    }
+
+    // stride is the bytes per line in the BMP file, which are padded to 32 bit boundary
+    uint32_t stride = (4 == info.bits_per_pixel) ? ((((lw + 1) / 2) + 3) & (~0x0003)) : ((lw + 3) & (~0x0003));
+
+    // read a band of lines at a time. Bottom up lines are read a band at a time from the end
+    // of the raster towards the start, which needs to be able to seek. If we can't, the
+    // whole raster is read in as a single band instead
+    int64_t base = flip ? -1 : io_seek(io, 0, SEEK_CUR);
+    uint32_t nband = IO_BAND_SIZE / stride;
+    if((!flip && (0 > base)) || (nband > lh)) nband = lh;
+    if(0 == nband) nband = 1;
+
+    if((NULL == (band = io_scratch_alloc((size_t)nband * stride))) || 
+       ((4 == info.bits_per_pixel) && (NULL == (line = io_scratch_alloc(lw))))) {
+        rval = errno;  // unable to allocate mem
+        goto bmp_cleanup;
+    }
+
+    uint32_t y = 0;
+    while(y < lh) {
+        uint32_t n = ((lh - y) < nband) ? (lh - y) : nband;
+
+        // top down lines y to y+n-1 are the file lines lh-y-n to lh-y-1, stored in reverse
+        if(!flip && (0 <= base) && (0 > io_seek(io, base + ((int64_t)(lh - y - n) * stride), SEEK_SET))) {
+            rval = BMP_INVALID;
+            goto bmp_cleanup;
+        }
+        if(0 != io_read_exact(io, band, (size_t)n * stride)) {
+            rval = BMP_INVALID;  // truncated image data
+            goto bmp_cleanup;
+        }
+
+        for(uint32_t i = 0; i < n; i++) {
+            uint8_t *src = &band[(size_t)(flip ? i : (n - 1 - i)) * stride];
+            if(4 == info.bits_per_pixel) {
+                io_unpack4(line, src, lw);
+                src = line;
+            }
+            if(0 != (rval = row(user, &info, y + i, src))) goto bmp_cleanup;
+        }
+        y += n;
+    }
+
+bmp_cleanup:
+    free_s(line);
+    free_s(band);
+    return rval;
+}
+
+/// @brief the state of a BMP being written a few rows at a time
+typedef struct {
+    image_writer_t w;  // must be first
+    int bpp;           // 4 or 8 bits per pixel
+    uint32_t stride;   // bytes per line in the file, including padding
+    int64_t base;      // position of the image data in the stream for a bottom up BMP, or -1 for top down
+    uint8_t *band;     // lines waiting to be written, filled from the end for a bottom up BMP
+    uint32_t nband;    // number of lines the band can hold
+    uint32_t count;    // number of lines in the band
+    uint32_t done;     // number of lines already written out
+} bmp_writer_t;
+
+/// @brief sends the lines in the band out to the stream
+/// @param bw pointer to the BMP writer
+/// @return 0 on success, otherwise an error code
+static int bmp_writer_flush(bmp_writer_t *bw) {
+    if(0 == bw->count) return 0;
+
+    size_t len = (size_t)bw->count * bw->stride;
+    uint8_t *data = bw->band;
+    if(0 <= bw->base) {
+        // top down lines done to done+count-1 are the file lines h-done-count to h-done-1, and 
+        // were put in the band from the end, so they are already in file order
+        data = &bw->band[(size_t)(bw->nband - bw->count) * bw->stride];
+        int64_t pos = bw->base + ((int64_t)(bw->w.info.height - bw->done - bw->count) * bw->stride);
+        if(0 > io_seek(bw->w.io, pos, SEEK_SET)) return errno;
+    }
+
+    int rval = io_write_all(bw->w.io, data, len);
+    bw->done += bw->count;
+    bw->count = 0;
+    return rval;
+}
+
+static int bmp_writer_rows(image_writer_t *w, const uint8_t *pixels, uint32_t count) {
+    bmp_writer_t *bw = (bmp_writer_t *)w;
+    uint32_t lw = w->info.width;
+
+    for(uint32_t i = 0; i < count; i++) {
+        // bottom up lines fill the band from the end, so it is in file order when written
+        uint32_t slot = (0 <= bw->base) ? (bw->nband - 1 - bw->count) : bw->count;
+        uint8_t *dp = &bw->band[(size_t)slot * bw->stride];
+        const uint8_t *sp = &pixels[(size_t)i * lw];
+        if(4 == bw->bpp) {
+            io_pack4(dp, sp, lw);
+        } else {
+            memcpy(dp, sp, lw); // the padding was zeroed when the band was allocated, and is never touched
+        }
+        if(++bw->count == bw->nband) {
+            int rval = bmp_writer_flush(bw);
+            if(0 != rval) return rval;
+        }
+    }
+    return 0;
+}
+
+static int bmp_writer_finish(image_writer_t *w, bool complete) {
+    bmp_writer_t *bw = (bmp_writer_t *)w;
+    int rval = 0;
+
+    if(complete) {
+        rval = bmp_writer_flush(bw);
+        // lines were written out of order, leave the stream at the end of the file
+        if((0 == rval) && (0 <= bw->base) &&
+           (0 > io_seek(w->io, bw->base + ((int64_t)w->info.height * bw->stride), SEEK_SET))) {
+            rval = errno;
+        }
+    }
+
+    free_s(bw->band);
+    io_free(bw);
+    return rval;
+}
+
+image_writer_t *save_bmp_begin(image_io_t *io, const image_info_t *info) {
+    int rval = BMP_NOERROR;
+    bmp_writer_t *bw = NULL;
+    uint8_t hdr[HDRBUFSZ + (256 * sizeof(bmp_palette_entry_t))];
+
+    if((NULL != info) && (16 != info->colours) && (256 != info->colours)) {
+        errno = BMP_INVALID;
+        return NULL;
+    }
+
+    if(NULL == (bw = io_writer_new(sizeof(bmp_writer_t), io, info))) {
+        return NULL;
+    }
+    bw->w.rows = bmp_writer_rows;
+    bw->w.finish = bmp_writer_finish;
+
+    uint32_t lw = info->width;
+    uint32_t lh = info->height;
+    bw->bpp = (16 == info->colours) ? 4 : 8;
+    bw->stride = (4 == bw->bpp) ? ((((lw + 1) / 2) + 3) & (~0x0003)) : ((lw + 3) & (~0x0003));
+
+    // For maximum compatibility we write the lines in the natural order for BMP, which is from 
+    // bottom to top. We know where each one goes, so they can be put in place as they arrive, 
+    // but only if we can seek. If we can't the lines are written top down instead
+    int64_t start = io_seek(io, 0, SEEK_CUR);
+    size_t hdrsz = bmp_write_header(hdr, lw, (0 <= start) ? (int32_t)lh : -(int32_t)lh, info->pal, bw->bpp, 
+                                    BMP_RGB, bw->stride * lh);
+    bw->base = (0 <= start) ? (start + (int64_t)hdrsz) : -1;
+
+    bw->nband = IO_BAND_SIZE / bw->stride;
+    if(bw->nband > lh) bw->nband = lh;
+    if(0 == bw->nband) bw->nband = 1;
+
+    // zeroed, so any line padding is already taken care of
+    if(NULL == (bw->band = io_calloc(bw->nband, bw->stride))) {
+        rval = errno;  // unable to allocate mem
+        goto bmp_cleanup;
+    }
+
+    if(0 != (rval = io_write_all(io, hdr, hdrsz))) {
+        goto bmp_cleanup;
+    }
+
+    return &bw->w;
+bmp_cleanup:
+    free_s(bw->band);
+    io_free(bw);
+    errno = rval;
+    return NULL;
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <imageio.h>
+#include "io_priv.h"
+
+#define IO_ALIGN (16) // every block handed out of the scratch region starts on this boundary
+#define IO_ROUND(n) (((n) + (IO_ALIGN - 1)) & ~(size_t)(IO_ALIGN - 1))
+
+/// @brief what sits in front of each block carved out of the scratch region
+typedef struct {
+    size_t size;  // size that was asked for
+    size_t prev;  // how much of the region was in use before this block
+} io_block_t;
+
+#define IO_HDR IO_ROUND(sizeof(io_block_t))
+
+/// @brief a caller supplied region that one thread's temporary buffers are carved from
+typedef struct {
+    uint8_t *base;  // start of the region, aligned
+    size_t len;     // usable size of the region
+    size_t used;    // bytes handed out, blocks are carved from the front
+    size_t live;    // number of blocks not yet released, the region starts over when it gets to 0
+    size_t peak;    // most that has been asked of the region at once, including what didn't fit
+} io_arena_t;
+
+static image_allocator_t io_hooks = {NULL, NULL, NULL, NULL}; // all NULL for the C library
+static IO_THREAD_LOCAL io_arena_t io_arena;
+
+int image_set_allocator(const image_allocator_t *alloc) {
+    if(NULL == alloc) { // back to the C library
+        memset(&io_hooks, 0, sizeof(io_hooks));
+        return 0;
+    }
+    if((NULL == alloc->alloc) || (NULL == alloc->resize) || (NULL == alloc->release)) return EINVAL;
+    io_hooks = *alloc;
+    return 0;
+}
+
+int image_set_scratch(void *buf, size_t len) {
+    io_arena_t *a = &io_arena;
+
+    if(0 != a->live) return EBUSY; // a decode on this thread is still using the current one
+
+    memset(a, 0, sizeof(io_arena_t));
+    if((NULL == buf) || (0 == len)) return 0;
+
+    // line the region up so every block is suitably aligned
+    uintptr_t p = (uintptr_t)buf;
+    size_t skip = IO_ROUND(p) - p;
+    if(len <= (skip + IO_HDR)) return EINVAL; // too small to hold anything
+    a->base = (uint8_t *)buf + skip;
+    a->len = (len - skip) & ~(size_t)(IO_ALIGN - 1);
+    return 0;
+}
+
+size_t image_scratch_peak(void) {
+    return io_arena.peak;
+}
+
+void *io_malloc(size_t size) {
+    void *p = (NULL != io_hooks.alloc) ? io_hooks.alloc(io_hooks.user, size) : malloc(size);
+    if(NULL == p) errno = ENOMEM; // the installed allocator may not set it
+    return p;
+}
+
+void *io_calloc(size_t count, size_t size) {
+    if((0 != size) && (count > (SIZE_MAX / size))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *p = io_malloc(count * size);
+    if(NULL != p) memset(p, 0, count * size);
+    return p;
+}
+
+/// @brief checks whether a block came from the calling thread's scratch region
+static inline bool io_in_arena(const io_arena_t *a, const void *p) {
+    return (NULL != a->base) && ((const uint8_t *)p >= a->base) && ((const uint8_t *)p < &a->base[a->len]);
+}
+
+void *io_scratch_alloc(size_t size) {
+    io_arena_t *a = &io_arena;
+
+    if(NULL != a->base) {
+        size_t need = (size <= a->len) ? (IO_HDR + IO_ROUND(size)) : SIZE_MAX;
+        size_t want = (need <= (SIZE_MAX - a->used)) ? (a->used + need) : SIZE_MAX;
+        if(want > a->peak) a->peak = want; // so the caller can tell how big the region needs to be
+        if(want <= a->len) {
+            io_block_t *b = (io_block_t *)&a->base[a->used];
+            b->size = size;
+            b->prev = a->used;
+            a->used = want;
+            a->live++;
+            return (uint8_t *)b + IO_HDR;
+        }
+        // the region is full, so this one comes from the allocator instead
+    }
+    return io_malloc(size);
+}
+
+void *io_scratch_calloc(size_t count, size_t size) {
+    if((0 != size) && (count > (SIZE_MAX / size))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *p = io_scratch_alloc(count * size);
+    if(NULL != p) memset(p, 0, count * size);
+    return p;
+}
+
+void *io_realloc(void *ptr, size_t size) {
+    io_arena_t *a = &io_arena;
+
+    if(NULL == ptr) return io_scratch_alloc(size);
+
+    if(!io_in_arena(a, ptr)) {
+        void *p = (NULL != io_hooks.resize) ? io_hooks.resize(io_hooks.user, ptr, size) : realloc(ptr, size);
+        if(NULL == p) errno = ENOMEM;
+        return p;
+    }
+
+    io_block_t *b = (io_block_t *)((uint8_t *)ptr - IO_HDR);
+    size_t start = (uint8_t *)ptr - a->base;
+
+    // the last block handed out can grow or shrink where it is
+    if(((start + IO_ROUND(b->size)) == a->used) && (size <= (a->len - start))) {
+        a->used = start + IO_ROUND(size);
+        if(a->used > a->peak) a->peak = a->used;
+        b->size = size;
+        return ptr;
+    }
+
+    // otherwise move it, the old block is given back once nothing after it is in use
+    if(size <= b->size) return ptr;
+    void *p = io_scratch_alloc(size);
+    if(NULL == p) return NULL;
+    memcpy(p, ptr, b->size);
+    io_free(ptr);
+    return p;
+}
+
+void io_free(void *ptr) {
+    io_arena_t *a = &io_arena;
+
+    if(NULL == ptr) return;
+
+    if(!io_in_arena(a, ptr)) {
+        if(NULL != io_hooks.release) {
+            io_hooks.release(io_hooks.user, ptr);
+        } else {
+            free(ptr);
+        }
+        return;
+    }
+
+    // the last block can be taken back straight away, anything else waits until all are released
+    io_block_t *b = (io_block_t *)((uint8_t *)ptr - IO_HDR);
+    if((((uint8_t *)ptr - a->base) + IO_ROUND(b->size)) == a->used) a->used = b->prev;
+    if(0 == --a->live) a->used = 0;
+}
+
+bool io_alloc_is_libc(void) {
+    return (NULL == io_hooks.alloc) && (NULL == io_arena.base);
+}
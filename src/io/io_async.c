@@ -0,0 +1,471 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <imageio.h>
+#include "io_priv.h"
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define ASYNC_RING_ENTRIES (64)        // number of reads and writes that can be queued at once
+#define ASYNC_MAX_XFER (1U << 30)      // largest single read or write handed to the ring
+
+/// @brief where a request is up to
+enum async_stage {
+    ASYNC_START,  // waiting for a worker to open (and for a save encode) the file
+    ASYNC_IO,     // the read or write is in flight on the ring
+    ASYNC_DECODE, // the file has been read, waiting for a worker to decode it
+};
+
+/// @brief one load or save request
+typedef struct async_job {
+    image_async_op_t op;
+    int stage;              // one of async_stage
+    char *fn;               // name of the file
+    void *tag;              // handed back with the completion
+    pal_image_t *img;       // the image saved, or loaded
+    uint8_t *buf;           // the encoded file
+    size_t len;             // length of the encoded file
+    size_t done;            // bytes read or written so far
+    int fd;                 // the open file, or -1
+    int err;                // result of the request
+    struct async_job *next;
+    bool on_ring;           // set while a transfer is on the ring
+    struct async_job *ring_prev; // the jobs with a transfer on the ring
+    struct async_job *ring_next;
+} async_job_t;
+
+struct image_async {
+    io_ring_t *ring;        // NULL when the workers do the reads and writes themselves
+    pthread_t reaper;       // takes completions off the ring
+    pthread_t *workers;     // open, decode and encode
+    int nworkers;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv; // signalled when there is work for the workers
+    pthread_cond_t done_cv; // signalled when a request completes
+    async_job_t *work_head; // jobs waiting for a worker
+    async_job_t *work_tail;
+    async_job_t *done_head; // completed jobs waiting to be reaped
+    async_job_t *done_tail;
+    size_t inflight;        // requests that haven't completed yet
+    size_t outstanding;     // requests that haven't been reaped yet
+    async_job_t *ring_jobs; // jobs with a transfer on the ring, so they can be failed if the ring does
+    bool ring_failed;       // set when the ring can no longer be reaped, so it isn't used again
+    bool stop;              // set when the workers are to exit
+    image_pool_t *pool;     // pool the loaded images are drawn from, if any
+};
+
+static void async_push(async_job_t **head, async_job_t **tail, async_job_t *job) {
+    job->next = NULL;
+    if(NULL == *tail) {
+        *head = job;
+    } else {
+        (*tail)->next = job;
+    }
+    *tail = job;
+}
+
+static async_job_t *async_pop(async_job_t **head, async_job_t **tail) {
+    async_job_t *job = *head;
+    if(NULL != job) {
+        *head = job->next;
+        if(NULL == *head) *tail = NULL;
+    }
+    return job;
+}
+
+/// @brief hands a job to the workers
+static void async_queue_work(image_async_t *a, async_job_t *job) {
+    pthread_mutex_lock(&a->lock);
+    async_push(&a->work_head, &a->work_tail, job);
+    pthread_cond_signal(&a->work_cv);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/// @brief releases what a job used for its I/O, and hands it back to be reaped
+static void async_complete(image_async_t *a, async_job_t *job, int err) {
+    if(0 <= job->fd) {
+        if((0 != close(job->fd)) && (0 == err) && (IMAGE_ASYNC_SAVE == job->op)) err = errno;
+        job->fd = -1;
+    }
+    if(IMAGE_ASYNC_SAVE == job->op) { // the encoded file came from save_image_mem(), which uses malloc()
+        free(job->buf);
+        job->buf = NULL;
+    } else {
+        free_s(job->buf);
+    }
+    job->err = err;
+
+    pthread_mutex_lock(&a->lock);
+    async_push(&a->done_head, &a->done_tail, job);
+    a->inflight--;
+    pthread_cond_broadcast(&a->done_cv);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/// @brief takes a job off the list of those on the ring. The lock must be held
+static void async_ring_remove(image_async_t *a, async_job_t *job) {
+    if(NULL != job->ring_prev) {
+        job->ring_prev->ring_next = job->ring_next;
+    } else if(a->ring_jobs == job) {
+        a->ring_jobs = job->ring_next;
+    }
+    if(NULL != job->ring_next) job->ring_next->ring_prev = job->ring_prev;
+    job->ring_prev = NULL;
+    job->ring_next = NULL;
+    job->on_ring = false;
+}
+
+/// @brief sends the next piece of a job's read or write to the ring
+/// @return 0 if it was submitted, otherwise an errno value and the job is not on the ring
+static int async_submit_io(image_async_t *a, async_job_t *job) {
+    size_t left = job->len - job->done;
+    uint32_t n = (left > ASYNC_MAX_XFER) ? ASYNC_MAX_XFER : (uint32_t)left;
+    int op = (IMAGE_ASYNC_LOAD == job->op) ? IO_RING_READ : IO_RING_WRITE;
+
+    // it goes on the list first, as the reaper can see it complete before the submit returns
+    pthread_mutex_lock(&a->lock);
+    if(a->ring_failed) {
+        pthread_mutex_unlock(&a->lock);
+        return EIO;
+    }
+    job->on_ring = true;
+    job->ring_prev = NULL;
+    job->ring_next = a->ring_jobs;
+    if(NULL != a->ring_jobs) a->ring_jobs->ring_prev = job;
+    a->ring_jobs = job;
+    pthread_mutex_unlock(&a->lock);
+
+    job->stage = ASYNC_IO;
+    int rval = io_ring_submit(a->ring, op, job->fd, &job->buf[job->done], n, job->done, job);
+    if(0 != rval) {
+        // if the reaper has already failed it along with the rest of the ring, it's been completed
+        pthread_mutex_lock(&a->lock);
+        if(job->on_ring) {
+            async_ring_remove(a, job);
+        } else {
+            rval = 0;
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+    return rval;
+}
+
+/// @brief does a job's read or write on the calling thread, when there is no ring to do it
+/// @return 0 on success, otherwise an errno value
+static int async_sync_io(async_job_t *job) {
+    while(job->done < job->len) {
+        size_t left = job->len - job->done;
+        ssize_t n = (IMAGE_ASYNC_LOAD == job->op) ?
+            pread(job->fd, &job->buf[job->done], left, job->done) :
+            pwrite(job->fd, &job->buf[job->done], left, job->done);
+        if(0 > n) {
+            if(EINTR == errno) continue;
+            return errno;
+        }
+        if(0 == n) return EIO;  // the file is shorter than it was
+        job->done += n;
+    }
+    return 0;
+}
+
+/// @brief gets a job ready for its read or write: opens the file, and either sizes the
+///        buffer for a load or encodes the image for a save
+/// @return 0 on success, otherwise an errno value
+static int async_open(async_job_t *job) {
+    if(IMAGE_ASYNC_LOAD == job->op) {
+        struct stat st;
+        if(0 > (job->fd = open(job->fn, O_RDONLY))) return errno;
+        if(0 != fstat(job->fd, &st)) return errno;
+        job->len = st.st_size;
+        // always allocate at least 1 byte so an empty file still yields a valid buffer
+        if(NULL == (job->buf = io_malloc(job->len + 1))) return errno;
+    } else {
+        int rval = save_image_mem(job->img, image_format_from_name(job->fn), &job->buf, &job->len);
+        if(0 != rval) return rval;
+        if(0 > (job->fd = open(job->fn, O_WRONLY | O_CREAT | O_TRUNC, 0666))) return errno;
+    }
+    return 0;
+}
+
+static void async_run(image_async_t *a, async_job_t *job) {
+    int rval = 0;
+
+    if(ASYNC_START == job->stage) {
+        if(0 != (rval = async_open(job))) {
+            async_complete(a, job, rval);
+            return;
+        }
+        // hand the transfer to the ring and move on, the reaper brings it back
+        if((NULL != a->ring) && (0 < job->len) && (0 == async_submit_io(a, job))) {
+            return;
+        }
+        if(0 != (rval = async_sync_io(job))) {
+            async_complete(a, job, rval);
+            return;
+        }
+    }
+
+    // the file is in memory, for a load all that is left is to decode it
+    if(IMAGE_ASYNC_LOAD == job->op) {
+        if(NULL == (job->img = load_image_mem(job->buf, job->len))) {
+            rval = (0 != errno) ? errno : EINVAL;
+        }
+    }
+    async_complete(a, job, rval);
+}
+
+static void *async_worker(void *arg) {
+    image_async_t *a = (image_async_t *)arg;
+    image_set_pool(a->pool);
+
+    pthread_mutex_lock(&a->lock);
+    while(true) {
+        async_job_t *job = async_pop(&a->work_head, &a->work_tail);
+        if(NULL == job) {
+            if(a->stop) break;
+            pthread_cond_wait(&a->work_cv, &a->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&a->lock);
+        async_run(a, job);
+        pthread_mutex_lock(&a->lock);
+    }
+    pthread_mutex_unlock(&a->lock);
+    return NULL;
+}
+
+static void *async_reaper(void *arg) {
+    image_async_t *a = (image_async_t *)arg;
+    void *user;
+    int res;
+    int rval;
+
+    while(0 == (rval = io_ring_wait(a->ring, &user, &res))) {
+        async_job_t *job = (async_job_t *)user;
+        if(NULL == job) return NULL; // the wake up sent when shutting down
+
+        pthread_mutex_lock(&a->lock);
+        async_ring_remove(a, job);
+        pthread_mutex_unlock(&a->lock);
+
+        if(0 > res) {
+            async_complete(a, job, -res);
+        } else if(0 == res) {
+            async_complete(a, job, EIO);  // the file is shorter than it was
+        } else if((job->done += res) < job->len) {
+            int err = async_submit_io(a, job); // short transfer, go round again for the rest
+            if(0 != err) async_complete(a, job, err);
+        } else if(IMAGE_ASYNC_LOAD == job->op) {
+            job->stage = ASYNC_DECODE;  // decode on a worker, so the reaper is never held up
+            async_queue_work(a, job);
+        } else {
+            async_complete(a, job, 0);
+        }
+    }
+
+    // nothing more can be reaped, so fail whatever is still on the ring rather than leave
+    // it in flight forever. Later transfers are done on the workers instead
+    pthread_mutex_lock(&a->lock);
+    a->ring_failed = true;
+    async_job_t *job = a->ring_jobs;
+    a->ring_jobs = NULL;
+    for(async_job_t *j = job; NULL != j; j = j->ring_next) j->on_ring = false;
+    pthread_mutex_unlock(&a->lock);
+    while(NULL != job) {
+        async_job_t *next = job->ring_next;
+        job->ring_prev = NULL;
+        job->ring_next = NULL;
+        async_complete(a, job, rval);
+        job = next;
+    }
+    return NULL;
+}
+
+image_async_t *image_async_new(int threads, unsigned flags) {
+    int rval = 0;
+    image_async_t *a = NULL;
+
+    if(0 >= threads) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (0 < n) ? (int)n : 1;
+    }
+
+    if((NULL == (a = io_calloc(1, sizeof(image_async_t)))) || 
+       (NULL == (a->workers = io_calloc(threads, sizeof(pthread_t))))) {
+        rval = errno;  // unable to allocate mem
+        io_free(a);
+        errno = rval;
+        return NULL;
+    }
+    a->pool = io_pool_current();
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->work_cv, NULL);
+    pthread_cond_init(&a->done_cv, NULL);
+
+    // if there is no ring, the workers do the reads and writes themselves
+    if(0 == (flags & IMAGE_ASYNC_NO_RING)) {
+        a->ring = io_ring_new(ASYNC_RING_ENTRIES);
+        if((NULL != a->ring) && (0 != pthread_create(&a->reaper, NULL, async_reaper, a))) {
+            io_ring_free(a->ring);
+            a->ring = NULL;
+        }
+    }
+
+    for(int t = 0; t < threads; t++) {
+        if(0 != (rval = pthread_create(&a->workers[t], NULL, async_worker, a))) break;
+        a->nworkers++;
+    }
+    if(0 == a->nworkers) {
+        image_async_free(a);
+        errno = rval;
+        return NULL;
+    }
+    return a;
+}
+
+bool image_async_uses_ring(const image_async_t *a) {
+    return (NULL != a) && (NULL != a->ring);
+}
+
+/// @brief starts a request off on the workers
+static int async_submit(image_async_t *a, image_async_op_t op, const char *fn, pal_image_t *img, void *tag) {
+    async_job_t *job = io_calloc(1, sizeof(async_job_t));
+    if(NULL == job) return errno;
+    size_t fnlen = strlen(fn) + 1;
+    if(NULL == (job->fn = io_malloc(fnlen))) {
+        io_free(job);
+        return ENOMEM;
+    }
+    memcpy(job->fn, fn, fnlen);
+    job->op = op;
+    job->stage = ASYNC_START;
+    job->img = img;
+    job->tag = tag;
+    job->fd = -1;
+
+    pthread_mutex_lock(&a->lock);
+    a->inflight++;
+    a->outstanding++;
+    async_push(&a->work_head, &a->work_tail, job);
+    pthread_cond_signal(&a->work_cv);
+    pthread_mutex_unlock(&a->lock);
+    return 0;
+}
+
+int image_async_load(image_async_t *a, const char *fn, void *tag) {
+    if((NULL == a) || (NULL == fn)) return EBADF;
+    return async_submit(a, IMAGE_ASYNC_LOAD, fn, NULL, tag);
+}
+
+int image_async_save(image_async_t *a, const char *fn, pal_image_t *img, void *tag) {
+    if((NULL == a) || (NULL == fn) || (NULL == img)) return EBADF;
+    if(IMAGE_FMT_UNKNOWN == image_format_from_name(fn)) return ENOTSUP;
+    return async_submit(a, IMAGE_ASYNC_SAVE, fn, img, tag);
+}
+
+int image_async_reap(image_async_t *a, image_completion_t *c, bool wait) {
+    if((NULL == a) || (NULL == c)) return EBADF;
+
+    pthread_mutex_lock(&a->lock);
+    while(NULL == a->done_head) {
+        if((0 == a->outstanding) || !wait) {
+            int rval = (0 == a->outstanding) ? ENOENT : EAGAIN;
+            pthread_mutex_unlock(&a->lock);
+            return rval;
+        }
+        pthread_cond_wait(&a->done_cv, &a->lock);
+    }
+    async_job_t *job = async_pop(&a->done_head, &a->done_tail);
+    a->outstanding--;
+    pthread_mutex_unlock(&a->lock);
+
+    c->op = job->op;
+    c->tag = job->tag;
+    c->img = job->img;
+    c->err = job->err;
+    io_free(job->fn);
+    io_free(job);
+    return 0;
+}
+
+void image_async_free(image_async_t *a) {
+    if(NULL == a) return;
+
+    // let everything in flight finish, then stop the workers
+    pthread_mutex_lock(&a->lock);
+    while(0 < a->inflight) {
+        pthread_cond_wait(&a->done_cv, &a->lock);
+    }
+    a->stop = true;
+    pthread_cond_broadcast(&a->work_cv);
+    pthread_mutex_unlock(&a->lock);
+
+    for(int t = 0; t < a->nworkers; t++) {
+        pthread_join(a->workers[t], NULL);
+    }
+    if(NULL != a->ring) {
+        // wake the reaper with an empty completion so it exits
+        if(0 == io_ring_submit(a->ring, IO_RING_NOP, -1, NULL, 0, 0, NULL)) {
+            pthread_join(a->reaper, NULL);
+        } else {
+            pthread_cancel(a->reaper);
+            pthread_join(a->reaper, NULL);
+        }
+        io_ring_free(a->ring);
+    }
+
+    // anything not reaped is dropped, along with any image that was loaded for it
+    async_job_t *job;
+    while(NULL != (job = async_pop(&a->done_head, &a->done_tail))) {
+        if(IMAGE_ASYNC_LOAD == job->op) image_pool_put(a->pool, job->img);
+        io_free(job->fn);
+        io_free(job);
+    }
+
+    pthread_cond_destroy(&a->done_cv);
+    pthread_cond_destroy(&a->work_cv);
+    pthread_mutex_destroy(&a->lock);
+    io_free(a->workers);
+    io_free(a);
+}
+
+#else
+
+// the worker pool is only written for POSIX threads so far
+
+image_async_t *image_async_new(int threads, unsigned flags) {
+    (void)threads; (void)flags;
+    errno = ENOSYS;
+    return NULL;
+}
+
+bool image_async_uses_ring(const image_async_t *a) {
+    (void)a;
+    return false;
+}
+
+int image_async_load(image_async_t *a, const char *fn, void *tag) {
+    (void)a; (void)fn; (void)tag;
+    return ENOSYS;
+}
+
+int image_async_save(image_async_t *a, const char *fn, pal_image_t *img, void *tag) {
+    (void)a; (void)fn; (void)img; (void)tag;
+    return ENOSYS;
+}
+
+int image_async_reap(image_async_t *a, image_completion_t *c, bool wait) {
+    (void)a; (void)c; (void)wait;
+    return ENOSYS;
+}
+
+void image_async_free(image_async_t *a) {
+    (void)a;
+}
+
+#endif
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <imageio.h>
+#include <image_bmp.h>
+#include <image_pcx.h>
+#include <image_tga.h>
+#include <image_png.h>
+#include "io_priv.h"
+
+pal_image_t *load_image(const char *fn) {
+    int rval = 0;
+    uint8_t *buf = NULL;
+    size_t len = 0;
+    pal_image_t *img = NULL;
+
+    if(NULL == fn) {
+        rval = EBADF;
+        goto CLEANUP;
+    }
+
+    // pull the whole file into memory with a single read, the format is
+    // worked out from what we already have in hand
+    if(0 != (rval = io_read_file(fn, &buf, &len))) {
+        goto CLEANUP;
+    }
+
+    if(NULL == (img = load_image_mem(buf, len))) {
+        rval = errno;
+        goto CLEANUP;
+    }
+
+    free_s(buf);
+    return img;
+CLEANUP:
+    free_s(buf);
+    errno = rval;
+    return NULL;
+}
+
+pal_image_t *load_image_mem(const uint8_t *buf, size_t len) {
+    if(NULL == buf) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    switch(io_sniff(buf, len)) {
+        case IMAGE_FMT_BMP: return load_bmp_mem(buf, len);
+        case IMAGE_FMT_PCX: return load_pcx_mem(buf, len);
+#ifdef CA_IMAGEIO_PNG
+        case IMAGE_FMT_PNG: return load_png_mem(buf, len);
+#else
+        case IMAGE_FMT_PNG: errno = ENOTSUP; return NULL;
+#endif
+        default: // TGA can only be confirmed by its footer, which the loader checks
+            return load_tga_mem(buf, len);
+    }
+}
+
+int load_image_into(pal_image_t **dst, const char *fn) {
+    int rval = 0;
+    io_map_t map = {NULL, 0, 0};
+
+    if((NULL == dst) || (NULL == fn)) return EBADF;
+
+    // map rather than read, so there is no file buffer to allocate for each frame
+    if(0 != (rval = io_map_file(fn, &map))) return rval;
+    rval = load_image_mem_into(dst, map.data, map.len);
+    io_unmap_file(&map);
+    return rval;
+}
+
+int load_image_mem_into(pal_image_t **dst, const uint8_t *buf, size_t len) {
+    if((NULL == dst) || (NULL == buf)) return EBADF;
+
+    switch(io_sniff(buf, len)) {
+        case IMAGE_FMT_BMP: return load_bmp_mem_into(dst, buf, len);
+        case IMAGE_FMT_PCX: return load_pcx_mem_into(dst, buf, len);
+#ifdef CA_IMAGEIO_PNG
+        case IMAGE_FMT_PNG: return load_png_mem_into(dst, buf, len);
+#else
+        case IMAGE_FMT_PNG: return ENOTSUP;
+#endif
+        default: // TGA can only be confirmed by its footer, which the loader checks
+            return load_tga_mem_into(dst, buf, len);
+    }
+}
+
+int load_image_scanlines(const char *fn, image_row_fn row, void *user) {
+    int rval = 0;
+    uint8_t hdr[IO_SNIFF_LEN];
+    io_file_t f;
+
+    if((NULL == fn) || (NULL == row)) return EBADF;
+
+    // the decoders do their own buffering
+    if(0 != (rval = io_open_file(fn, &f))) {
+        return rval;  // can't open input file
+    }
+    image_io_t *io = &f.io;
+
+    // have a look at the start of the file to see what it is, then go back to the start for the decoder
+    memset(hdr, 0, sizeof(hdr));
+    int64_t nr = io->read(io->user, hdr, sizeof(hdr));
+    if((0 > nr) || (0 > io_seek(io, 0, SEEK_SET))) {
+        rval = EIO;
+        goto CLEANUP;
+    }
+
+    switch(io_sniff(hdr, nr)) {
+        case IMAGE_FMT_BMP: rval = load_bmp_scanlines(io, row, user); break;
+        case IMAGE_FMT_PCX: rval = load_pcx_scanlines(io, row, user); break;
+#ifdef CA_IMAGEIO_PNG
+        case IMAGE_FMT_PNG: rval = load_png_scanlines(io, row, user); break;
+#else
+        case IMAGE_FMT_PNG: rval = ENOTSUP; break;
+#endif
+        default: // TGA can only be confirmed by its footer, which the decoder checks
+            rval = load_tga_scanlines(io, row, user);
+            break;
+    }
+
+CLEANUP:
+    io_close_file(&f);
+    return rval;
+}
+
+pal_image_t *load_image_scaled(const char *fn, int scale) {
+    int rval = 0;
+    uint8_t hdr[IO_SNIFF_LEN];
+    io_file_t f;
+
+    if(NULL == fn) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    // have a look at the start of the file to see what it is, the loaders open it themselves
+    if(0 != (rval = io_open_file(fn, &f))) {
+        errno = rval;
+        return NULL;
+    }
+    memset(hdr, 0, sizeof(hdr));
+    int64_t nr = f.io.read(f.io.user, hdr, sizeof(hdr));
+    io_close_file(&f);
+    if(0 > nr) {
+        errno = EIO;
+        return NULL;
+    }
+
+    switch(io_sniff(hdr, nr)) {
+        case IMAGE_FMT_BMP: return load_bmp_scaled(fn, scale);
+        case IMAGE_FMT_PCX: return load_pcx_scaled(fn, scale);
+#ifdef CA_IMAGEIO_PNG
+        case IMAGE_FMT_PNG: return load_png_scaled(fn, scale);
+#else
+        case IMAGE_FMT_PNG: errno = ENOTSUP; return NULL;
+#endif
+        default: // TGA can only be confirmed by its footer, which the loader checks
+            return load_tga_scaled(fn, scale);
+    }
+}
+
+image_format_t image_format_from_name(const char *fn) {
+    if(NULL == fn) return IMAGE_FMT_UNKNOWN;
+
+    const char *ext = strrchr(fn, '.');
+    if(NULL == ext) return IMAGE_FMT_UNKNOWN;
+    ext++;
+
+    if(0 == strcasecmp(ext, "bmp")) return IMAGE_FMT_BMP;
+    if(0 == strcasecmp(ext, "pcx")) return IMAGE_FMT_PCX;
+    if(0 == strcasecmp(ext, "tga")) return IMAGE_FMT_TGA;
+    if(0 == strcasecmp(ext, "png")) return IMAGE_FMT_PNG;
+    return IMAGE_FMT_UNKNOWN;
+}
+
+int save_image(const char *fn, pal_image_t *img) {
+    if((NULL == fn) || (NULL == img)) return EBADF;
+
+    switch(image_format_from_name(fn)) {
+        case IMAGE_FMT_BMP: return save_bmp(fn, img);
+        case IMAGE_FMT_PCX: return save_pcx(fn, img);
+        case IMAGE_FMT_TGA: return save_tga(fn, img);
+#ifdef CA_IMAGEIO_PNG
+        case IMAGE_FMT_PNG: return save_png(fn, img);
+#endif
+        default: return ENOTSUP;
+    }
+}
+
+int save_image_mem(pal_image_t *img, image_format_t format, uint8_t **buf, size_t *len) {
+    if((NULL == img) || (NULL == buf) || (NULL == len)) return EBADF;
+
+    switch(format) {
+        case IMAGE_FMT_BMP: return save_bmp_mem(img, buf, len);
+        case IMAGE_FMT_PCX: return save_pcx_mem(img, buf, len);
+        case IMAGE_FMT_TGA: return save_tga_mem(img, buf, len);
+#ifdef CA_IMAGEIO_PNG
+        case IMAGE_FMT_PNG: return save_png_mem(img, buf, len);
+#endif
+        default: return ENOTSUP;
+    }
+}
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <imageio.h>
+#include "io_priv.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/// @brief the share of the batch given to one worker. The worker takes files from the front
+///        of its range, and idle workers steal from the back of it
+typedef struct {
+#if !defined(_WIN32)
+    pthread_mutex_t lock;
+#else
+    CRITICAL_SECTION lock;
+#endif
+    size_t lo;  // next file for the owner to load
+    size_t hi;  // one past the last file in the range
+} io_batch_range_t;
+
+/// @brief the state shared by all of the workers of a batch
+typedef struct {
+    const char **fns;         // the files to load
+    pal_image_t **out;        // where to put each image
+    int *errs;                // where to put the result for each file, may be NULL
+    io_batch_range_t *range;  // one range for each worker
+    int nworkers;             // number of ranges
+    image_pool_t *pool;       // pool the caller was drawing images from, if any
+} io_batch_t;
+
+/// @brief what each worker is given when it starts
+typedef struct {
+    io_batch_t *batch;
+    int id;             // which range is the worker's own
+} io_batch_worker_t;
+
+static void io_batch_lock(io_batch_range_t *r) {
+#if !defined(_WIN32)
+    pthread_mutex_lock(&r->lock);
+#else
+    EnterCriticalSection(&r->lock);
+#endif
+}
+
+static void io_batch_unlock(io_batch_range_t *r) {
+#if !defined(_WIN32)
+    pthread_mutex_unlock(&r->lock);
+#else
+    LeaveCriticalSection(&r->lock);
+#endif
+}
+
+/// @brief takes the next file from the front of a worker's own range
+/// @return true if there was a file, with its index in *i
+static bool io_batch_take(io_batch_range_t *r, size_t *i) {
+    bool got = false;
+    io_batch_lock(r);
+    if(r->lo < r->hi) {
+        *i = r->lo++;
+        got = true;
+    }
+    io_batch_unlock(r);
+    return got;
+}
+
+/// @brief steals the back half of the busiest looking range into an idle worker's own range
+/// @return true if anything was stolen
+static bool io_batch_steal(io_batch_t *b, int id) {
+    for(;;) {
+        // the sizes are only a snapshot, the owners keep taking from their ranges meanwhile
+        io_batch_range_t *victim = NULL;
+        size_t most = 0;
+        for(int k = 1; k < b->nworkers; k++) {
+            io_batch_range_t *r = &b->range[(id + k) % b->nworkers];
+            io_batch_lock(r);
+            size_t left = r->hi - r->lo;
+            io_batch_unlock(r);
+            if(most < left) {
+                most = left;
+                victim = r;
+            }
+        }
+        if(NULL == victim) return false;
+
+        size_t lo = 0, hi = 0;
+        io_batch_lock(victim);
+        size_t left = victim->hi - victim->lo;
+        if(0 < left) {
+            // leave the owner the front half, which it is working through
+            hi = victim->hi;
+            lo = hi - ((left + 1) / 2);
+            victim->hi = lo;
+        }
+        io_batch_unlock(victim);
+
+        if(lo < hi) {
+            io_batch_range_t *own = &b->range[id];
+            io_batch_lock(own);
+            own->lo = lo;
+            own->hi = hi;
+            io_batch_unlock(own);
+            return true;
+        }
+        // the victim emptied its range before it could be stolen from, so look again
+    }
+}
+
+/// @brief loads files until there are none left to take or steal
+static void io_batch_work(io_batch_t *b, int id) {
+    size_t i;
+    image_pool_t *prev = image_set_pool(b->pool); // the caller's own thread works too
+    do {
+        while(io_batch_take(&b->range[id], &i)) {
+            // errno is per thread, so it can be picked up straight after the load
+            errno = 0;
+            b->out[i] = load_image(b->fns[i]);
+            int rval = (NULL != b->out[i]) ? 0 : ((0 != errno) ? errno : EIO);
+            if(NULL != b->errs) b->errs[i] = rval;
+        }
+    } while(io_batch_steal(b, id));
+    image_set_pool(prev);
+}
+
+#if !defined(_WIN32)
+static void *io_batch_thread(void *arg) {
+    io_batch_worker_t *w = (io_batch_worker_t *)arg;
+    io_batch_work(w->batch, w->id);
+    return NULL;
+}
+#else
+static DWORD WINAPI io_batch_thread(LPVOID arg) {
+    io_batch_worker_t *w = (io_batch_worker_t *)arg;
+    io_batch_work(w->batch, w->id);
+    return 0;
+}
+#endif
+
+/// @brief gets the number of processors available to run workers on
+static int io_batch_cpus(void) {
+#if !defined(_WIN32)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (0 < n) ? (int)n : 1;
+#else
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (0 < si.dwNumberOfProcessors) ? (int)si.dwNumberOfProcessors : 1;
+#endif
+}
+
+int load_images_batch(const char **fns, size_t n, pal_image_t **out, int *errs, int threads) {
+    int rval = 0;
+    io_batch_t b = {.fns = fns, .out = out, .errs = errs, .range = NULL, .nworkers = 0, .pool = io_pool_current()};
+    io_batch_worker_t *workers = NULL;
+#if !defined(_WIN32)
+    pthread_t *tid = NULL;
+#else
+    HANDLE *tid = NULL;
+#endif
+
+    if((NULL == fns) || (NULL == out)) return EBADF;
+    if(0 == n) return 0;
+
+    if(0 >= threads) threads = io_batch_cpus();
+    if((size_t)threads > n) threads = n;
+
+    if((NULL == (b.range = io_calloc(threads, sizeof(io_batch_range_t)))) || 
+       (NULL == (workers = io_calloc(threads, sizeof(io_batch_worker_t)))) || 
+       (NULL == (tid = io_calloc(threads, sizeof(*tid))))) {
+        rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+
+    // start each worker off with an even share of the files
+    for(int t = 0; t < threads; t++) {
+#if !defined(_WIN32)
+        pthread_mutex_init(&b.range[t].lock, NULL);
+#else
+        InitializeCriticalSection(&b.range[t].lock);
+#endif
+        b.range[t].lo = (n * t) / threads;
+        b.range[t].hi = (n * (t + 1)) / threads;
+        workers[t].batch = &b;
+        workers[t].id = t;
+    }
+    b.nworkers = threads;
+
+    // the calling thread is worker 0. If a worker can't be started its files are left
+    // in its range, where the others will steal them
+    int started = 1;
+    for(int t = 1; t < threads; t++) {
+#if !defined(_WIN32)
+        if(0 != pthread_create(&tid[t], NULL, io_batch_thread, &workers[t])) break;
+#else
+        if(NULL == (tid[t] = CreateThread(NULL, 0, io_batch_thread, &workers[t], 0, NULL))) break;
+#endif
+        started++;
+    }
+
+    io_batch_work(&b, 0);
+
+    for(int t = 1; t < started; t++) {
+#if !defined(_WIN32)
+        pthread_join(tid[t], NULL);
+#else
+        WaitForSingleObject(tid[t], INFINITE);
+        CloseHandle(tid[t]);
+#endif
+    }
+
+    // anything left in the range of a worker that never started still needs loading
+    for(int t = started; t < threads; t++) {
+        io_batch_work(&b, t);
+    }
+
+    for(size_t i = 0; i < n; i++) {
+        if(NULL == out[i]) {
+            rval = EIO;  // the details are in errs
+            break;
+        }
+    }
+
+CLEANUP:
+    for(int t = 0; t < b.nworkers; t++) {
+#if !defined(_WIN32)
+        pthread_mutex_destroy(&b.range[t].lock);
+#else
+        DeleteCriticalSection(&b.range[t].lock);
+#endif
+    }
+    free_s(tid);
+    free_s(workers);
+    free_s(b.range);
+    return rval;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <imageio.h>
+#include "io_priv.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#if defined(IO_X86) && defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#elif defined(IO_X86)
+#include <cpuid.h>
+#endif
+
+#define IO_CPU_ENV "CA_IMAGEIO_SIMD" // environment variable that lowers the level, for testing
+
+// the names for CA_IMAGEIO_SIMD, in io_cpu_level_t order
+static const char *io_cpu_names[] = {"scalar", "sse2", "ssse3", "avx2", "avx512", "neon"};
+
+static int io_cpu_best = IO_CPU_SCALAR; // the best the CPU can run
+static int io_cpu_cur = IO_CPU_SCALAR;  // the level the kernels are set to
+
+#if defined(_WIN32)
+static INIT_ONCE io_cpu_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t io_cpu_once = PTHREAD_ONCE_INIT;
+#endif
+
+#if defined(IO_X86)
+/// @brief runs cpuid for a leaf and subleaf
+/// @param r receives eax, ebx, ecx and edx
+static void io_cpuid(uint32_t leaf, uint32_t sub, uint32_t r[4]) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int v[4];
+    __cpuidex(v, (int)leaf, (int)sub);
+    for(int i = 0; i < 4; i++) r[i] = (uint32_t)v[i];
+#else
+    __cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+/// @brief the register state the OS saves on a task switch, from XCR0
+static uint64_t io_xgetbv(void) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+#endif
+
+/// @brief finds the best level the CPU supports. The wider registers also need the OS to save them
+static int io_cpu_detect(void) {
+#if defined(IO_X86)
+    uint32_t r[4];
+    io_cpuid(0, 0, r);
+    uint32_t leaves = r[0];
+    if(1 > leaves) return IO_CPU_SCALAR;
+
+    io_cpuid(1, 0, r);
+    if(0 == (r[3] & (1u << 26))) return IO_CPU_SCALAR; // SSE2
+    if(0 == (r[2] & (1u << 9))) return IO_CPU_SSE2;    // SSSE3
+    // the AVX registers need OSXSAVE, AVX, and the OS saving the XMM and YMM state
+    if((7 > leaves) || (0 == (r[2] & (1u << 27))) || (0 == (r[2] & (1u << 28)))) return IO_CPU_SSSE3;
+    uint64_t xcr0 = io_xgetbv();
+    if(0x06 != (xcr0 & 0x06)) return IO_CPU_SSSE3;
+
+    io_cpuid(7, 0, r);
+    if(0 == (r[1] & (1u << 5))) return IO_CPU_SSSE3;   // AVX2
+    // AVX-512 F and BW, and the OS saving the mask and ZMM state as well
+    if((0 == (r[1] & (1u << 16))) || (0 == (r[1] & (1u << 30))) || (0xe6 != (xcr0 & 0xe6))) return IO_CPU_AVX2;
+    return IO_CPU_AVX512;
+#elif defined(IO_NEON)
+    return IO_CPU_NEON; // part of the target, so there is nothing to ask
+#else
+    return IO_CPU_SCALAR;
+#endif
+}
+
+/// @brief sets the kernels for a level, lowered to what the CPU can run
+/// @return the level set
+static int io_cpu_set(int level) {
+    if((IO_CPU_SCALAR > level) || (IO_CPU_NEON < level)) {
+        level = io_cpu_best;
+    } else if(IO_CPU_SCALAR != level) {
+        // NEON and the x86 levels aren't comparable, so anything from the wrong family gets the best
+        bool neon = (IO_CPU_NEON == io_cpu_best);
+        if((neon != (IO_CPU_NEON == level)) || (level > io_cpu_best)) level = io_cpu_best;
+    }
+    io_pixels_select(level);
+    io_cpu_cur = level;
+    return level;
+}
+
+static void io_cpu_init(void) {
+    io_cpu_best = io_cpu_detect();
+    int level = io_cpu_best;
+
+    const char *env = getenv(IO_CPU_ENV);
+    if(NULL != env) {
+        for(int i = 0; i < (int)(sizeof(io_cpu_names) / sizeof(io_cpu_names[0])); i++) {
+            if(0 == strcmp(env, io_cpu_names[i])) level = i;
+        }
+    }
+    io_cpu_set(level);
+}
+
+#if defined(_WIN32)
+static BOOL CALLBACK io_cpu_init_once(PINIT_ONCE once, PVOID param, PVOID *ctx) {
+    io_cpu_init();
+    return TRUE;
+}
+#endif
+
+int io_cpu_level(void) {
+#if defined(_WIN32)
+    InitOnceExecuteOnce(&io_cpu_once, io_cpu_init_once, NULL, NULL);
+#else
+    pthread_once(&io_cpu_once, io_cpu_init);
+#endif
+    return io_cpu_cur;
+}
+
+int io_cpu_force(int level) {
+    io_cpu_level(); // so the best is known, and a later first call doesn't undo this
+    return io_cpu_set(level);
+}
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "io_priv.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+int io_open_file(const char *fn, io_file_t *f) {
+    if((NULL == fn) || (NULL == f)) return EBADF;
+
+    f->fp = NULL;
+    f->fd = -1;
+#if defined(_WIN32)
+    if(NULL == (f->fp = fopen(fn,"rb"))) {
+        return errno;  // can't open input file
+    }
+    f->io = image_io_file(f->fp);
+#else
+    // go straight to the descriptor, so we only ever read the bytes we ask for
+    if(0 > (f->fd = open(fn, O_RDONLY))) {
+        return errno;  // can't open input file
+    }
+    f->io = image_io_fd(f->fd);
+#endif
+    return 0;
+}
+
+void io_close_file(io_file_t *f) {
+    fclose_s(f->fp);
+#if !defined(_WIN32)
+    if(0 <= f->fd) close(f->fd);
+    f->fd = -1;
+#endif
+}
+
+int io_read_file(const char *fn, uint8_t **buf, size_t *len) {
+    int rval = 0;
+    FILE *fp = NULL;
+    uint8_t *data = NULL;
+
+    if((NULL == fn) || (NULL == buf) || (NULL == len)) return EBADF;
+
+    // try to open input file
+    if(NULL == (fp = fopen(fn,"rb"))) {
+        rval = errno;  // can't open input file
+        goto CLEANUP;
+    }
+
+    // get the size of the file
+    if(0 != fseek(fp, 0, SEEK_END)) {
+        rval = errno;
+        goto CLEANUP;
+    }
+    long fsz = ftell(fp);
+    if(0 > fsz) {
+        rval = errno;
+        goto CLEANUP;
+    }
+    fseek(fp, 0, SEEK_SET);
+
+    // always allocate at least 1 byte so an empty file still yields a valid buffer
+    if(NULL == (data = io_scratch_alloc(fsz + 1))) {
+        rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+
+    // pull the whole file in at once
+    if(0 < fsz) {
+        size_t nr = fread(data, fsz, 1, fp);
+        if(1 != nr) {
+            rval = ferror(fp) ? errno : EIO;  // can't read file
+            goto CLEANUP;
+        }
+    }
+
+    fclose_s(fp);
+    *buf = data;
+    *len = fsz;
+    return 0;
+CLEANUP:
+    fclose_s(fp);
+    free_s(data);
+    return rval;
+}
+
+int io_write_file(const char *fn, io_segs_t *segs) {
+    int rval = 0;
+
+    if((NULL == fn) || (NULL == segs)) return EBADF;
+
+#if defined(_WIN32)
+    FILE *fp = NULL;
+
+    // try to open/create output file
+    if(NULL == (fp = fopen(fn,"wb"))) {
+        return errno;  // can't open/create output file
+    }
+
+    image_io_t io = image_io_file(fp);
+    rval = io_write_segs(&io, segs);
+
+    // close explicitly so buffered write errors are reported
+    if(0 != fclose(fp)) {
+        if(0 == rval) rval = errno;
+    }
+#else
+    int fd = -1;
+
+    // try to open/create output file, bypassing stdio so the pieces go out in one writev
+    if(0 > (fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0666))) {
+        return errno;  // can't open/create output file
+    }
+
+    image_io_t io = image_io_fd(fd);
+    rval = io_write_segs(&io, segs);
+
+    if(0 != close(fd)) {
+        if(0 == rval) rval = errno;
+    }
+#endif
+    return rval;
+}
+
+int io_segs_add(io_segs_t *segs, const void *data, size_t len) {
+    if(0 == len) return 0; // nothing to add
+
+    // merge with the previous piece if this one directly follows it
+    if(0 < segs->count) {
+        image_iovec_t *last = &segs->iov[segs->count - 1];
+        if(((const uint8_t *)last->data + last->len) == data) {
+            last->len += len;
+            segs->len += len;
+            return 0;
+        }
+    }
+
+    if(segs->count == segs->cap) { // out of room, grow the list
+        int ncap = (0 == segs->cap) ? 8 : segs->cap * 2;
+        image_iovec_t *niov = io_realloc(segs->iov, ncap * sizeof(image_iovec_t));
+        if(NULL == niov) return errno;  // unable to allocate mem
+        segs->iov = niov;
+        segs->cap = ncap;
+    }
+
+    segs->iov[segs->count].data = data;
+    segs->iov[segs->count].len = len;
+    segs->count++;
+    segs->len += len;
+    return 0;
+}
+
+void io_segs_free(io_segs_t *segs) {
+    if(NULL == segs) return;
+    free_s(segs->iov);
+    free_s(segs->buf);
+    segs->count = 0;
+    segs->cap = 0;
+    segs->len = 0;
+}
+
+int io_segs_flatten(io_segs_t *segs, uint8_t **buf, size_t *len) {
+    uint8_t *data = NULL;
+
+    if((NULL == segs) || (NULL == buf) || (NULL == len)) return EBADF;
+
+    // a single piece that is the whole scratch buffer can just be handed over, as long
+    // as it came from malloc() so the caller can free() it
+    if((1 == segs->count) && (segs->iov[0].data == segs->buf) && io_alloc_is_libc()) {
+        *buf = segs->buf;
+        *len = segs->len;
+        segs->buf = NULL;
+        return 0;
+    }
+
+    if(NULL == (data = malloc(segs->len + 1))) return errno;  // unable to allocate mem
+
+    uint8_t *dp = data;
+    for(int i = 0; i < segs->count; i++) {
+        memcpy(dp, segs->iov[i].data, segs->iov[i].len);
+        dp += segs->iov[i].len;
+    }
+
+    *buf = data;
+    *len = segs->len;
+    return 0;
+}
+
+int io_write_segs(image_io_t *io, io_segs_t *segs) {
+    if((NULL == io) || (NULL == segs)) return EBADF;
+
+    if(NULL == io->writev) { // no gathered write, so send the pieces one at a time
+        for(int i = 0; i < segs->count; i++) {
+            int rval = io_write_all(io, segs->iov[i].data, segs->iov[i].len);
+            if(0 != rval) return rval;
+        }
+        return 0;
+    }
+
+    // keep going until everything is out, streams may take it in pieces
+    int first = 0;
+    while(first < segs->count) {
+        errno = 0;
+        int64_t nw = io->writev(io->user, &segs->iov[first], segs->count - first);
+        if(0 >= nw) return errno ? errno : EIO;  // can't write stream
+
+        // consume the pieces that were written, and trim any partially written one
+        while((first < segs->count) && (0 < nw)) {
+            image_iovec_t *v = &segs->iov[first];
+            if((size_t)nw >= v->len) {
+                nw -= v->len;
+                first++;
+            } else {
+                v->data = (const uint8_t *)v->data + nw;
+                v->len -= nw;
+                nw = 0;
+            }
+        }
+    }
+    return 0;
+}
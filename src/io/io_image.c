@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "io_priv.h"
+
+void io_image_fit(pal_image_t *img, int width, int height, int colours) {
+    size_t need = (size_t)width * height;
+    size_t pixcap = img->image_size + img->extra_size;
+
+    img->width = width;
+    img->height = height;
+    img->image_size = need;
+    img->extra_size = pixcap - need;
+    img->colours = colours;
+    img->transparent = -1;
+    // decoders rely on unused palette entries being 0, as they are from image_alloc()
+    memset(img->pal, 0, (size_t)colours * sizeof(img_pal_entry_t));
+}
+
+int io_image_reuse(pal_image_t **img, int width, int height, int colours) {
+    if(NULL == img) return EBADF;
+
+    size_t need = (size_t)width * height;
+    pal_image_t *cur = *img;
+
+    // the existing storage is big enough, so just re-dimension it. The pixel capacity is kept
+    // as image_size + extra_size so a smaller frame doesn't lose it. ca-image only records the
+    // colours in use, so the palette is only known to be big enough when it already has as many
+    if((NULL != cur) && ((cur->image_size + cur->extra_size) >= need) && (cur->colours >= colours)) {
+        io_image_fit(cur, width, height, colours);
+        return 0;
+    }
+
+    // too small, or nothing there yet, swap in a fresh image
+    pal_image_t *fresh = io_image_new(width, height, colours);
+    if(NULL == fresh) return (0 != errno) ? errno : ENOMEM;
+
+    io_image_drop(cur);
+    *img = fresh;
+    return 0;
+}
+
+/// @brief swaps two rows of pixels, a piece at a time through the stack
+static void io_swap_rows(uint8_t *a, uint8_t *b, size_t len) {
+    uint8_t tmp[256];
+    while(0 < len) {
+        size_t n = (len < sizeof(tmp)) ? len : sizeof(tmp);
+        memcpy(tmp, a, n);
+        memcpy(a, b, n);
+        memcpy(b, tmp, n);
+        a += n;
+        b += n;
+        len -= n;
+    }
+}
+
+int io_read_rows(image_io_t *io, pal_image_t *img, size_t stride, bool bottom_up) {
+    size_t w = img->width;
+    size_t h = img->height;
+    size_t cap = img->image_size + img->extra_size;
+    uint8_t *px = img->pixels;
+    size_t done = 0;
+
+    if(stride < w) return EINVAL;
+
+    // read as many whole rows as there is room for in one go, padding and all, then close up the
+    // padding. Each pass frees room for more, and a last row doesn't need its padding at all
+    while(done < h) {
+        size_t room = cap - (done * w);
+        size_t rows = room / stride;
+        size_t len = rows * stride;
+        if(rows >= (h - done)) {
+            rows = h - done;
+            len = ((rows - 1) * stride) + w;
+        } else if(0 == rows) { // very narrow rows, so take one and skip its padding
+            rows = 1;
+            len = w;
+        }
+
+        int rval = io_read_exact(io, &px[done * w], len);
+        if(0 != rval) return rval;
+        for(size_t r = 1; r < rows; r++) {
+            memmove(&px[(done + r) * w], &px[(done * w) + (r * stride)], w);
+        }
+        done += rows;
+
+        if((len == w) && (done < h) && (stride > w)) {
+            if(0 != (rval = io_skip(io, stride - w))) return rval;
+        }
+    }
+
+    // bottom up rows are put the right way up where they are
+    if(bottom_up) {
+        for(size_t y = 0; y < (h / 2); y++) {
+            io_swap_rows(&px[y * w], &px[(h - 1 - y) * w], w);
+        }
+    }
+    return 0;
+}
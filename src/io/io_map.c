@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "io_priv.h"
+
+#if defined(_WIN32)
+// no mmap, fall back to reading the file into memory
+int io_map_file(const char *fn, io_map_t *map) {
+    if(NULL == map) return EBADF;
+    map->mapped = 0;
+    return io_read_file(fn, &map->data, &map->len);
+}
+
+void io_unmap_file(io_map_t *map) {
+    if(NULL == map) return;
+    free_s(map->data);
+    map->len = 0;
+}
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int io_map_file(const char *fn, io_map_t *map) {
+    int rval = 0;
+    int fd = -1;
+
+    if((NULL == fn) || (NULL == map)) return EBADF;
+    map->data = NULL;
+    map->len = 0;
+    map->mapped = 0;
+
+    // try to open input file
+    if(0 > (fd = open(fn, O_RDONLY))) {
+        return errno;  // can't open input file
+    }
+
+    struct stat st;
+    if(0 != fstat(fd, &st)) {
+        rval = errno;
+        goto CLEANUP;
+    }
+
+    // an empty file can't be mapped, and can't be an image either
+    if(0 == st.st_size) {
+        rval = EINVAL;
+        goto CLEANUP;
+    }
+
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(MAP_FAILED == p) { // some file systems can't be mapped, so just read it instead
+        close(fd);
+        return io_read_file(fn, &map->data, &map->len);
+    }
+
+    // the decoders walk the file front to back
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+    map->data = p;
+    map->len = st.st_size;
+    map->mapped = 1;
+CLEANUP:
+    close(fd); // the mapping stays valid after the descriptor is closed
+    return rval;
+}
+
+void io_unmap_file(io_map_t *map) {
+    if(NULL == map) return;
+    if(map->mapped) {
+        if(NULL != map->data) munmap(map->data, map->len);
+        map->data = NULL;
+    } else {
+        free_s(map->data);
+    }
+    map->len = 0;
+    map->mapped = 0;
+}
+#endif
@@ -0,0 +1,693 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <imageio.h>
+#include "io_priv.h"
+
+// every x86 version is built whatever the compiler targets, each with the instruction set it
+// needs, and io_pixels_select() points the kernels at the ones the CPU can run
+#if defined(IO_X86)
+#include <immintrin.h>
+#elif defined(IO_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/// @brief index of the lowest set bit, m must not be 0
+static inline unsigned io_ctz(uint32_t m) {
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, m);
+    return (unsigned)i;
+#else
+    return (unsigned)__builtin_ctz(m);
+#endif
+}
+
+/// @brief index of the lowest set bit of a 64 bit mask, m must not be 0
+static inline unsigned io_ctz64(uint64_t m) {
+#if defined(_MSC_VER) && defined(_M_IX86)
+    return (0 != (uint32_t)m) ? io_ctz((uint32_t)m) : (32 + io_ctz((uint32_t)(m >> 32)));
+#elif defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward64(&i, m);
+    return (unsigned)i;
+#else
+    return (unsigned)__builtin_ctzll(m);
+#endif
+}
+
+/// @brief the versions of the kernels in use, the scalar ones until io_pixels_select() is called
+typedef struct {
+    void (*planar4)(uint8_t *dst, const uint8_t *src, size_t stride, int width);
+    void (*unpack4)(uint8_t *dst, const uint8_t *src, int width);
+    void (*pack4)(uint8_t *dst, const uint8_t *src, int width);
+    size_t (*span_le)(const uint8_t *src, size_t len, uint8_t max);
+    size_t (*span_eq)(const uint8_t *src, size_t len);
+    size_t (*span_distinct)(const uint8_t *src, size_t len);
+    void (*swap3)(uint8_t *dst, const uint8_t *src, int count);
+    void (*to_bgra)(uint8_t *dst, const uint8_t *src, int count, uint8_t alpha);
+    int (*from_bgra)(uint8_t *dst, const uint8_t *src, int count);
+} io_kernels_t;
+
+// spreads the 8 bits of a plane byte across the 8 bytes of a 64 bit word, in memory order,
+// so each pixel gets a 0 or 1 in its own byte, left most pixel (the top bit) first
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define IO_AT(j) (8 * (7 - (j)))
+#else
+#define IO_AT(j) (8 * (j))
+#endif
+#define IO_BIT(b, j) ((uint64_t)(((b) >> (7 - (j))) & 1) << IO_AT(j))
+#define IO_SPREAD(b) (IO_BIT(b, 0) | IO_BIT(b, 1) | IO_BIT(b, 2) | IO_BIT(b, 3) | \
+                      IO_BIT(b, 4) | IO_BIT(b, 5) | IO_BIT(b, 6) | IO_BIT(b, 7))
+#define IO_SPREAD4(b) IO_SPREAD(b), IO_SPREAD((b) + 1), IO_SPREAD((b) + 2), IO_SPREAD((b) + 3)
+#define IO_SPREAD16(b) IO_SPREAD4(b), IO_SPREAD4((b) + 4), IO_SPREAD4((b) + 8), IO_SPREAD4((b) + 12)
+#define IO_SPREAD64(b) IO_SPREAD16(b), IO_SPREAD16((b) + 16), IO_SPREAD16((b) + 32), IO_SPREAD16((b) + 48)
+
+static const uint64_t io_spread[256] = {
+    IO_SPREAD64(0), IO_SPREAD64(64), IO_SPREAD64(128), IO_SPREAD64(192)
+};
+
+/// @brief combines the plane bytes for 8 pixels into the 8 pixels
+static inline uint64_t io_planes8(const uint8_t *p0, size_t stride, size_t i) {
+    return io_spread[p0[i]] | (io_spread[p0[stride + i]] << 1) |
+           (io_spread[p0[(stride * 2) + i]] << 2) | (io_spread[p0[(stride * 3) + i]] << 3);
+}
+
+/*
+ * The scalar versions. Each one carries on from where a vector loop stopped, so it finishes the
+ * line for them all, and is the whole of the kernel when there is nothing better to run
+ */
+
+static inline void io_planar4_from(uint8_t *dst, const uint8_t *src, size_t stride, int width, size_t i) {
+    size_t n = (0 < width) ? (size_t)width / 8 : 0; // whole plane bytes
+    for(; i < n; i++) { // 8 pixels at a time, with no tests at all
+        uint64_t px = io_planes8(src, stride, i);
+        memcpy(&dst[i * 8], &px, sizeof(px));
+    }
+    if(width & 7) { // the last few pixels come from the top bits of one more byte
+        uint64_t px = io_planes8(src, stride, n);
+        memcpy(&dst[n * 8], &px, width & 7);
+    }
+}
+
+static inline void io_unpack4_from(uint8_t *dst, const uint8_t *src, int width, size_t i) {
+    size_t n = (0 < width) ? (size_t)width / 2 : 0; // whole pixel pairs
+    for(; i < n; i++) {
+        uint8_t sp = src[i];
+        dst[i * 2] = sp >> 4;
+        dst[i * 2 + 1] = sp & 0x0f;
+    }
+    if(width & 1) dst[n * 2] = src[n] >> 4; // an odd width ends with half a byte
+}
+
+static inline void io_pack4_from(uint8_t *dst, const uint8_t *src, int width, size_t i) {
+    size_t n = (0 < width) ? (size_t)width / 2 : 0; // whole pixel pairs
+    for(; i < n; i++) {
+        dst[i] = (uint8_t)((src[i * 2] << 4) | (src[i * 2 + 1] & 0x0f));
+    }
+    if(width & 1) dst[n] = (uint8_t)(src[n * 2] << 4); // an odd width ends with half a byte
+}
+
+static inline size_t io_span_le_from(const uint8_t *src, size_t len, uint8_t max, size_t i) {
+    while((i < len) && (src[i] <= max)) i++;
+    return i;
+}
+
+static inline size_t io_span_eq_from(const uint8_t *src, size_t len, size_t i) {
+    while((i < len) && (src[i] == src[0])) i++;
+    return i;
+}
+
+static inline size_t io_span_distinct_from(const uint8_t *src, size_t len, size_t i) {
+    while(((i + 1) < len) && (src[i] != src[i + 1])) i++;
+    if((i + 1) == len) i++; // nothing follows the last byte, so it can't start a run
+    return i;
+}
+
+/// @brief swaps the first and third byte of each 3 byte entry, which turns RGB into BGR and back
+static inline void io_swap3_from(uint8_t *dst, const uint8_t *src, int count, int i) {
+    for(; i < count; i++) {
+        uint8_t t = src[i * 3];
+        dst[i * 3] = src[i * 3 + 2];
+        dst[i * 3 + 1] = src[i * 3 + 1];
+        dst[i * 3 + 2] = t;
+    }
+}
+
+static inline void io_to_bgra_from(uint8_t *dst, const uint8_t *src, int count, uint8_t alpha, int i) {
+    for(; i < count; i++) {
+        dst[i * 4] = src[i * 3 + 2];
+        dst[i * 4 + 1] = src[i * 3 + 1];
+        dst[i * 4 + 2] = src[i * 3];
+        dst[i * 4 + 3] = alpha;
+    }
+}
+
+/// @return the first entry from i on with an alpha of 0, or first if it was already found
+static inline int io_from_bgra_from(uint8_t *dst, const uint8_t *src, int count, int first, int i) {
+    for(; i < count; i++) {
+        dst[i * 3] = src[i * 4 + 2];
+        dst[i * 3 + 1] = src[i * 4 + 1];
+        dst[i * 3 + 2] = src[i * 4];
+        if((0 > first) && (0 == src[i * 4 + 3])) first = i;
+    }
+    return first;
+}
+
+static void io_planar4_scalar(uint8_t *dst, const uint8_t *src, size_t stride, int width) {
+    io_planar4_from(dst, src, stride, width, 0);
+}
+
+static void io_unpack4_scalar(uint8_t *dst, const uint8_t *src, int width) {
+    io_unpack4_from(dst, src, width, 0);
+}
+
+static void io_pack4_scalar(uint8_t *dst, const uint8_t *src, int width) {
+    io_pack4_from(dst, src, width, 0);
+}
+
+static size_t io_span_le_scalar(const uint8_t *src, size_t len, uint8_t max) {
+    return io_span_le_from(src, len, max, 0);
+}
+
+static size_t io_span_eq_scalar(const uint8_t *src, size_t len) {
+    return io_span_eq_from(src, len, 1);
+}
+
+static size_t io_span_distinct_scalar(const uint8_t *src, size_t len) {
+    return io_span_distinct_from(src, len, 0);
+}
+
+static void io_swap3_scalar(uint8_t *dst, const uint8_t *src, int count) {
+    io_swap3_from(dst, src, count, 0);
+}
+
+static void io_to_bgra_scalar(uint8_t *dst, const uint8_t *src, int count, uint8_t alpha) {
+    io_to_bgra_from(dst, src, count, alpha, 0);
+}
+
+static int io_from_bgra_scalar(uint8_t *dst, const uint8_t *src, int count) {
+    return io_from_bgra_from(dst, src, count, -1, 0);
+}
+
+static const io_kernels_t io_scalar = {
+    io_planar4_scalar, io_unpack4_scalar, io_pack4_scalar,
+    io_span_le_scalar, io_span_eq_scalar, io_span_distinct_scalar,
+    io_swap3_scalar, io_to_bgra_scalar, io_from_bgra_scalar
+};
+
+static io_kernels_t io_kern = {
+    io_planar4_scalar, io_unpack4_scalar, io_pack4_scalar,
+    io_span_le_scalar, io_span_eq_scalar, io_span_distinct_scalar,
+    io_swap3_scalar, io_to_bgra_scalar, io_from_bgra_scalar
+};
+
+#if defined(IO_X86)
+
+/*
+ * SSE2, 16 bytes at a time
+ */
+
+IO_TARGET("sse2") static void io_unpack4_sse2(uint8_t *dst, const uint8_t *src, int width) {
+    size_t n = (0 < width) ? (size_t)width / 2 : 0;
+    size_t i = 0;
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    for(; (i + 16) <= n; i += 16) { // 16 bytes in, 32 pixels out
+        __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        __m128i lo = _mm_and_si128(v, mask);
+        _mm_storeu_si128((__m128i *)&dst[i * 2], _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)&dst[i * 2 + 16], _mm_unpackhi_epi8(hi, lo));
+    }
+    io_unpack4_from(dst, src, width, i);
+}
+
+IO_TARGET("sse2") static void io_pack4_sse2(uint8_t *dst, const uint8_t *src, int width) {
+    size_t n = (0 < width) ? (size_t)width / 2 : 0;
+    size_t i = 0;
+    const __m128i mask = _mm_set1_epi16(0x000f);
+    for(; (i + 16) <= n; i += 16) { // 32 pixels in, 16 bytes out
+        // each 16 bit lane holds a pair, the left pixel in the low byte
+        __m128i a = _mm_loadu_si128((const __m128i *)&src[i * 2]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&src[i * 2 + 16]);
+        a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, mask), 4), _mm_and_si128(_mm_srli_epi16(a, 8), mask));
+        b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, mask), 4), _mm_and_si128(_mm_srli_epi16(b, 8), mask));
+        _mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(a, b));
+    }
+    io_pack4_from(dst, src, width, i);
+}
+
+IO_TARGET("sse2") static size_t io_span_le_sse2(const uint8_t *src, size_t len, uint8_t max) {
+    size_t i = 0;
+    const __m128i limit = _mm_set1_epi8((char)max);
+    for(; (i + 16) <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+        // a byte is in the span when the larger of it and the limit is the limit
+        uint32_t m = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, limit), limit)) & 0xffff;
+        if(0 != m) return i + io_ctz(m);
+    }
+    return io_span_le_from(src, len, max, i);
+}
+
+IO_TARGET("sse2") static size_t io_span_eq_sse2(const uint8_t *src, size_t len) {
+    size_t i = 1;
+    const __m128i val = _mm_set1_epi8((char)src[0]);
+    for(; (i + 16) <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+        uint32_t m = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, val)) & 0xffff;
+        if(0 != m) return i + io_ctz(m);
+    }
+    return io_span_eq_from(src, len, i);
+}
+
+IO_TARGET("sse2") static size_t io_span_distinct_sse2(const uint8_t *src, size_t len) {
+    size_t i = 0;
+    // each byte is compared with the one after it, so the loop stops a byte short of the end
+    for(; (i + 17) <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+        __m128i next = _mm_loadu_si128((const __m128i *)&src[i + 1]);
+        uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, next));
+        if(0 != m) return i + io_ctz(m);
+    }
+    return io_span_distinct_from(src, len, i);
+}
+
+/*
+ * SSSE3, the palette shuffles
+ */
+
+IO_TARGET("ssse3") static void io_swap3_ssse3(uint8_t *dst, const uint8_t *src, int count) {
+    int i = 0;
+    // 5 entries to each 16 bytes, the last byte is overwritten by the next store
+    const __m128i order = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+    for(; (i + 6) <= count; i += 5) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&src[i * 3]);
+        _mm_storeu_si128((__m128i *)&dst[i * 3], _mm_shuffle_epi8(v, order));
+    }
+    io_swap3_from(dst, src, count, i);
+}
+
+IO_TARGET("ssse3") static void io_to_bgra_ssse3(uint8_t *dst, const uint8_t *src, int count, uint8_t alpha) {
+    int i = 0;
+    // 4 entries at a time, reading 16 bytes for the 12 that are used
+    const __m128i order = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i a = _mm_set1_epi32((int)((uint32_t)alpha << 24));
+    for(; (i + 6) <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&src[i * 3]);
+        _mm_storeu_si128((__m128i *)&dst[i * 4], _mm_or_si128(_mm_shuffle_epi8(v, order), a));
+    }
+    io_to_bgra_from(dst, src, count, alpha, i);
+}
+
+IO_TARGET("ssse3") static int io_from_bgra_ssse3(uint8_t *dst, const uint8_t *src, int count) {
+    int first = -1;
+    int i = 0;
+    // 4 entries at a time, writing 16 bytes for the 12 that are used
+    const __m128i order = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m128i zero = _mm_setzero_si128();
+    for(; (i + 6) <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&src[i * 4]);
+        _mm_storeu_si128((__m128i *)&dst[i * 3], _mm_shuffle_epi8(v, order));
+        uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & 0x8888; // the alpha bytes
+        if((0 > first) && (0 != m)) first = i + (int)(io_ctz(m) / 4);
+    }
+    return io_from_bgra_from(dst, src, count, first, i);
+}
+
+/*
+ * AVX2, 32 bytes at a time. What is left over is handed down to the SSE2 version
+ */
+
+IO_TARGET("avx2") static void io_planar4_avx2(uint8_t *dst, const uint8_t *src, size_t stride, int width) {
+    size_t n = (0 < width) ? (size_t)width / 8 : 0;
+    size_t i = 0;
+    // each plane byte is copied to 8 lanes, and each lane tests its own bit of it
+    const __m256i bits = _mm256_set1_epi64x(0x0102040810204080ull);
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    for(; (i + 4) <= n; i += 4) { // 4 bytes of each plane in, 32 pixels out
+        __m256i px = _mm256_setzero_si256();
+        for(int k = 0; k < 4; k++) {
+            uint32_t w;
+            memcpy(&w, &src[(stride * k) + i], sizeof(w));
+            __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int)w), spread);
+            v = _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), bits);
+            px = _mm256_or_si256(px, _mm256_and_si256(v, _mm256_set1_epi8((char)(1 << k))));
+        }
+        _mm256_storeu_si256((__m256i *)&dst[i * 8], px);
+    }
+    _mm256_zeroupper(); // the rest runs SSE code, which stalls while the upper halves are in use
+    io_planar4_from(dst, src, stride, width, i);
+}
+
+IO_TARGET("avx2") static void io_unpack4_avx2(uint8_t *dst, const uint8_t *src, int width) {
+    size_t n = (0 < width) ? (size_t)width / 2 : 0;
+    size_t i = 0;
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    for(; (i + 32) <= n; i += 32) { // 32 bytes in, 64 pixels out
+        __m256i v = _mm256_loadu_si256((const __m256i *)&src[i]);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+        __m256i lo = _mm256_and_si256(v, mask);
+        // the unpacks work within each 128 bit half, so put the halves back in order after
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)&dst[i * 2], _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)&dst[i * 2 + 32], _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    _mm256_zeroupper();
+    io_unpack4_sse2(&dst[i * 2], &src[i], width - (int)(i * 2)); // the rest is too short for 256 bits
+}
+
+IO_TARGET("avx2") static void io_pack4_avx2(uint8_t *dst, const uint8_t *src, int width) {
+    size_t n = (0 < width) ? (size_t)width / 2 : 0;
+    size_t i = 0;
+    const __m256i mask = _mm256_set1_epi16(0x000f);
+    for(; (i + 32) <= n; i += 32) { // 64 pixels in, 32 bytes out
+        __m256i a = _mm256_loadu_si256((const __m256i *)&src[i * 2]);
+        __m256i b = _mm256_loadu_si256((const __m256i *)&src[i * 2 + 32]);
+        a = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(a, mask), 4), _mm256_and_si256(_mm256_srli_epi16(a, 8), mask));
+        b = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(b, mask), 4), _mm256_and_si256(_mm256_srli_epi16(b, 8), mask));
+        // the pack works within each 128 bit half, so put the quarters back in order after
+        __m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+        _mm256_storeu_si256((__m256i *)&dst[i], v);
+    }
+    _mm256_zeroupper();
+    io_pack4_sse2(&dst[i], &src[i * 2], width - (int)(i * 2));
+}
+
+IO_TARGET("avx2") static size_t io_span_le_avx2(const uint8_t *src, size_t len, uint8_t max) {
+    size_t i = 0;
+    const __m256i limit = _mm256_set1_epi8((char)max);
+    for(; (i + 32) <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&src[i]);
+        uint32_t m = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, limit), limit));
+        if(0 != m) return i + io_ctz(m);
+    }
+    _mm256_zeroupper();
+    return i + io_span_le_sse2(&src[i], len - i, max);
+}
+
+IO_TARGET("avx2") static size_t io_span_eq_avx2(const uint8_t *src, size_t len) {
+    size_t i = 1;
+    const __m256i val = _mm256_set1_epi8((char)src[0]);
+    for(; (i + 32) <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&src[i]);
+        uint32_t m = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, val));
+        if(0 != m) return i + io_ctz(m);
+    }
+    _mm256_zeroupper();
+    return (i - 1) + io_span_eq_sse2(&src[i - 1], len - (i - 1)); // src[i - 1] is the same as src[0]
+}
+
+IO_TARGET("avx2") static size_t io_span_distinct_avx2(const uint8_t *src, size_t len) {
+    size_t i = 0;
+    for(; (i + 33) <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&src[i]);
+        __m256i next = _mm256_loadu_si256((const __m256i *)&src[i + 1]);
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, next));
+        if(0 != m) return i + io_ctz(m);
+    }
+    _mm256_zeroupper();
+    return i + io_span_distinct_sse2(&src[i], len - i);
+}
+
+/*
+ * AVX-512 BW, 64 bytes at a time with the compares going straight to a mask, handing what is left
+ * over down to the AVX2 version
+ */
+
+IO_TARGET("avx512f,avx512bw") static void io_unpack4_avx512(uint8_t *dst, const uint8_t *src, int width) {
+    size_t n = (0 < width) ? (size_t)width / 2 : 0;
+    size_t i = 0;
+    const __m512i mask = _mm512_set1_epi8(0x0f);
+    // the unpacks work within each 128 bit quarter, these put the quarters back in order after
+    const __m512i first = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+    const __m512i second = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+    for(; (i + 64) <= n; i += 64) { // 64 bytes in, 128 pixels out
+        __m512i v = _mm512_loadu_si512((const void *)&src[i]);
+        __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), mask);
+        __m512i lo = _mm512_and_si512(v, mask);
+        __m512i a = _mm512_unpacklo_epi8(hi, lo);
+        __m512i b = _mm512_unpackhi_epi8(hi, lo);
+        _mm512_storeu_si512((void *)&dst[i * 2], _mm512_permutex2var_epi64(a, first, b));
+        _mm512_storeu_si512((void *)&dst[i * 2 + 64], _mm512_permutex2var_epi64(a, second, b));
+    }
+    io_unpack4_avx2(&dst[i * 2], &src[i], width - (int)(i * 2)); // the rest is too short for 512 bits
+}
+
+IO_TARGET("avx512f,avx512bw") static void io_pack4_avx512(uint8_t *dst, const uint8_t *src, int width) {
+    size_t n = (0 < width) ? (size_t)width / 2 : 0;
+    size_t i = 0;
+    const __m512i mask = _mm512_set1_epi16(0x000f);
+    // the pack works within each 128 bit quarter, this puts the eighths back in order after
+    const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    for(; (i + 64) <= n; i += 64) { // 128 pixels in, 64 bytes out
+        __m512i a = _mm512_loadu_si512((const void *)&src[i * 2]);
+        __m512i b = _mm512_loadu_si512((const void *)&src[i * 2 + 64]);
+        a = _mm512_or_si512(_mm512_slli_epi16(_mm512_and_si512(a, mask), 4), _mm512_and_si512(_mm512_srli_epi16(a, 8), mask));
+        b = _mm512_or_si512(_mm512_slli_epi16(_mm512_and_si512(b, mask), 4), _mm512_and_si512(_mm512_srli_epi16(b, 8), mask));
+        _mm512_storeu_si512((void *)&dst[i], _mm512_permutexvar_epi64(order, _mm512_packus_epi16(a, b)));
+    }
+    io_pack4_avx2(&dst[i], &src[i * 2], width - (int)(i * 2));
+}
+
+IO_TARGET("avx512f,avx512bw") static size_t io_span_le_avx512(const uint8_t *src, size_t len, uint8_t max) {
+    size_t i = 0;
+    const __m512i limit = _mm512_set1_epi8((char)max);
+    for(; (i + 64) <= len; i += 64) {
+        uint64_t m = _mm512_cmpgt_epu8_mask(_mm512_loadu_si512((const void *)&src[i]), limit);
+        if(0 != m) return i + io_ctz64(m);
+    }
+    return i + io_span_le_avx2(&src[i], len - i, max);
+}
+
+IO_TARGET("avx512f,avx512bw") static size_t io_span_eq_avx512(const uint8_t *src, size_t len) {
+    size_t i = 1;
+    const __m512i val = _mm512_set1_epi8((char)src[0]);
+    for(; (i + 64) <= len; i += 64) {
+        uint64_t m = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512((const void *)&src[i]), val);
+        if(0 != m) return i + io_ctz64(m);
+    }
+    return (i - 1) + io_span_eq_avx2(&src[i - 1], len - (i - 1));
+}
+
+IO_TARGET("avx512f,avx512bw") static size_t io_span_distinct_avx512(const uint8_t *src, size_t len) {
+    size_t i = 0;
+    for(; (i + 65) <= len; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void *)&src[i]);
+        __m512i next = _mm512_loadu_si512((const void *)&src[i + 1]);
+        uint64_t m = _mm512_cmpeq_epi8_mask(v, next);
+        if(0 != m) return i + io_ctz64(m);
+    }
+    return i + io_span_distinct_avx2(&src[i], len - i);
+}
+
+#elif defined(IO_NEON)
+
+/*
+ * NEON, 16 bytes at a time. The spans need the across vector reductions of AArch64
+ */
+
+static void io_unpack4_neon(uint8_t *dst, const uint8_t *src, int width) {
+    size_t n = (0 < width) ? (size_t)width / 2 : 0;
+    size_t i = 0;
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    for(; (i + 16) <= n; i += 16) { // 16 bytes in, 32 pixels out
+        uint8x16_t v = vld1q_u8(&src[i]);
+        uint8x16x2_t px = {{vshrq_n_u8(v, 4), vandq_u8(v, mask)}};
+        vst2q_u8(&dst[i * 2], px);
+    }
+    io_unpack4_from(dst, src, width, i);
+}
+
+static void io_pack4_neon(uint8_t *dst, const uint8_t *src, int width) {
+    size_t n = (0 < width) ? (size_t)width / 2 : 0;
+    size_t i = 0;
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    for(; (i + 16) <= n; i += 16) { // 32 pixels in, 16 bytes out
+        uint8x16x2_t px = vld2q_u8(&src[i * 2]); // left pixels in val[0], right in val[1]
+        vst1q_u8(&dst[i], vorrq_u8(vshlq_n_u8(px.val[0], 4), vandq_u8(px.val[1], mask)));
+    }
+    io_pack4_from(dst, src, width, i);
+}
+
+#if defined(__aarch64__)
+static size_t io_span_le_neon(const uint8_t *src, size_t len, uint8_t max) {
+    size_t i = 0;
+    const uint8x16_t limit = vdupq_n_u8(max);
+    for(; (i + 16) <= len; i += 16) {
+        if(0xff != vminvq_u8(vcleq_u8(vld1q_u8(&src[i]), limit))) break; // the scalar loop finds which one
+    }
+    return io_span_le_from(src, len, max, i);
+}
+
+static size_t io_span_eq_neon(const uint8_t *src, size_t len) {
+    size_t i = 1;
+    const uint8x16_t val = vdupq_n_u8(src[0]);
+    for(; (i + 16) <= len; i += 16) {
+        if(0xff != vminvq_u8(vceqq_u8(vld1q_u8(&src[i]), val))) break; // the scalar loop finds which one
+    }
+    return io_span_eq_from(src, len, i);
+}
+
+static size_t io_span_distinct_neon(const uint8_t *src, size_t len) {
+    size_t i = 0;
+    for(; (i + 17) <= len; i += 16) {
+        if(0 != vmaxvq_u8(vceqq_u8(vld1q_u8(&src[i]), vld1q_u8(&src[i + 1])))) break; // the scalar loop finds which one
+    }
+    return io_span_distinct_from(src, len, i);
+}
+#endif
+
+static void io_swap3_neon(uint8_t *dst, const uint8_t *src, int count) {
+    int i = 0;
+    for(; (i + 16) <= count; i += 16) {
+        uint8x16x3_t v = vld3q_u8(&src[i * 3]);
+        uint8x16_t t = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = t;
+        vst3q_u8(&dst[i * 3], v);
+    }
+    io_swap3_from(dst, src, count, i);
+}
+
+static void io_to_bgra_neon(uint8_t *dst, const uint8_t *src, int count, uint8_t alpha) {
+    int i = 0;
+    for(; (i + 16) <= count; i += 16) {
+        uint8x16x3_t v = vld3q_u8(&src[i * 3]);
+        uint8x16x4_t o = {{v.val[2], v.val[1], v.val[0], vdupq_n_u8(alpha)}};
+        vst4q_u8(&dst[i * 4], o);
+    }
+    io_to_bgra_from(dst, src, count, alpha, i);
+}
+
+static int io_from_bgra_neon(uint8_t *dst, const uint8_t *src, int count) {
+    int first = -1;
+    int i = 0;
+    for(; (i + 16) <= count; i += 16) {
+        uint8x16x4_t v = vld4q_u8(&src[i * 4]);
+        uint8x16x3_t o = {{v.val[2], v.val[1], v.val[0]}};
+        vst3q_u8(&dst[i * 3], o);
+        if(0 > first) {
+            for(int k = 0; k < 16; k++) {
+                if(0 == src[(i + k) * 4 + 3]) {
+                    first = i + k;
+                    break;
+                }
+            }
+        }
+    }
+    return io_from_bgra_from(dst, src, count, first, i);
+}
+
+#endif
+
+void io_pixels_select(int level) {
+    io_kernels_t k = io_scalar;
+
+#if defined(IO_X86)
+    if(IO_CPU_SSE2 <= level) {
+        k.unpack4 = io_unpack4_sse2;
+        k.pack4 = io_pack4_sse2;
+        k.span_le = io_span_le_sse2;
+        k.span_eq = io_span_eq_sse2;
+        k.span_distinct = io_span_distinct_sse2;
+    }
+    if(IO_CPU_SSSE3 <= level) {
+        k.swap3 = io_swap3_ssse3;
+        k.to_bgra = io_to_bgra_ssse3;
+        k.from_bgra = io_from_bgra_ssse3;
+    }
+    if(IO_CPU_AVX2 <= level) {
+        k.planar4 = io_planar4_avx2;
+        k.unpack4 = io_unpack4_avx2;
+        k.pack4 = io_pack4_avx2;
+        k.span_le = io_span_le_avx2;
+        k.span_eq = io_span_eq_avx2;
+        k.span_distinct = io_span_distinct_avx2;
+    }
+    if(IO_CPU_AVX512 <= level) { // the plane transpose and the palettes stay with AVX2 and SSSE3
+        k.unpack4 = io_unpack4_avx512;
+        k.pack4 = io_pack4_avx512;
+        k.span_le = io_span_le_avx512;
+        k.span_eq = io_span_eq_avx512;
+        k.span_distinct = io_span_distinct_avx512;
+    }
+#elif defined(IO_NEON)
+    if(IO_CPU_NEON == level) {
+        k.unpack4 = io_unpack4_neon;
+        k.pack4 = io_pack4_neon;
+#if defined(__aarch64__)
+        k.span_le = io_span_le_neon;
+        k.span_eq = io_span_eq_neon;
+        k.span_distinct = io_span_distinct_neon;
+#endif
+        k.swap3 = io_swap3_neon;
+        k.to_bgra = io_to_bgra_neon;
+        k.from_bgra = io_from_bgra_neon;
+    }
+#else
+    (void)level;
+#endif
+
+    io_kern = k;
+}
+
+// pick the kernels when the library is loaded, before any thread can be using them. Anything that
+// runs sooner, or a compiler that can't do this, gets the scalar versions until io_cpu_level() is called
+#if defined(__GNUC__)
+__attribute__((constructor)) static void io_pixels_init(void) {
+    io_cpu_level();
+}
+#elif defined(_MSC_VER)
+static void __cdecl io_pixels_init(void) {
+    io_cpu_level();
+}
+#pragma section(".CRT$XCU", read)
+__declspec(allocate(".CRT$XCU")) void (__cdecl *io_pixels_init_ptr)(void) = io_pixels_init;
+#endif
+
+void io_planar4(uint8_t *dst, const uint8_t *src, size_t stride, int width) {
+    io_kern.planar4(dst, src, stride, width);
+}
+
+void io_unpack4(uint8_t *dst, const uint8_t *src, int width) {
+    io_kern.unpack4(dst, src, width);
+}
+
+void io_pack4(uint8_t *dst, const uint8_t *src, int width) {
+    io_kern.pack4(dst, src, width);
+}
+
+size_t io_span_le(const uint8_t *src, size_t len, uint8_t max) {
+    return io_kern.span_le(src, len, max);
+}
+
+size_t io_span_eq(const uint8_t *src, size_t len) {
+    return io_kern.span_eq(src, len);
+}
+
+size_t io_span_distinct(const uint8_t *src, size_t len) {
+    return io_kern.span_distinct(src, len);
+}
+
+void image_pal_to_bgr(uint8_t *dst, const img_pal_entry_t *pal, int count) {
+    io_kern.swap3(dst, (const uint8_t *)pal, count);
+}
+
+void image_pal_from_bgr(img_pal_entry_t *pal, const uint8_t *src, int count) {
+    io_kern.swap3((uint8_t *)pal, src, count);
+}
+
+void image_pal_to_bgra(uint8_t *dst, const img_pal_entry_t *pal, int count, uint8_t alpha, int transparent) {
+    io_kern.to_bgra(dst, (const uint8_t *)pal, count, alpha);
+    if((0 <= transparent) && (transparent < count)) dst[transparent * 4 + 3] = 0;
+}
+
+int image_pal_from_bgra(img_pal_entry_t *pal, const uint8_t *src, int count) {
+    return io_kern.from_bgra((uint8_t *)pal, src, count);
+}
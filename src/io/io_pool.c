@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <imageio.h>
+#include "io_priv.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define POOL_MIN_PIXELS (4096) // smallest pixel capacity handed out, smaller images share it
+#define POOL_CLASSES (80)      // four classes to each doubling, up to 3.5G pixels
+
+/// @brief an image held by the pool, waiting to be handed out
+typedef struct io_pool_node {
+    pal_image_t *img;
+    int cls;                   // size class of the pixel storage
+    int cc;                    // palette class, 0 for 16 entries, 1 for 256
+    struct io_pool_node *next;
+} io_pool_node_t;
+
+struct image_pool {
+#if !defined(_WIN32)
+    pthread_mutex_t lock;
+#else
+    CRITICAL_SECTION lock;
+#endif
+    size_t max_bytes;                       // most storage to keep in the free lists, 0 for no limit
+    size_t bytes;                           // storage in the free lists
+    io_pool_node_t *free[2][POOL_CLASSES];  // images waiting to be handed out, by palette then size
+    io_pool_node_t *spare;                  // nodes not in use
+};
+
+static IO_THREAD_LOCAL image_pool_t *io_pool;
+
+static void pool_lock(image_pool_t *p) {
+#if !defined(_WIN32)
+    pthread_mutex_lock(&p->lock);
+#else
+    EnterCriticalSection(&p->lock);
+#endif
+}
+
+static void pool_unlock(image_pool_t *p) {
+#if !defined(_WIN32)
+    pthread_mutex_unlock(&p->lock);
+#else
+    LeaveCriticalSection(&p->lock);
+#endif
+}
+
+/// @brief the pixel capacity of a size class, the classes go up in quarter steps between powers of 2
+static size_t pool_class_size(int cls) {
+    size_t base = (size_t)POOL_MIN_PIXELS << (cls / 4);
+    return base + (base / 4) * (cls % 4);
+}
+
+/// @brief finds the smallest size class that holds n pixels
+/// @return the class, or -1 if n is too big for any of them
+static int pool_class(size_t n) {
+    for(int cls = 0; cls < POOL_CLASSES; cls++) {
+        if(pool_class_size(cls) >= n) return cls;
+    }
+    return -1;
+}
+
+/// @brief finds the largest size class that fits in n pixels
+/// @return the class, or -1 if n is too small for any of them
+static int pool_class_within(size_t n) {
+    int cls = -1;
+    while(((cls + 1) < POOL_CLASSES) && (pool_class_size(cls + 1) <= n)) cls++;
+    return cls;
+}
+
+/// @brief the storage an image of a class ties up, for keeping to the pool's limit
+static size_t pool_bytes(int cls, int cc) {
+    return pool_class_size(cls) + ((cc ? 256 : 16) * sizeof(img_pal_entry_t));
+}
+
+/// @brief gets a node, reusing a spare one when there is one. The pool must be locked
+static io_pool_node_t *pool_node(image_pool_t *p) {
+    io_pool_node_t *n = p->spare;
+    if(NULL != n) {
+        p->spare = n->next;
+        return n;
+    }
+    return io_malloc(sizeof(io_pool_node_t));
+}
+
+image_pool_t *image_pool_new(size_t max_bytes) {
+    image_pool_t *p = io_calloc(1, sizeof(image_pool_t));
+    if(NULL == p) return NULL;
+#if !defined(_WIN32)
+    pthread_mutex_init(&p->lock, NULL);
+#else
+    InitializeCriticalSection(&p->lock);
+#endif
+    p->max_bytes = max_bytes;
+    return p;
+}
+
+pal_image_t *image_pool_get(image_pool_t *pool, int width, int height, int colours) {
+    if(NULL == pool) {
+        errno = EBADF;
+        return NULL;
+    }
+    if((0 >= width) || (0 >= height) || (0 > colours) || (256 < colours)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size_t need = (size_t)width * height;
+    int cls = pool_class(need);
+    int cc = (16 < colours) ? 1 : 0;
+    if(0 > cls) { // bigger than any class, so it isn't kept
+        pal_image_t *img = image_alloc(width, height, colours, 0);
+        if((NULL == img) && (0 == errno)) errno = ENOMEM;
+        return img;
+    }
+
+    pool_lock(pool);
+    io_pool_node_t *n = pool->free[cc][cls];
+    if((NULL == n) && (0 == cc)) n = pool->free[1][cls]; // a bigger palette will do
+    pal_image_t *img = NULL;
+    if(NULL != n) {
+        pool->free[n->cc][cls] = n->next;
+        pool->bytes -= pool_bytes(cls, n->cc);
+        img = n->img;
+        n->next = pool->spare;
+        pool->spare = n;
+    }
+    pool_unlock(pool);
+
+    if(NULL != img) { // the classes guarantee the capacity, so this only sets the dimensions
+        io_image_fit(img, width, height, colours);
+        return img;
+    }
+
+    // nothing to recycle, allocate with the whole capacity of the class so it can be used for any size in it
+    if(NULL == (img = image_alloc(width, height, cc ? 256 : 16, pool_class_size(cls) - need))) {
+        if(0 == errno) errno = ENOMEM;
+        return NULL;
+    }
+    io_image_fit(img, width, height, colours);
+    return img;
+}
+
+void image_pool_put(image_pool_t *pool, pal_image_t *img) {
+    if(NULL == img) return;
+    if(NULL == pool) {
+        image_free(img);
+        return;
+    }
+
+    pool_lock(pool);
+
+    // every image is classed on what it can be seen to hold, ours included. The pixel capacity
+    // of one of ours is exactly its class, but a palette fitted to fewer colours than it has
+    // room for is classed on the colours, as nothing records the rest
+    io_pool_node_t *n = NULL;
+    int cls = pool_class_within(img->image_size + img->extra_size);
+    if((0 <= cls) && (16 <= img->colours) && (NULL != (n = pool_node(pool)))) {
+        n->img = img;
+        n->cls = cls;
+        n->cc = (256 <= img->colours) ? 1 : 0;
+    }
+
+    // keep it if there's room, otherwise let it go
+    if((NULL != n) && ((0 == pool->max_bytes) || ((pool->bytes + pool_bytes(n->cls, n->cc)) <= pool->max_bytes))) {
+        n->next = pool->free[n->cc][n->cls];
+        pool->free[n->cc][n->cls] = n;
+        pool->bytes += pool_bytes(n->cls, n->cc);
+        img = NULL;
+    } else if(NULL != n) {
+        n->next = pool->spare;
+        pool->spare = n;
+    }
+    pool_unlock(pool);
+
+    if(NULL != img) image_free(img);
+}
+
+void image_pool_free(image_pool_t *pool) {
+    if(NULL == pool) return;
+
+    for(int cc = 0; cc < 2; cc++) {
+        for(int cls = 0; cls < POOL_CLASSES; cls++) {
+            while(NULL != pool->free[cc][cls]) {
+                io_pool_node_t *n = pool->free[cc][cls];
+                pool->free[cc][cls] = n->next;
+                image_free(n->img);
+                io_free(n);
+            }
+        }
+    }
+    while(NULL != pool->spare) {
+        io_pool_node_t *n = pool->spare;
+        pool->spare = n->next;
+        io_free(n);
+    }
+
+#if !defined(_WIN32)
+    pthread_mutex_destroy(&pool->lock);
+#else
+    DeleteCriticalSection(&pool->lock);
+#endif
+    if(io_pool == pool) io_pool = NULL;
+    io_free(pool);
+}
+
+image_pool_t *image_set_pool(image_pool_t *pool) {
+    image_pool_t *prev = io_pool;
+    io_pool = pool;
+    return prev;
+}
+
+image_pool_t *io_pool_current(void) {
+    return io_pool;
+}
+
+pal_image_t *io_image_new(int width, int height, int colours) {
+    if(NULL != io_pool) return image_pool_get(io_pool, width, height, colours);
+
+    pal_image_t *img = image_alloc(width, height, colours, 0);
+    if((NULL == img) && (0 == errno)) errno = ENOMEM;
+    return img;
+}
+
+void io_image_drop(pal_image_t *img) {
+    if(NULL == img) return;
+    if(NULL != io_pool) {
+        image_pool_put(io_pool, img);
+    } else {
+        image_free(img);
+    }
+}
@@ -0,0 +1,460 @@
+/*
+ * io_priv.h 
+ * shared helpers for moving encoded image data between files and memory
+ * 
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <memstream.h>
+#include <image_io.h>
+#include <imageio.h>
+
+#ifndef CA_IMG_IO_INTERNAL
+#define CA_IMG_IO_INTERNAL
+
+#define fclose_s(A) if(A) fclose(A); A=NULL
+#define free_s(A) if(A) io_free(A); A=NULL
+
+#if defined(_MSC_VER)
+#define IO_THREAD_LOCAL __declspec(thread)
+#else
+#define IO_THREAD_LOCAL _Thread_local
+#endif
+
+// the x86 pixel kernels are built for each instruction set and picked at run time, which needs a
+// compiler that takes the instruction set a function at a time rather than for the whole build
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) && \
+    (defined(__GNUC__) || defined(_MSC_VER))
+#define IO_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+#define IO_TARGET(isa) // MSVC allows any intrinsic anywhere
+#else
+#define IO_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IO_NEON
+#endif
+
+/// @brief the instruction sets the pixel kernels are built for. Each x86 level includes the ones
+///        before it, NEON is only ever found on ARM
+typedef enum {
+    IO_CPU_SCALAR = 0,  // plain C, always available
+    IO_CPU_SSE2,
+    IO_CPU_SSSE3,
+    IO_CPU_AVX2,
+    IO_CPU_AVX512,      // AVX-512 F and BW
+    IO_CPU_NEON,
+} io_cpu_level_t;
+
+/// @brief allocates memory that is kept beyond the current call (writers, indexes, queues),
+///        from the allocator installed with image_set_allocator() or the C library
+/// @param size number of bytes
+/// @return pointer to the memory, release with io_free(), or null on error (errno is set)
+void *io_malloc(size_t size);
+
+/// @brief allocates zeroed memory as for io_malloc()
+/// @param count number of elements
+/// @param size size of each element
+/// @return pointer to the memory, release with io_free(), or null on error (errno is set)
+void *io_calloc(size_t count, size_t size);
+
+/// @brief allocates a temporary buffer that is released before the current call returns, on the
+///        thread that allocated it. It is carved out of the thread's scratch region when one is
+///        set with image_set_scratch() and there is room, otherwise it comes from io_malloc()
+/// @param size number of bytes
+/// @return pointer to the buffer, release with io_free(), or null on error (errno is set)
+void *io_scratch_alloc(size_t size);
+
+/// @brief allocates a zeroed temporary buffer as for io_scratch_alloc()
+/// @param count number of elements
+/// @param size size of each element
+/// @return pointer to the buffer, release with io_free(), or null on error (errno is set)
+void *io_scratch_calloc(size_t count, size_t size);
+
+/// @brief resizes memory from io_malloc() or io_scratch_alloc(), a NULL ptr allocates a 
+///        temporary buffer
+/// @param ptr pointer to the memory, may be NULL
+/// @param size new size in bytes
+/// @return pointer to the resized memory, or null on error (errno is set, ptr is untouched)
+void *io_realloc(void *ptr, size_t size);
+
+/// @brief releases memory from any of the io_*alloc() functions
+/// @param ptr pointer to the memory, may be NULL
+void io_free(void *ptr);
+
+/// @brief checks whether io_scratch_alloc() is currently just malloc(), so a buffer from it
+///        can be handed to the caller to release with free()
+/// @return true if there is no installed allocator and no scratch region on this thread
+bool io_alloc_is_libc(void);
+
+/// @brief a file opened for reading through an image_io_t, which only reads what is asked for
+typedef struct {
+    image_io_t io;  // the stream to read the file through
+    FILE *fp;       // the open file on Windows, otherwise NULL
+    int fd;         // the open descriptor elsewhere, otherwise -1
+} io_file_t;
+
+/// @brief opens a file for reading, straight on the descriptor where there is one so
+///        no more is read than the decoder asks for
+/// @param fn name of the file to open
+/// @param f pointer to the io_file_t to fill in, release with io_close_file()
+/// @return 0 on success, otherwise an errno value
+int io_open_file(const char *fn, io_file_t *f);
+
+/// @brief closes a file opened with io_open_file()
+/// @param f pointer to the io_file_t to close
+void io_close_file(io_file_t *f);
+
+/// @brief reads the entire contents of a file into a newly allocated buffer using a single read
+/// @param fn name of the file to read
+/// @param buf pointer to receive the buffer, must be released with io_free()
+/// @param len pointer to receive the length of the buffer in bytes
+/// @return 0 on success, otherwise an errno value
+int io_read_file(const char *fn, uint8_t **buf, size_t *len);
+
+/// @brief the encoded form of an image as a list of pieces to be written in order. Pieces
+///        may point directly into the source image, or into the scratch buffer which is 
+///        owned by the list
+typedef struct {
+    image_iovec_t *iov; // the pieces, in file order
+    int count;          // number of pieces in use
+    int cap;            // number of pieces allocated
+    size_t len;         // total length of all of the pieces in bytes
+    uint8_t *buf;       // scratch buffer for any data that had to be built, freed with the list
+} io_segs_t;
+
+/// @brief appends a piece to a segment list
+/// @param segs pointer to the segment list
+/// @param data pointer to the data for the piece, which must remain valid until written
+/// @param len length of the piece in bytes
+/// @return 0 on success, otherwise an errno value
+int io_segs_add(io_segs_t *segs, const void *data, size_t len);
+
+/// @brief releases the piece list and scratch buffer of a segment list
+/// @param segs pointer to the segment list
+void io_segs_free(io_segs_t *segs);
+
+/// @brief copies all of the pieces of a segment list into a single newly allocated buffer
+/// @param segs pointer to the segment list
+/// @param buf pointer to receive the buffer, must be released with free()
+/// @param len pointer to receive the length of the buffer in bytes
+/// @return 0 on success, otherwise an errno value
+int io_segs_flatten(io_segs_t *segs, uint8_t **buf, size_t *len);
+
+/// @brief writes all of the pieces of a segment list to a stream, using a gathered
+///        write if the stream supports it
+/// @param io pointer to the image_io_t to write to
+/// @param segs pointer to the segment list, the pieces are consumed as they are written
+/// @return 0 on success, otherwise an errno value
+int io_write_segs(image_io_t *io, io_segs_t *segs);
+
+/// @brief creates a file and writes all of the pieces of a segment list to it with a
+///        single gathered write where possible
+/// @param fn name of the file to create and write to
+/// @param segs pointer to the segment list, the pieces are consumed as they are written
+/// @return 0 on success, otherwise an errno value
+int io_write_file(const char *fn, io_segs_t *segs);
+
+/// @brief reads everything remaining in a stream into a newly allocated buffer. The stream
+///        size is used to read it in one go when it is known, otherwise the stream is buffered
+///        until it reports end of stream, so it works with streams that can't seek.
+/// @param io pointer to the image_io_t to read from
+/// @param buf pointer to receive the buffer, must be released with io_free()
+/// @param len pointer to receive the length of the buffer in bytes
+/// @return 0 on success, otherwise an errno value
+int io_read_all(image_io_t *io, uint8_t **buf, size_t *len);
+
+/// @brief writes an entire buffer to a stream, retrying partial writes
+/// @param io pointer to the image_io_t to write to
+/// @param buf pointer to the data to write
+/// @param len length of the data in bytes
+/// @return 0 on success, otherwise an errno value
+int io_write_all(image_io_t *io, const uint8_t *buf, size_t len);
+
+/// @brief reads exactly len bytes from a stream, retrying short reads
+/// @param io pointer to the image_io_t to read from
+/// @param buf pointer to the buffer to fill
+/// @param len number of bytes to read
+/// @return 0 on success, EIO if the stream ended early, otherwise an errno value
+int io_read_exact(image_io_t *io, void *buf, size_t len);
+
+/// @brief moves a stream forward, seeking if it can and reading and discarding the data if not
+/// @param io pointer to the image_io_t
+/// @param len number of bytes to skip
+/// @return 0 on success, EIO if the stream ended early, otherwise an errno value
+int io_skip(image_io_t *io, uint64_t len);
+
+/// @brief a window onto a stream for decoders that work through the data a piece at a
+///        time, so only the window has to be held in memory rather than the whole stream
+typedef struct {
+    image_io_t *io;     // the stream being read
+    memstream_buf_t ms; // the buffered data, ms.pos is the next byte to be decoded
+    size_t cap;         // size of the buffer
+    bool eof;           // set once the stream has run dry
+} io_reader_t;
+
+/// @brief sets up a buffered reader over a stream
+/// @param rd pointer to the io_reader_t to set up, release with io_reader_free()
+/// @param io pointer to the image_io_t to read from
+/// @param cap minimum size of the buffer, should be at least the most that will be asked for at once
+/// @return 0 on success, otherwise an errno value
+int io_reader_init(io_reader_t *rd, image_io_t *io, size_t cap);
+
+/// @brief makes sure there are at least want bytes buffered after ms.pos, unless the
+///        stream ends first
+/// @param rd pointer to the io_reader_t
+/// @param want number of bytes needed
+/// @return 0 on success (check the buffered length at the end of the stream), otherwise an errno value
+int io_reader_fill(io_reader_t *rd, size_t want);
+
+/// @brief releases the buffer of a reader
+/// @param rd pointer to the io_reader_t
+void io_reader_free(io_reader_t *rd);
+
+/// @brief the state shared by all of the push style encoders. Each format embeds this as the
+///        first member of its own state, so the pointer can be passed around as either
+struct image_writer {
+    image_io_t *io;     // the stream being written to
+    image_info_t info;  // dimensions and palette of the image
+    uint32_t y;         // number of rows written so far
+    int err;            // first error to happen, returned by every call after it
+
+    /// @brief encodes rows y to y+count-1 of the image
+    int (*rows)(image_writer_t *w, const uint8_t *pixels, uint32_t count);
+
+    /// @brief writes anything needed to complete the file if complete is true, then releases the writer
+    int (*finish)(image_writer_t *w, bool complete);
+};
+
+/// @brief allocates the state for a push style encoder, after checking the image can be encoded
+/// @param size size of the format specific state, which starts with an image_writer_t
+/// @param io pointer to the image_io_t to write to
+/// @param info the dimensions and palette of the image
+/// @return pointer to the zeroed state with the image_writer_t filled in, or null on error (errno is set)
+void *io_writer_new(size_t size, image_io_t *io, const image_info_t *info);
+
+/// @brief an asynchronous I/O ring (io_uring on Linux), for keeping many reads and writes
+///        in flight from a few threads
+typedef struct io_ring io_ring_t;
+
+enum io_ring_op {
+    IO_RING_NOP   = 0,  // does nothing, used to wake the reaper
+    IO_RING_READ  = 1,  // pread() on the descriptor
+    IO_RING_WRITE = 2,  // pwrite() on the descriptor
+};
+
+/// @brief sets up a ring
+/// @param entries number of operations that can be queued for submission at once
+/// @return pointer to the ring, or null if the platform or kernel doesn't support it (errno is set)
+io_ring_t *io_ring_new(unsigned entries);
+
+/// @brief queues an operation and hands it to the kernel, safe to call from any thread
+/// @param r pointer to the ring
+/// @param op one of the io_ring_op values
+/// @param fd descriptor to read or write
+/// @param buf pointer to the data, which must stay valid until the operation completes
+/// @param len number of bytes to read or write
+/// @param off offset in the file to read or write at
+/// @param user value handed back with the completion
+/// @return 0 on success, otherwise an errno value and the operation was not queued, so it
+///         will never complete
+int io_ring_submit(io_ring_t *r, int op, int fd, void *buf, uint32_t len, uint64_t off, void *user);
+
+/// @brief waits for the next operation to complete, only one thread may wait on a ring
+/// @param r pointer to the ring
+/// @param user pointer to receive the value given when the operation was submitted
+/// @param res pointer to receive the number of bytes transferred, or a negative errno value
+/// @return 0 on success, otherwise an errno value
+int io_ring_wait(io_ring_t *r, void **user, int *res);
+
+/// @brief tears down a ring, nothing may still be in flight
+/// @param r pointer to the ring, may be NULL
+void io_ring_free(io_ring_t *r);
+
+/// @brief moves the position of a stream
+/// @param io pointer to the image_io_t
+/// @param offset offset to move to, relative to whence
+/// @param whence one of SEEK_SET, SEEK_CUR or SEEK_END
+/// @return the new position, or -1 if the stream can't seek
+int64_t io_seek(image_io_t *io, int64_t offset, int whence);
+
+/// @brief opens a file and runs a probe function over it
+/// @param fn name of the file to probe
+/// @param info pointer to an image_info_t to fill in
+/// @param probe the format specific probe to run
+/// @return 0 on success, otherwise the error code from the probe
+int io_probe_file(const char *fn, image_info_t *info, int (*probe)(image_io_t *io, image_info_t *info));
+
+/// @brief works out the format of an image from the first bytes of the file
+/// @param buf pointer to the start of the file
+/// @param len number of bytes available, at least IO_SNIFF_LEN for a reliable answer
+/// @return the format of the file, or IMAGE_FMT_UNKNOWN if it isn't recognized. TGA files
+///         have no signature at the start so they are only a best guess from the header
+image_format_t io_sniff(const uint8_t *buf, size_t len);
+
+#define IO_SNIFF_LEN (32) // number of bytes io_sniff() needs to see
+#define IO_BAND_SIZE (64 * 1024) // target size of the band of scanlines read at once by the streaming decoders
+
+/// @brief a read only view of an entire file
+typedef struct {
+    uint8_t *data; // start of the file contents
+    size_t len;    // length of the file in bytes
+    int mapped;    // 1 if data is a memory mapping, 0 if it was read into an allocated buffer
+} io_map_t;
+
+/// @brief maps an entire file into memory read only, falling back to reading it
+///        when the file can't be mapped
+/// @param fn name of the file to map
+/// @param map pointer to the io_map_t to fill in, release with io_unmap_file()
+/// @return 0 on success, otherwise an errno value
+int io_map_file(const char *fn, io_map_t *map);
+
+/// @brief releases a file view created by io_map_file()
+/// @param map pointer to the io_map_t to release
+void io_unmap_file(io_map_t *map);
+
+/// @brief gets an image of the requested dimensions for a decoder to fill, reusing the
+///        storage of the existing image when its pixel and palette capacity are large enough.
+///        Otherwise the existing image is released and replaced with a newly allocated one
+/// @param img pointer to the image to reuse, which may point to NULL to always allocate
+/// @param width width of the image in pixels
+/// @param height height of the image in pixels
+/// @param colours number of palette entries needed
+/// @return 0 on success, otherwise an errno value (*img is left untouched)
+int io_image_reuse(pal_image_t **img, int width, int height, int colours);
+
+/// @brief re-dimensions an image that is known to have the capacity, keeping its storage
+/// @param img pointer to the image
+/// @param width width of the image in pixels, width * height must fit the pixel storage
+/// @param height height of the image in pixels
+/// @param colours number of palette entries needed, which the palette must have room for
+void io_image_fit(pal_image_t *img, int width, int height, int colours);
+
+/// @brief reads an uncompressed 8 bit raster from a stream straight into the pixels of an image,
+///        with a single read when the rows aren't padded, and no buffer in between
+/// @param io pointer to the stream, positioned at the start of the raster
+/// @param img pointer to the image, already sized for the raster
+/// @param stride bytes in each row of the raster, including any padding
+/// @param bottom_up true if the raster starts with the bottom row
+/// @return 0 on success, otherwise an errno value (EIO if the raster is truncated)
+int io_read_rows(image_io_t *io, pal_image_t *img, size_t stride, bool bottom_up);
+
+/// @brief the level the pixel kernels run at. It is found once, when the library is loaded or on the
+///        first call, as the best the CPU and OS support, and can be lowered with the CA_IMAGEIO_SIMD
+///        environment variable set to scalar, sse2, ssse3, avx2, avx512 or neon
+/// @return one of the io_cpu_level_t values
+int io_cpu_level(void);
+
+/// @brief changes the level the pixel kernels run at, for testing each of them. Not thread safe, no
+///        kernel may be running while it is changed
+/// @param level one of the io_cpu_level_t values, a level the CPU can't run gets the best it can
+/// @return the level now in use
+int io_cpu_force(int level);
+
+/// @brief points the pixel kernels at the versions for a level, for io_cpu_level() and io_cpu_force()
+/// @param level one of the io_cpu_level_t values, which the CPU must be able to run
+void io_pixels_select(int level);
+
+/// @brief unpacks one scanline of 4 bit pixels, left most pixel in the most significant nibble.
+///        Works on 16, 32 or 64 bytes at a time with SSE2, AVX2, AVX-512 or NEON, as io_cpu_level() picks
+/// @param dst pointer to receive width pixels, one per byte
+/// @param src pointer to the (width + 1) / 2 packed bytes
+/// @param width number of pixels in the line
+void io_unpack4(uint8_t *dst, const uint8_t *src, int width);
+
+/// @brief packs one scanline of pixels 2 per byte, left most pixel in the most significant nibble.
+///        Only the low 4 bits of each pixel are kept, and the low nibble of the last byte of an
+///        odd width line is 0. Vectorized like io_unpack4()
+/// @param dst pointer to receive (width + 1) / 2 bytes
+/// @param src pointer to width pixels, one per byte
+/// @param width number of pixels in the line
+void io_pack4(uint8_t *dst, const uint8_t *src, int width);
+
+/// @brief converts one scanline of 4 bit planes (EGA style, 1 bit per pixel in each plane) to
+///        one byte per pixel, plane 0 giving the least significant bit. Works on 8 pixels at a
+///        time through a lookup table, or 32 with AVX2 when the CPU has it
+/// @param dst pointer to receive width pixels
+/// @param src pointer to the first plane, each following plane starts stride bytes after the one before
+/// @param stride bytes in each plane, at least (width + 7) / 8
+/// @param width number of pixels in the line
+void io_planar4(uint8_t *dst, const uint8_t *src, size_t stride, int width);
+
+/// @brief counts the bytes at the start of a buffer that are no greater than a limit, for finding
+///        where a span of literal bytes ends. Tests 16, 32 or 64 bytes at a time with SSE2, AVX2,
+///        AVX-512 or NEON, as io_cpu_level() picks
+/// @param src pointer to the bytes to scan
+/// @param len most bytes to scan
+/// @param max largest value that counts
+/// @return the number of bytes before the first one greater than max, or len if there isn't one
+size_t io_span_le(const uint8_t *src, size_t len, uint8_t max);
+
+/// @brief counts the bytes at the start of a buffer that are the same as the first, for finding
+///        where a run ends. Tests 16, 32 or 64 bytes at a time like io_span_le()
+/// @param src pointer to the bytes to scan
+/// @param len most bytes to scan, at least 1
+/// @return the length of the run, from 1 to len
+size_t io_span_eq(const uint8_t *src, size_t len);
+
+/// @brief counts the bytes at the start of a buffer that differ from the byte after them, for finding
+///        where the next run starts. The last byte always counts. Tests 16, 32 or 64 bytes at a time
+///        like io_span_le()
+/// @param src pointer to the bytes to scan
+/// @param len most bytes to scan
+/// @return the number of bytes before the first run, 0 if the buffer starts with one
+size_t io_span_distinct(const uint8_t *src, size_t len);
+
+/// @brief allocates a new image for a decoder, from the calling thread's pool when one is set
+///        with image_set_pool()
+/// @param width width of the image in pixels
+/// @param height height of the image in pixels
+/// @param colours number of palette entries needed
+/// @return pointer to the image, or null on error (errno is set)
+pal_image_t *io_image_new(int width, int height, int colours);
+
+/// @brief releases an image a decoder has finished with, back to the calling thread's pool
+///        when one is set
+/// @param img pointer to the image, may be NULL
+void io_image_drop(pal_image_t *img);
+
+/// @brief gets the pool set on the calling thread with image_set_pool(), so it can be 
+///        carried over to worker threads
+/// @return pointer to the pool, or NULL if there isn't one
+image_pool_t *io_pool_current(void);
+
+/// @brief number of pixels along an edge of n pixels once it is scaled down to 1/s
+#define IO_SCALED(n, s) (((n) + (s) - 1) / (s))
+
+/// @brief checks a scale factor for a scaled decode
+/// @param scale the image is decoded at 1/scale of its size
+/// @return true if scale is one of 1, 2, 4 or 8
+static inline bool io_scale_ok(int scale) {
+    return (1 == scale) || (2 == scale) || (4 == scale) || (8 == scale);
+}
+
+/// @brief picks every step'th pixel from a line, the nearest neighbour for a scaled decode
+/// @param dst pointer to receive count pixels
+/// @param src pointer to the full size line
+/// @param count number of pixels to pick
+/// @param step distance between the pixels picked
+static inline void io_pick(uint8_t *dst, const uint8_t *src, uint32_t count, uint32_t step) {
+    for(uint32_t x = 0; x < count; x++) {
+        dst[x] = src[(size_t)x * step];
+    }
+}
+
+/// @brief gets a pointer to the next len bytes of a memstream and advances past them
+/// @param ms pointer to the memstream buffer
+/// @param len number of bytes to consume
+/// @return pointer to the first byte, or NULL if fewer than len bytes remain
+static inline uint8_t *io_take(memstream_buf_t *ms, size_t len) {
+    if((ms->pos > ms->len) || (len > (ms->len - ms->pos))) return NULL;
+    uint8_t *p = &ms->data[ms->pos];
+    ms->pos += len;
+    return p;
+}
+
+#endif
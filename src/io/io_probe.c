@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <imageio.h>
+#include <image_bmp.h>
+#include <image_pcx.h>
+#include <image_tga.h>
+#include <image_png.h>
+#include "io_priv.h"
+
+int io_probe_file(const char *fn, image_info_t *info, int (*probe)(image_io_t *io, image_info_t *info)) {
+    int rval = 0;
+    io_file_t f;
+
+    if((NULL == fn) || (NULL == info) || (NULL == probe)) return EBADF;
+
+    if(0 != (rval = io_open_file(fn, &f))) {
+        return rval;  // can't open input file
+    }
+    rval = probe(&f.io, info);
+    io_close_file(&f);
+    return rval;
+}
+
+image_format_t io_sniff(const uint8_t *buf, size_t len) {
+    if(NULL == buf) return IMAGE_FMT_UNKNOWN;
+
+    // PNG has a full 8 byte signature
+    if((8 <= len) && (0 == memcmp(buf, "\x89PNG\x0d\x0a\x1a\x0a", 8))) return IMAGE_FMT_PNG;
+
+    // BMP is "BM" followed by the header, the info header size must be 40 for us
+    if((18 <= len) && ('B' == buf[0]) && ('M' == buf[1])) {
+        uint32_t hsz = buf[14] | (buf[15] << 8) | (buf[16] << 16) | ((uint32_t)buf[17] << 24);
+        if(40 == hsz) return IMAGE_FMT_BMP;
+    }
+
+    // PCX has a 1 byte magic, so also check the version, encoding and depth are sane
+    if((4 <= len) && (0x0a == buf[0]) && 
+       ((0 == buf[1]) || ((2 <= buf[1]) && (buf[1] <= 5))) &&
+       (1 == buf[2]) &&
+       ((1 == buf[3]) || (2 == buf[3]) || (4 == buf[3]) || (8 == buf[3]))) return IMAGE_FMT_PCX;
+
+    // TGA has no signature at the start, so we go on whether the header looks reasonable
+    // for the files we can deal with, a paletted image with a 24 or 32 bit colour map
+    if((18 <= len) && (1 == buf[1]) && (1 == buf[2]) &&
+       ((24 == buf[7]) || (32 == buf[7])) && (8 == buf[16])) return IMAGE_FMT_TGA;
+
+    return IMAGE_FMT_UNKNOWN;
+}
+
+/// @brief probes an open stream, picking the format from the first bytes
+/// @param io pointer to the image_io_t to probe, must be seekable
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+static int image_probe_io(image_io_t *io, image_info_t *info) {
+    uint8_t sig[IO_SNIFF_LEN];
+    memset(sig, 0, sizeof(sig));
+
+    // read what we can of the start of the file, it may be shorter than we'd like
+    int64_t nr = io->read(io->user, sig, sizeof(sig));
+    if(0 > nr) return errno;
+    if(0 > io_seek(io, 0, SEEK_SET)) return errno;
+
+    switch(io_sniff(sig, nr)) {
+        case IMAGE_FMT_BMP: return probe_bmp_io(io, info);
+        case IMAGE_FMT_PCX: return probe_pcx_io(io, info);
+        case IMAGE_FMT_PNG: return probe_png_io(io, info);
+        default: // TGA can only be confirmed by its footer
+            return probe_tga_io(io, info);
+    }
+}
+
+int image_probe(const char *fn, image_info_t *info) {
+    return io_probe_file(fn, info, image_probe_io);
+}
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "io_priv.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+// the ring is driven with the system calls directly, so there is no dependency on liburing
+
+/// @brief an io_uring with its submission and completion rings mapped in
+struct io_ring {
+    int fd;                      // the ring
+    pthread_mutex_t lock;        // serializes submissions, there is only ever one reaper
+    unsigned entries;            // number of submission entries
+    unsigned submitted;          // count of submissions, orders the submitter's writes before the reaper's reads
+
+    void *sq_ptr;                // submission ring mapping
+    size_t sq_sz;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;   // submission entries mapping
+    size_t sqes_sz;
+
+    void *cq_ptr;                // completion ring mapping, may be the same as sq_ptr
+    size_t cq_sz;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+io_ring_t *io_ring_new(unsigned entries) {
+    struct io_uring_params p;
+    io_ring_t *r = NULL;
+    int rval = 0;
+
+    if(NULL == (r = io_calloc(1, sizeof(io_ring_t)))) return NULL;
+    r->fd = -1;
+    r->sq_ptr = MAP_FAILED;
+    r->cq_ptr = MAP_FAILED;
+    r->sqes = MAP_FAILED;
+
+    memset(&p, 0, sizeof(p));
+    if(0 > (r->fd = syscall(__NR_io_uring_setup, entries, &p))) {
+        rval = errno;  // not supported by the kernel, or not allowed
+        goto CLEANUP;
+    }
+    r->entries = p.sq_entries;
+
+    r->sq_sz = p.sq_off.array + (p.sq_entries * sizeof(unsigned));
+    r->cq_sz = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+    if(p.features & IORING_FEAT_SINGLE_MMAP) { // both rings share the one mapping
+        if(r->cq_sz > r->sq_sz) r->sq_sz = r->cq_sz;
+        r->cq_sz = r->sq_sz;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if(MAP_FAILED == r->sq_ptr) {
+        rval = errno;
+        goto CLEANUP;
+    }
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if(MAP_FAILED == r->cq_ptr) {
+            rval = errno;
+            goto CLEANUP;
+        }
+    }
+
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if(MAP_FAILED == r->sqes) {
+        rval = errno;
+        goto CLEANUP;
+    }
+
+    uint8_t *sq = r->sq_ptr;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+    uint8_t *cq = r->cq_ptr;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    pthread_mutex_init(&r->lock, NULL);
+    return r;
+CLEANUP:
+    if(MAP_FAILED != r->sqes) munmap(r->sqes, r->sqes_sz);
+    if((MAP_FAILED != r->cq_ptr) && (r->cq_ptr != r->sq_ptr)) munmap(r->cq_ptr, r->cq_sz);
+    if(MAP_FAILED != r->sq_ptr) munmap(r->sq_ptr, r->sq_sz);
+    if(0 <= r->fd) close(r->fd);
+    io_free(r);
+    errno = rval;
+    return NULL;
+}
+
+int io_ring_submit(io_ring_t *r, int op, int fd, void *buf, uint32_t len, uint64_t off, void *user) {
+    int rval = 0;
+
+    pthread_mutex_lock(&r->lock);
+
+    // every entry is handed to the kernel as soon as it is queued, so the ring can only be
+    // full if the kernel hasn't caught up with a previous enter
+    unsigned tail = *r->sq_tail;
+    if((tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE)) >= r->entries) {
+        rval = EBUSY;
+        goto CLEANUP;
+    }
+
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    switch(op) {
+        case IO_RING_READ:  sqe->opcode = IORING_OP_READ; break;
+        case IO_RING_WRITE: sqe->opcode = IORING_OP_WRITE; break;
+        default:            sqe->opcode = IORING_OP_NOP; break;
+    }
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = (uint64_t)(uintptr_t)user;
+
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&r->submitted, 1, __ATOMIC_RELEASE);
+
+    while(0 > syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0)) {
+        if(EINTR != errno) {
+            rval = errno;
+            break;
+        }
+    }
+
+    // if the kernel didn't take the entry, take it back off the ring. Otherwise a later enter
+    // would submit it after the caller has given up on it. If it did, it is on its way
+    if((0 != rval) && (tail == __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE))) {
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+    } else {
+        rval = 0;
+    }
+
+CLEANUP:
+    pthread_mutex_unlock(&r->lock);
+    return rval;
+}
+
+int io_ring_wait(io_ring_t *r, void **user, int *res) {
+    unsigned head = *r->cq_head;
+
+    // sleep in the kernel until there is something to reap
+    while(head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        if((0 > syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0)) && (EINTR != errno)) {
+            return errno;
+        }
+    }
+
+    // the kernel sits between the submitter and us, which doesn't count as synchronization
+    // to the compiler. This pairs with the release in io_ring_submit(), so whatever the 
+    // submitter wrote before submitting is visible to the caller
+    (void)__atomic_load_n(&r->submitted, __ATOMIC_ACQUIRE);
+
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    *user = (void *)(uintptr_t)cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void io_ring_free(io_ring_t *r) {
+    if(NULL == r) return;
+    munmap(r->sqes, r->sqes_sz);
+    if(r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_sz);
+    munmap(r->sq_ptr, r->sq_sz);
+    close(r->fd);
+    pthread_mutex_destroy(&r->lock);
+    io_free(r);
+}
+
+#else
+
+// no io_uring on this platform, the async loader falls back to doing the I/O on its workers
+
+io_ring_t *io_ring_new(unsigned entries) {
+    (void)entries;
+    errno = ENOSYS;
+    return NULL;
+}
+
+int io_ring_submit(io_ring_t *r, int op, int fd, void *buf, uint32_t len, uint64_t off, void *user) {
+    (void)r; (void)op; (void)fd; (void)buf; (void)len; (void)off; (void)user;
+    return ENOSYS;
+}
+
+int io_ring_wait(io_ring_t *r, void **user, int *res) {
+    (void)r; (void)user; (void)res;
+    return ENOSYS;
+}
+
+void io_ring_free(io_ring_t *r) {
+    (void)r;
+}
+
+#endif
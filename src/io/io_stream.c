@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <image_io.h>
+#include "io_priv.h"
+
+#define IO_CHUNK (64 * 1024) // initial buffer size when the stream size is unknown
+
+static int64_t io_file_read(void *user, void *buf, size_t len) {
+    FILE *fp = (FILE *)user;
+    size_t nr = fread(buf, 1, len, fp);
+    if((nr < len) && ferror(fp)) return -1;
+    return nr;
+}
+
+static int64_t io_file_write(void *user, const void *buf, size_t len) {
+    size_t nw = fwrite(buf, 1, len, (FILE *)user);
+    if(nw < len) return -1;
+    return nw;
+}
+
+static int64_t io_file_seek(void *user, int64_t offset, int whence) {
+    FILE *fp = (FILE *)user;
+    if(0 != fseek(fp, offset, whence)) return -1;
+    return ftell(fp);
+}
+
+static int64_t io_file_size(void *user) {
+    FILE *fp = (FILE *)user;
+    long cur = ftell(fp);
+    if(0 > cur) return -1; // not seekable
+    if(0 != fseek(fp, 0, SEEK_END)) return -1;
+    long sz = ftell(fp);
+    fseek(fp, cur, SEEK_SET);
+    return sz;
+}
+
+image_io_t image_io_file(FILE *fp) {
+    image_io_t io = {
+        .user = fp,
+        .read = io_file_read,
+        .write = io_file_write,
+        .seek = io_file_seek,
+        .size = io_file_size,
+    };
+    return io;
+}
+
+#if !defined(_WIN32)
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX (1024)
+#endif
+
+static int64_t io_fd_read(void *user, void *buf, size_t len) {
+    int fd = (int)(intptr_t)user;
+    ssize_t nr;
+    do {
+        nr = read(fd, buf, len);
+    } while((0 > nr) && (EINTR == errno));
+    return nr;
+}
+
+static int64_t io_fd_write(void *user, const void *buf, size_t len) {
+    int fd = (int)(intptr_t)user;
+    ssize_t nw;
+    do {
+        nw = write(fd, buf, len);
+    } while((0 > nw) && (EINTR == errno));
+    return nw;
+}
+
+static int64_t io_fd_writev(void *user, const image_iovec_t *iov, int count) {
+    int fd = (int)(intptr_t)user;
+    struct iovec vec[IOV_MAX < 1024 ? IOV_MAX : 1024];
+    int n = (count < (int)(sizeof(vec) / sizeof(vec[0]))) ? count : (int)(sizeof(vec) / sizeof(vec[0]));
+
+    // the kernel caps how many pieces it takes at once, the caller loops for the rest
+    for(int i = 0; i < n; i++) {
+        vec[i].iov_base = (void *)iov[i].data;
+        vec[i].iov_len = iov[i].len;
+    }
+
+    ssize_t nw;
+    do {
+        nw = writev(fd, vec, n);
+    } while((0 > nw) && (EINTR == errno));
+    return nw;
+}
+
+static int64_t io_fd_seek(void *user, int64_t offset, int whence) {
+    return lseek((int)(intptr_t)user, offset, whence); // fails with ESPIPE on pipes and sockets
+}
+
+static int64_t io_fd_size(void *user) {
+    struct stat st;
+    if(0 != fstat((int)(intptr_t)user, &st)) return -1;
+    if(!S_ISREG(st.st_mode)) return -1; // only regular files have a meaningful size
+    return st.st_size;
+}
+
+image_io_t image_io_fd(int fd) {
+    image_io_t io = {
+        .user = (void *)(intptr_t)fd,
+        .read = io_fd_read,
+        .write = io_fd_write,
+        .writev = io_fd_writev,
+        .seek = io_fd_seek,
+        .size = io_fd_size,
+    };
+    return io;
+}
+#endif
+
+int io_read_all(image_io_t *io, uint8_t **buf, size_t *len) {
+    int rval = 0;
+    uint8_t *data = NULL;
+
+    if((NULL == io) || (NULL == io->read) || (NULL == buf) || (NULL == len)) return EBADF;
+
+    // if we can find out how much is left, we can read it all in one go, otherwise
+    // we fall back to buffering the stream until it runs dry
+    size_t cap = IO_CHUNK;
+    if((NULL != io->size) && (NULL != io->seek)) {
+        int64_t sz = io->size(io->user);
+        int64_t cur = io->seek(io->user, 0, SEEK_CUR);
+        if((0 <= sz) && (0 <= cur) && (sz >= cur)) cap = (sz - cur) + 1; // +1 so we see the end without growing
+    }
+
+    if(NULL == (data = io_scratch_alloc(cap))) {
+        rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+
+    size_t pos = 0;
+    while(true) {
+        if(pos == cap) { // out of room, grow the buffer
+            uint8_t *ndata = io_realloc(data, cap * 2);
+            if(NULL == ndata) {
+                rval = errno;  // unable to allocate mem
+                goto CLEANUP;
+            }
+            data = ndata;
+            cap *= 2;
+        }
+        errno = 0;
+        int64_t nr = io->read(io->user, &data[pos], cap - pos);
+        if(0 > nr) {
+            rval = errno ? errno : EIO;  // can't read stream
+            goto CLEANUP;
+        }
+        if(0 == nr) break; // end of stream
+        pos += nr;
+    }
+
+    *buf = data;
+    *len = pos;
+    return 0;
+CLEANUP:
+    free_s(data);
+    return rval;
+}
+
+int io_write_all(image_io_t *io, const uint8_t *buf, size_t len) {
+    if((NULL == io) || (NULL == io->write) || (NULL == buf)) return EBADF;
+
+    // keep going until everything is out, streams may take it in pieces
+    while(0 < len) {
+        errno = 0;
+        int64_t nw = io->write(io->user, buf, len);
+        if(0 >= nw) return errno ? errno : EIO;  // can't write stream
+        buf += nw;
+        len -= nw;
+    }
+    return 0;
+}
+
+int io_read_exact(image_io_t *io, void *buf, size_t len) {
+    if((NULL == io) || (NULL == io->read) || (NULL == buf)) return EBADF;
+
+    uint8_t *dp = (uint8_t *)buf;
+    while(0 < len) {
+        errno = 0;
+        int64_t nr = io->read(io->user, dp, len);
+        if(0 > nr) return errno ? errno : EIO;  // can't read stream
+        if(0 == nr) return EIO;                 // stream ended early
+        dp += nr;
+        len -= nr;
+    }
+    return 0;
+}
+
+int64_t io_seek(image_io_t *io, int64_t offset, int whence) {
+    if((NULL == io) || (NULL == io->seek)) {
+        errno = ESPIPE;
+        return -1;
+    }
+    return io->seek(io->user, offset, whence);
+}
+
+int io_skip(image_io_t *io, uint64_t len) {
+    uint8_t tmp[4096];
+
+    if((NULL == io) || (NULL == io->read)) return EBADF;
+    if(0 == len) return 0;
+
+    // jump over it if we can, otherwise read it and throw it away
+    if((NULL != io->seek) && (0 <= io->seek(io->user, len, SEEK_CUR))) return 0;
+
+    while(0 < len) {
+        size_t n = (len < sizeof(tmp)) ? len : sizeof(tmp);
+        int rval = io_read_exact(io, tmp, n);
+        if(0 != rval) return rval;
+        len -= n;
+    }
+    return 0;
+}
+
+int io_reader_init(io_reader_t *rd, image_io_t *io, size_t cap) {
+    if((NULL == rd) || (NULL == io) || (NULL == io->read)) return EBADF;
+
+    rd->io = io;
+    rd->eof = false;
+    rd->cap = (cap < IO_CHUNK) ? IO_CHUNK : cap;
+    rd->ms = (memstream_buf_t){.pos = 0, .len = 0, .data = io_scratch_alloc(rd->cap)};
+    if(NULL == rd->ms.data) return errno;  // unable to allocate mem
+    return 0;
+}
+
+int io_reader_fill(io_reader_t *rd, size_t want) {
+    if(NULL == rd) return EBADF;
+
+    size_t avail = rd->ms.len - rd->ms.pos;
+    if((avail >= want) || rd->eof) return 0;
+    if(want > rd->cap) return ENOBUFS;
+
+    // slide what is left down to the start, then top up the rest of the buffer
+    memmove(rd->ms.data, &rd->ms.data[rd->ms.pos], avail);
+    rd->ms.pos = 0;
+    rd->ms.len = avail;
+    while((rd->ms.len < want) && !rd->eof) {
+        errno = 0;
+        int64_t nr = rd->io->read(rd->io->user, &rd->ms.data[rd->ms.len], rd->cap - rd->ms.len);
+        if(0 > nr) return errno ? errno : EIO;  // can't read stream
+        if(0 == nr) rd->eof = true;             // end of stream, whatever is left is all there is
+        rd->ms.len += nr;
+    }
+    return 0;
+}
+
+void io_reader_free(io_reader_t *rd) {
+    if(NULL == rd) return;
+    free_s(rd->ms.data);
+    rd->ms.len = 0;
+    rd->ms.pos = 0;
+}
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <imageio.h>
+#include <image_bmp.h>
+#include <image_pcx.h>
+#include <image_tga.h>
+#include <image_png.h>
+#include "io_priv.h"
+
+image_writer_t *save_image_begin(image_io_t *io, image_format_t format, const image_info_t *info) {
+    switch(format) {
+        case IMAGE_FMT_BMP: return save_bmp_begin(io, info);
+        case IMAGE_FMT_PCX: return save_pcx_begin(io, info);
+        case IMAGE_FMT_TGA: return save_tga_begin(io, info);
+#ifdef CA_IMAGEIO_PNG
+        case IMAGE_FMT_PNG: return save_png_begin(io, info);
+#endif
+        default: 
+            errno = ENOTSUP;
+            return NULL;
+    }
+}
+
+int image_write_rows(image_writer_t *w, const uint8_t *pixels, uint32_t count) {
+    if((NULL == w) || (NULL == pixels)) return EBADF;
+    if(0 != w->err) return w->err;
+
+    // can't write more rows than the image has
+    if(count > (w->info.height - w->y)) {
+        w->err = EINVAL;
+        return w->err;
+    }
+
+    if(0 == (w->err = w->rows(w, pixels, count))) {
+        w->y += count;
+    }
+    return w->err;
+}
+
+int image_write_finish(image_writer_t *w) {
+    if(NULL == w) return EBADF;
+
+    // the file is only completed if every row made it out
+    int rval = w->err;
+    if((0 == rval) && (w->y != w->info.height)) rval = EINVAL;
+
+    int frval = w->finish(w, (0 == rval));
+    return (0 != rval) ? rval : frval;
+}
+
+void *io_writer_new(size_t size, image_io_t *io, const image_info_t *info) {
+    if((NULL == io) || (NULL == io->write) || (NULL == info)) {
+        errno = EBADF;
+        return NULL;
+    }
+    if((0 == info->width) || (0 == info->height) || (0 == info->colours)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    image_writer_t *w = io_calloc(1, size);
+    if(NULL == w) return NULL;  // unable to allocate mem, errno is set
+
+    w->io = io;
+    w->info = *info;
+    return w;
+}
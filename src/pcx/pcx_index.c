@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcx_priv.h"
+#include "../io/io_priv.h"
+#include <image_pcx.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <memstream.h>
+
+/// @brief gets the size of the file behind a stream
+/// @param io pointer to the image_io_t
+/// @return size of the file in bytes, or -1 if it isn't known
+static int64_t pcx_file_size(image_io_t *io) {
+    if(NULL == io->size) return -1;
+    return io->size(io->user);
+}
+
+pcx_index_t *build_pcx_index(const char *fn) {
+    int rval = 0;
+    io_file_t f = {.fp = NULL, .fd = -1};
+    io_reader_t rd = {0};
+    pcx_index_t *index = NULL;
+    pcx_header_t pcx;
+    image_info_t info;
+
+    if(NULL == fn) {
+        rval = EBADF;
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = io_open_file(fn, &f))) {
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = pcx_read_header(&f.io, &pcx, &info))) {
+        goto CLEANUP;
+    }
+
+    int64_t fsz = pcx_file_size(&f.io);
+    if(0 > fsz) {
+        rval = EINVAL;
+        goto CLEANUP;
+    }
+    if(UINT32_MAX < fsz) {
+        rval = EFBIG;  // offsets are kept to 32 bits to keep the index compact
+        goto CLEANUP;
+    }
+
+    size_t stride = (size_t)pcx.bytes_per_line * pcx.num_planes;
+    size_t need = stride * 2;
+
+    if((NULL == (index = io_calloc(1, sizeof(pcx_index_t)))) || 
+       (NULL == (index->line = io_calloc(info.height, sizeof(pcx_index_entry_t))))) {
+        rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+
+    memcpy(index->hdr.sig, PCX_INDEX_SIG, sizeof(index->hdr.sig));
+    index->hdr.version = PCX_INDEX_VERSION;
+    index->hdr.width = info.width;
+    index->hdr.height = info.height;
+    index->hdr.stride = stride;
+    index->hdr.size = fsz;
+
+    if(0 != (rval = io_reader_init(&rd, &f.io, need))) {
+        goto CLEANUP;
+    }
+
+    // one pass over the RLE data, noting where each line starts and any run that was carried
+    // into it. The line buffer is refilled as we go, so keep our own count of what was used
+    uint64_t offset = sizeof(pcx_header_t);
+    pcx_run_t run = {0};
+    for(uint32_t y = 0; y < info.height; y++) {
+        if(0 != (rval = io_reader_fill(&rd, need))) goto CLEANUP;
+        index->line[y].offset = offset;
+        index->line[y].val = run.val;
+        index->line[y].count = run.count;
+
+        size_t pos = rd.ms.pos;
+        if(0 != (rval = pcx_rle_skip_line(stride, &rd.ms, &run))) goto CLEANUP;
+        offset += rd.ms.pos - pos;
+    }
+
+    io_reader_free(&rd);
+    io_close_file(&f);
+    return index;
+CLEANUP:
+    io_reader_free(&rd);
+    io_close_file(&f);
+    free_pcx_index(index);
+    errno = rval;
+    return NULL;
+}
+
+int save_pcx_index(const char *fn, const pcx_index_t *index) {
+    int rval = 0;
+    io_segs_t segs = {0};
+
+    if((NULL == fn) || (NULL == index)) return EBADF;
+
+    // the header, then the entries straight from the index
+    if((0 == (rval = io_segs_add(&segs, &index->hdr, sizeof(pcx_index_header_t)))) && 
+       (0 == (rval = io_segs_add(&segs, index->line, (size_t)index->hdr.height * sizeof(pcx_index_entry_t))))) {
+        rval = io_write_file(fn, &segs);
+    }
+
+    io_segs_free(&segs);
+    return rval;
+}
+
+pcx_index_t *load_pcx_index(const char *fn) {
+    int rval = 0;
+    uint8_t *buf = NULL;
+    size_t len = 0;
+    pcx_index_t *index = NULL;
+
+    if(NULL == fn) {
+        rval = EBADF;
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = io_read_file(fn, &buf, &len))) {
+        goto CLEANUP;
+    }
+
+    if(NULL == (index = io_calloc(1, sizeof(pcx_index_t)))) {
+        rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+
+    memstream_buf_t src = {.pos = 0, .len = len, .data = buf};
+    uint8_t *p = io_take(&src, sizeof(pcx_index_header_t));
+    if(NULL == p) {
+        rval = EINVAL;  // too short to be an index
+        goto CLEANUP;
+    }
+    memcpy(&index->hdr, p, sizeof(pcx_index_header_t));
+
+    if((0 != memcmp(index->hdr.sig, PCX_INDEX_SIG, sizeof(index->hdr.sig))) || 
+       (PCX_INDEX_VERSION != index->hdr.version) || (0 == index->hdr.height)) {
+        rval = EINVAL;  // not an index we understand
+        goto CLEANUP;
+    }
+
+    size_t lsz = (size_t)index->hdr.height * sizeof(pcx_index_entry_t);
+    if(NULL == (p = io_take(&src, lsz))) {
+        rval = EINVAL;  // truncated index
+        goto CLEANUP;
+    }
+    if(NULL == (index->line = io_malloc(lsz))) {
+        rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+    memcpy(index->line, p, lsz);
+
+    free_s(buf);
+    return index;
+CLEANUP:
+    free_s(buf);
+    free_pcx_index(index);
+    errno = rval;
+    return NULL;
+}
+
+void free_pcx_index(pcx_index_t *index) {
+    if(NULL == index) return;
+    free_s(index->line);
+    io_free(index);
+}
+
+pal_image_t *load_pcx_rows(const char *fn, const pcx_index_t *index, uint32_t y0, uint32_t count) {
+    int rval = 0;
+    io_file_t f = {.fp = NULL, .fd = -1};
+    io_reader_t rd = {0};
+    pal_image_t *img = NULL;
+    uint8_t *line = NULL;
+    pcx_header_t pcx;
+    image_info_t info;
+
+    if((NULL == fn) || (NULL == index)) {
+        rval = EBADF;
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = io_open_file(fn, &f))) {
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = pcx_read_header(&f.io, &pcx, &info))) {
+        goto CLEANUP;
+    }
+
+    // make sure the index is for this file, and hasn't gone stale
+    size_t stride = (size_t)pcx.bytes_per_line * pcx.num_planes;
+    if((index->hdr.width != info.width) || (index->hdr.height != info.height) || 
+       (index->hdr.stride != stride) || (pcx_file_size(&f.io) != (int64_t)index->hdr.size)) {
+        rval = EINVAL;
+        goto CLEANUP;
+    }
+
+    // the rows have to be inside the image
+    if((0 == count) || (y0 >= info.height) || (count > (info.height - y0))) {
+        rval = EINVAL;
+        goto CLEANUP;
+    }
+
+    if((256 == info.colours) && (0 != (rval = pcx_read_palette(&f.io, 0, &info)))) {
+        goto CLEANUP;
+    }
+
+    // go straight to the first line we want
+    if(0 > io_seek(&f.io, index->line[y0].offset, SEEK_SET)) {
+        rval = errno;
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = io_image_reuse(&img, info.width, count, info.colours))) {
+        goto CLEANUP;
+    }
+    memcpy(img->pal, info.pal, info.colours * sizeof(img_pal_entry_t));
+
+    if((0 != (rval = io_reader_init(&rd, &f.io, stride * 2))) || (NULL == (line = io_scratch_alloc(stride)))) {
+        if(0 == rval) rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+
+    pcx_run_t run = {.val = index->line[y0].val, .count = index->line[y0].count};
+    for(uint32_t y = 0; y < count; y++) {
+        if(0 != (rval = io_reader_fill(&rd, stride * 2))) goto CLEANUP;
+        if(0 != (rval = pcx_rle_decode_line(line, stride, &rd.ms, &run))) goto CLEANUP;
+        pcx_unpack_line(&pcx, &img->pixels[(size_t)y * info.width], line, info.width);
+    }
+
+    free_s(line);
+    io_reader_free(&rd);
+    io_close_file(&f);
+    return img;
+CLEANUP:
+    free_s(line);
+    io_reader_free(&rd);
+    io_close_file(&f);
+    if(NULL != img) io_image_drop(img);
+    errno = rval;
+    return NULL;
+}
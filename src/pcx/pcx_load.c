@@ -1,73 +1,229 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "pcx_priv.h"
+#include "../io/io_priv.h"
 #include <image_pcx.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <memstream.h>
 #include <pal-tools.h>
 
-static int pcx_rle_decode(memstream_buf_t *dst, memstream_buf_t *src);
+#define PCX_RLE_SLACK (64) // room needed on both sides to decode without exact bounds
+
+static int pcx_rle_decode(uint8_t *dst, size_t len, const uint8_t *src, size_t slen);
+
+/// @brief decodes a PCX file held in memory into an image, reusing the storage of the
+///        image it is given when that is large enough
+/// @param dst pointer to the image to decode into, may point to NULL to allocate a new one
+/// @param buf pointer to the start of the PCX file data
+/// @param len length of the PCX file data in bytes
+/// @return 0 on success, otherwise an errno value
+static int pcx_decode(pal_image_t **dst, const uint8_t *buf, size_t len);
 
 pal_image_t *load_pcx(const char *fn) {
     int rval = 0;
     pal_image_t *img = NULL;
-    FILE *fp = NULL;
-    uint8_t *fbuf = NULL;
+    uint8_t *buf = NULL;
+    size_t len = 0;
 
     if(NULL == fn) {
         rval = EBADF;
         goto CLEANUP;
     }
 
-    // try to open input file
-    if(NULL == (fp = fopen(fn,"rb"))) {
-        rval = errno;  // can't open input file
+    // pull the whole file into memory with a single read
+    if(0 != (rval = io_read_file(fn, &buf, &len))) {
         goto CLEANUP;
     }
 
-    // get the size of the file
-    fseek(fp, 0, SEEK_END);
-    size_t fsz = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    if(NULL == (img = load_pcx_mem(buf, len))) {
+        rval = errno;
+        goto CLEANUP;
+    }
 
-    // go back to the start of the file and read in the header
-    pcx_header_t pcx;
-    memset(&pcx, 0, sizeof(pcx_header_t));
+    free_s(buf);
+    return img;
+CLEANUP:
+    free_s(buf);
+    errno = rval;
+    return NULL;
+}
+
+pal_image_t *load_pcx_io(image_io_t *io) {
+    int rval = 0;
+    pal_image_t *img = NULL;
+    uint8_t *buf = NULL;
+    size_t len = 0;
+
+    if(NULL == io) {
+        rval = EBADF;
+        goto CLEANUP;
+    }
+
+    // the stream may not be able to seek, so buffer all of it up front
+    if(0 != (rval = io_read_all(io, &buf, &len))) {
+        goto CLEANUP;
+    }
 
-    int nr = fread(&pcx, sizeof(pcx_header_t), 1, fp);
-    if(1 != nr) {
+    if(NULL == (img = load_pcx_mem(buf, len))) {
         rval = errno;
         goto CLEANUP;
     }
-    fsz -= sizeof(pcx_header_t);
 
-    // sanity check the magic, and the encoding
-    if((PCX_MAGIC != pcx.magic) || (PCX_RLE != pcx.encoding)) {
+    free_s(buf);
+    return img;
+CLEANUP:
+    free_s(buf);
+    errno = rval;
+    return NULL;
+}
+
+pal_image_t *load_pcx_mem(const uint8_t *buf, size_t len) {
+    pal_image_t *img = NULL;
+
+    int rval = pcx_decode(&img, buf, len);
+    if(0 != rval) {
+        io_image_drop(img);
+        errno = rval;
+        return NULL;
+    }
+    return img;
+}
+
+int load_pcx_into(pal_image_t **dst, const char *fn) {
+    int rval = 0;
+    io_map_t map = {NULL, 0, 0};
+
+    if((NULL == dst) || (NULL == fn)) return EBADF;
+
+    // map rather than read, so there is no file buffer to allocate for each frame
+    if(0 != (rval = io_map_file(fn, &map))) return rval;
+    rval = pcx_decode(dst, map.data, map.len);
+    io_unmap_file(&map);
+    return rval;
+}
+
+int load_pcx_mem_into(pal_image_t **dst, const uint8_t *buf, size_t len) {
+    if(NULL == dst) return EBADF;
+    return pcx_decode(dst, buf, len);
+}
+
+pal_image_t *load_pcx_scaled(const char *fn, int scale) {
+    int rval = 0;
+    io_file_t f = {.fp = NULL, .fd = -1};
+    io_reader_t rd = {0};
+    pal_image_t *img = NULL;
+    uint8_t *line = NULL;
+    uint8_t *px = NULL;
+    pcx_header_t pcx;
+    image_info_t info;
+
+    if(NULL == fn) {
         rval = EBADF;
         goto CLEANUP;
     }
+    if(!io_scale_ok(scale)) {
+        rval = EINVAL;
+        goto CLEANUP;
+    }
 
-    // check the version, we only support version 5 as we want 256 colour paletted images
-    if(PCX_V5 != pcx.version) {
-        rval = ENOTSUP;
+    if(0 != (rval = io_open_file(fn, &f))) {
         goto CLEANUP;
     }
 
-    // we only support 1 plane and 4 plane encodings currently
-    if((pcx.num_planes != 1) && (pcx.num_planes != 4)) {
-        rval = ENOTSUP;
+    if(0 != (rval = pcx_read_header(&f.io, &pcx, &info))) {
         goto CLEANUP;
     }
 
-    int max_colours = (1UL << (pcx.bits_per_pixel * pcx.num_planes));
+    // fetch the palette from the end, then come back for the image data
+    if(256 == info.colours) {
+        if(0 != (rval = pcx_read_palette(&f.io, 0, &info))) {
+            goto CLEANUP;
+        }
+        if(0 > io_seek(&f.io, sizeof(pcx_header_t), SEEK_SET)) {
+            rval = errno;
+            goto CLEANUP;
+        }
+    }
 
-    // must be a 16 or 256 colour paletted image
-    if((16 != max_colours) && (256 != max_colours)) {
-        rval = ENOTSUP;
+    uint32_t ow = IO_SCALED(info.width, scale);
+    uint32_t oh = IO_SCALED(info.height, scale);
+    size_t stride = (size_t)pcx.bytes_per_line * pcx.num_planes;
+    size_t need = stride * 2;
+
+    if((0 != (rval = io_reader_init(&rd, &f.io, need))) || 
+       (NULL == (line = io_scratch_alloc(stride))) || (NULL == (px = io_scratch_alloc(info.width + 1)))) {
+        if(0 == rval) rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = io_image_reuse(&img, ow, oh, info.colours))) {
+        goto CLEANUP;
+    }
+    memcpy(img->pal, info.pal, info.colours * sizeof(img_pal_entry_t));
+
+    // every line has to be run through the RLE decoder to find the next, but the lines we 
+    // don't keep are only counted through rather than decoded and unpacked
+    pcx_run_t run = {0};
+    uint32_t lh = ((oh - 1) * scale) + 1; // no need to go past the last line we keep
+    for(uint32_t y = 0; y < lh; y++) {
+        if(0 != (rval = io_reader_fill(&rd, need))) goto CLEANUP;
+        if(0 != (y % scale)) {
+            if(0 != (rval = pcx_rle_skip_line(stride, &rd.ms, &run))) goto CLEANUP;
+            continue;
+        }
+        if(0 != (rval = pcx_rle_decode_line(line, stride, &rd.ms, &run))) goto CLEANUP;
+        pcx_unpack_line(&pcx, px, line, info.width);
+        io_pick(&img->pixels[(size_t)(y / scale) * ow], px, ow, scale);
+    }
+
+    free_s(px);
+    free_s(line);
+    io_reader_free(&rd);
+    io_close_file(&f);
+    return img;
+CLEANUP:
+    free_s(px);
+    free_s(line);
+    io_reader_free(&rd);
+    io_close_file(&f);
+    if(NULL != img) io_image_drop(img);
+    errno = rval;
+    return NULL;
+}
+
+static int pcx_decode(pal_image_t **dst, const uint8_t *buf, size_t len) {
+    int rval = 0;
+    pal_image_t *img = NULL;
+    uint8_t *line = NULL;
+
+    if(NULL == buf) {
+        rval = EBADF;
+        goto CLEANUP;
+    }
+
+    // the decoder only ever reads from the source buffer
+    memstream_buf_t src = {.pos = 0, .len = len, .data = (uint8_t *)buf};
+    size_t fsz = len;
+
+    // read in the header from the start of the file
+    pcx_header_t pcx;
+    uint8_t *p = io_take(&src, sizeof(pcx_header_t));
+    if(NULL == p) {
+        rval = EBADF; // too short to be a PCX file
+        goto CLEANUP;
+    }
+    memcpy(&pcx, p, sizeof(pcx_header_t));
+    fsz -= sizeof(pcx_header_t);
+
+    // make sure it's in a format we can work with
+    if(0 != (rval = pcx_check_header(&pcx))) {
         goto CLEANUP;
     }
 
+    int max_colours = (1UL << (pcx.bits_per_pixel * pcx.num_planes));
+
     pcx_pal256_t pal_vga;
     memset(&pal_vga, 0, sizeof(pcx_pal256_t));
 
@@ -75,13 +231,12 @@ pal_image_t *load_pcx(const char *fn) {
     // so may need to adjust this to check for palettes of varying lengths at the end. For now
     // we assume only a 256 coour palette would be present for 1 plane/8 bits per pixel mode
     if(256 == max_colours) { // try to read the palette
-        size_t cpz = ftell(fp); // save our position
-        fseek(fp, -sizeof(pcx_pal256_t), SEEK_END); // goto the last 769 bytes in the file
-        int nr = fread(&pal_vga, sizeof(pcx_pal256_t), 1, fp); // read in the palette
-        if(1 != nr) {
-            rval = errno;
+        if(fsz < sizeof(pcx_pal256_t)) { // not enough room for the palette
+            rval = EINVAL;
             goto CLEANUP;
         }
+        // the palette is the last 769 bytes in the file
+        memcpy(&pal_vga, &buf[len - sizeof(pcx_pal256_t)], sizeof(pcx_pal256_t));
 
         // check to see that it is there
         if(PCX_PAL_MAGIC != pal_vga.marker) {
@@ -89,26 +244,17 @@ pal_image_t *load_pcx(const char *fn) {
             goto CLEANUP;
         }
 
-        fseek(fp, cpz, SEEK_SET); // restore our position
         fsz -= sizeof(pcx_pal256_t);
     }
 
-    // we allocate the image buffer with enough space to include any padding.
-    // so we don't need an additional buffer while decoding
-    // the padding btes will fall off to the end of the allocated space after decoding
     int img_width = pcx.x_end - pcx.x_start + 1;
     int img_height = pcx.y_end - pcx.y_start + 1;
-    int ipsz = img_width * img_height; // pixel size
-
-    int bpp = (pcx.bits_per_pixel * pcx.num_planes);
-    int stride = pcx.bytes_per_line * pcx.num_planes;
-    int ibsz = stride * img_height; // buffer size, including any padding
+    size_t stride = (size_t)pcx.bytes_per_line * pcx.num_planes;
 
-    // extra bytes will be the difference between the buffer size and the pixel size
-    if(NULL == (img = image_alloc(img_width, img_height, max_colours, 0))) {
-        rval = errno;
+    if(0 != (rval = io_image_reuse(dst, img_width, img_height, max_colours))) {
         goto CLEANUP;
     }
+    img = *dst;
 
     // copy in the palette, no manipulation should be required as the palette should already be 24bit RGB
     // we caan get away with memcpy here because the PCX palette format is the same as our internal one
@@ -121,125 +267,205 @@ pal_image_t *load_pcx(const char *fn) {
         memcpy(img->pal, pcx.pal_ega, 16 * sizeof(pcx_rgb_palette_entry_t));
     }
 
-    // allocate a buffer large enough for the RLE data in the file, and the decoded data
-    if(NULL == (fbuf = calloc(1, fsz+ibsz))) {
-        rval = errno;
+    const uint8_t *rle = &src.data[src.pos]; // rle data follows the header
+    bool direct = (1 == pcx.num_planes) && (8 == pcx.bits_per_pixel);
+
+    // a plain 8 bit image with no padding decodes straight into the pixels in one go
+    if(direct && (pcx.bytes_per_line == img_width)) {
+        rval = pcx_rle_decode(img->pixels, stride * img_height, rle, fsz);
         goto CLEANUP;
     }
 
-    // read the compressed stream into the 2nd half of the buffer
-    nr = fread(fbuf+ibsz, fsz, 1, fp);
-    if(nr != 1) {
-        rval = errno;  // can't read file
+    // otherwise it goes a line at a time through a single line of scratch space. A padded 8 bit
+    // line can't decode straight into its row, as the padding can be longer than the rest of the image
+    if(NULL == (line = io_scratch_alloc(stride))) {
+        rval = errno;
         goto CLEANUP;
     }
 
-    memstream_buf_t pcxbuf = {fsz, 0, fbuf+ibsz}; // rle data is in 2nd half
-    memstream_buf_t imgbuf = {ibsz, 0, fbuf};     // decompressed image is in first half
-    // memstream_buf_t imgbuf = {img->image_size + img->extra_size, 0, img->pixels};
-    rval = pcx_rle_decode(&imgbuf, &pcxbuf);
-    if(rval != 0) {
-        goto CLEANUP;
+    memstream_buf_t ms = {.pos = 0, .len = fsz, .data = (uint8_t *)rle};
+    pcx_run_t run = {0, 0};
+    for(int y = 0; y < img_height; y++) {
+        uint8_t *row = &img->pixels[(size_t)y * img_width];
+        if(0 != (rval = pcx_rle_decode_line(line, stride, &ms, &run))) {
+            goto CLEANUP;
+        }
+        if(direct) { // drop the padding
+            memcpy(row, line, img_width);
+        } else { // deplane, or unpack
+            pcx_unpack_line(&pcx, row, line, img_width);
+        }
     }
 
-    // now we need to deplane, or unpack if necessary
-    if(pcx.num_planes == 1) {
-        if(pcx.bits_per_pixel == 8) {
-            if(ipsz == ibsz) { // no padding bytes, we can jsut copy the image over
-                memcpy(img->pixels, fbuf, ipsz);
-            } else { // we have padding per line, so we need to only copy the image bytes on a per line basis
-                int img_stride = img->width;
-                int pcx_stride = pcx.bytes_per_line;
-                uint8_t *dst = img->pixels;
-                uint8_t *src = fbuf;
-                for(int line = 0; line < img->height; line++) {
-                    memcpy(dst, src, img_stride);
-                    dst += img_stride;
-                    src += pcx_stride;
-                }
-            }
-        } else { // must be 4 bits/pixel
-            int skip = (pcx.bytes_per_line - ((img->width + 1) / 2)); // number of padding bytes at end of line
-            uint8_t *dst = img->pixels;
-            uint8_t *src = fbuf;
-            int h = img->height;
-            int w = img->width;
-            for(int y = 0; y < h; y++) {
-                for(int x = 0; x < w; x+=2) {
-                    uint8_t pix = *src++;
-                    *dst++ = ((pix >> 4) & 0x0f);
-                    if((x+1) < w) *dst++ = (pix & 0x0f); // do not write 2nd pixel if we are an odd width, and at the end
-                }
-                src += skip; // skip any padding bytes
-            }
+    // the RLE data has to end with the image, as it does for the single pass decode
+    if((0 != run.count) || (ms.pos != ms.len)) rval = ENOBUFS;
+
+CLEANUP:
+    free_s(line);
+    return rval;
+}
+
+int pcx_check_header(const pcx_header_t *pcx) {
+    // sanity check the magic, and the encoding
+    if((PCX_MAGIC != pcx->magic) || (PCX_RLE != pcx->encoding)) {
+        return EBADF;
+    }
+
+    // check the version, we only support version 5 as we want 256 colour paletted images
+    if(PCX_V5 != pcx->version) {
+        return ENOTSUP;
+    }
+
+    // we only support 1 plane and 4 plane encodings currently
+    if((pcx->num_planes != 1) && (pcx->num_planes != 4)) {
+        return ENOTSUP;
+    }
+
+    int max_colours = (1UL << (pcx->bits_per_pixel * pcx->num_planes));
+
+    // must be a 16 or 256 colour paletted image
+    if((16 != max_colours) && (256 != max_colours)) {
+        return ENOTSUP;
+    }
+
+    // the image can't end before it starts
+    if((pcx->x_end < pcx->x_start) || (pcx->y_end < pcx->y_start)) {
+        return EINVAL;
+    }
+
+    // each plane of a line has to have room for all of the pixels
+    if(((uint32_t)pcx->bytes_per_line * 8) < ((uint32_t)(pcx->x_end - pcx->x_start + 1) * pcx->bits_per_pixel)) {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+/// @brief PCX rle decoder, for a whole image held in memory
+/// @param dst pointer to receive the decompressed data
+/// @param len size of the decompressed data in bytes, it must all be filled
+/// @param src pointer to the RLE compressed source data
+/// @param slen length of the RLE data in bytes, it must all be used
+/// @return 0 on success, EFAULT if the RLE data ran out, ENOBUFS if there was too much of it
+static int pcx_rle_decode(uint8_t *dst, size_t len, const uint8_t *src, size_t slen) {
+    memstream_buf_t ms = {.pos = 0, .len = slen, .data = (uint8_t *)src};
+    pcx_run_t run = {0, 0};
+
+    int rval = pcx_rle_decode_line(dst, len, &ms, &run);
+    if(0 != rval) return rval;
+    if((0 != run.count) || (ms.pos != ms.len)) return ENOBUFS; // we ran out of space
+    return 0;
+}
+
+int pcx_rle_decode_line(uint8_t *dst, size_t len, memstream_buf_t *src, pcx_run_t *run) {
+    uint8_t *d = dst;
+    uint8_t *dend = &dst[len];
+    const uint8_t *s = &src->data[src->pos];
+    const uint8_t *send = &src->data[src->len];
+    int rval = 0;
+
+    // finish off any run that was carried over from the previous line
+    if(0 < run->count) {
+        size_t fit = ((size_t)run->count < len) ? (size_t)run->count : len;
+        memset(d, run->val, fit);
+        d += fit;
+        run->count -= (int)fit;
+    }
+
+    while(d < dend) {
+        if(s >= send) {
+            rval = EFAULT; // input stream unexpectidly ran out
+            break;
         }
-    } else { // must be 4 planes, and therefore 1 bit per pixel/plane
-        int pcx_stride = pcx.bytes_per_line;
-        int pcx_line_stride = pcx.bytes_per_line * 4;
-        uint8_t *dst = img->pixels;
-        uint8_t *src = fbuf;
-        int h = img->height;
-        int w = img->width;
-        for(int y = 0; y < h; y++) {
-            uint8_t *p0 = src;
-            uint8_t *p1 = p0 + pcx_stride;
-            uint8_t *p2 = p1 + pcx_stride;
-            uint8_t *p3 = p2 + pcx_stride;
-            uint8_t mask = 0x80;
-            for(int x = 0; x < w; x++) {
-                uint8_t pix = 0;
-                if((*p0) & mask) pix |= 0x01;
-                if((*p1) & mask) pix |= 0x02;
-                if((*p2) & mask) pix |= 0x04;
-                if((*p3) & mask) pix |= 0x08;
-                *dst++ = pix;
-                mask >>= 1;
-                if(0 == mask) { // we've consumed all the bits, advance to the next byte
-                    mask = 0x80;
-                    p0++;
-                    p1++;
-                    p2++;
-                    p3++;
-                }
+
+        // with plenty of room on both sides, fixed size copies and fills that may go past what
+        // is needed stand in for exact ones, the extra is overwritten by what comes next
+        if(((dend - d) >= PCX_RLE_SLACK) && ((send - s) >= PCX_RLE_SLACK)) {
+            if(0xc0 >= *s) {
+                memcpy(d, s, 16);
+                size_t n = io_span_le(s, 16, 0xc0);
+                d += n;
+                s += n;
+            } else {
+                memset(d, s[1], 64);
+                d += s[0] & 0x3f;
+                s += 2;
             }
-            src += pcx_line_stride; 
+            continue;
+        }
+
+        // a span of literal bytes is copied in one go, it ends at the next run or when either side is full
+        if(0xc0 >= *s) {
+            size_t room = dend - d;
+            size_t avail = send - s;
+            size_t n = io_span_le(s, (avail < room) ? avail : room, 0xc0);
+            memcpy(d, s, n);
+            d += n;
+            s += n;
+            continue;
+        }
+
+        if(1 == (send - s)) {
+            rval = EFAULT; // input stream unexpectidly ran out
+            break;
+        }
+        size_t n = s[0] & 0x3f;
+        uint8_t col = s[1];
+        s += 2;
+
+        // anything that doesn't fit is held over for the next line
+        size_t room = dend - d;
+        size_t fit = (room < n) ? room : n;
+        memset(d, col, fit);
+        d += fit;
+        if(fit < n) {
+            run->val = col;
+            run->count = (int)(n - fit);
         }
     }
 
-    free_s(fbuf);
-    fclose_s(fp);
-    return img;
-CLEANUP:
-    fclose_s(fp);
-    free_s(fbuf);
-    image_free(img);
-    errno = rval;
-    return NULL;
+    src->pos = s - src->data;
+    return rval;
 }
 
-/// @brief PCX rle decoder
-/// @param dst pointer to a memstream buffer for holding the decompressed result data
-/// @param src pointer to a memstream buffer holding the RLE compressed source data 
-/// @return 
-static int pcx_rle_decode(memstream_buf_t *dst, memstream_buf_t *src) {
+void pcx_unpack_line(const pcx_header_t *pcx, uint8_t *dst, const uint8_t *src, int width) {
+    if(1 == pcx->num_planes) {
+        if(8 == pcx->bits_per_pixel) { // already one byte per pixel, just drop the padding
+            memcpy(dst, src, width);
+        } else { // must be 4 bits/pixel
+            io_unpack4(dst, src, width);
+        }
+    } else { // must be 4 planes, and therefore 1 bit per pixel/plane
+        io_planar4(dst, src, pcx->bytes_per_line, width);
+    }
+}
+
+int pcx_rle_skip_line(size_t len, memstream_buf_t *src, pcx_run_t *run) {
+    size_t pos = 0;
 
-    uint8_t val;
-    while(src->pos < src->len) {
-        val = src->data[src->pos++];
-        int len = 1;
+    // finish off any run that was carried over from the previous line
+    size_t fit = ((size_t)run->count < len) ? (size_t)run->count : len;
+    run->count -= fit;
+    pos += fit;
+
+    while(pos < len) {
+        if(src->pos >= src->len) return EFAULT; // input stream unexpectidly ran out
+        uint8_t val = src->data[src->pos++];
+        size_t n = 1;
         uint8_t col = val;
         if(0xc0 < val) {
             if(src->pos == src->len) return EFAULT; // input stream unexpectidly ran out
             col = src->data[src->pos++];
-            len = val & 0x3f;
+            n = val & 0x3f;
         }
 
-        if((dst->pos + len) > dst->len) return ENOBUFS; // we ran out of space
-
-        for(int i = 0; i < len; i++) {
-            dst->data[dst->pos++] = col;
+        // anything that doesn't fit is held over for the next line
+        fit = ((len - pos) < n) ? (len - pos) : n;
+        pos += fit;
+        if(fit < n) {
+            run->val = col;
+            run->count = n - fit;
         }
     }
-    if(dst->pos != dst->len) return EINVAL;
     return 0;
 }
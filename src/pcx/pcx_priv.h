@@ -7,12 +7,13 @@
  */
 #include <stdint.h>
 #include <image_pcx.h>
+#include <memstream.h>
 
 #ifndef CA_IMG_PCX_INTERNAL
 #define CA_IMG_PCX_INTERNAL
 
 #define fclose_s(A) if(A) fclose(A); A=NULL
-#define free_s(A) if(A) free(A); A=NULL
+#define free_s(A) if(A) io_free(A); A=NULL
 
 #define PCX_MAGIC 0x0A 
 #define PCX_PAL_MAGIC 0x0C 
@@ -89,6 +90,105 @@ typedef struct { // always located as last 769 bytes in file, if present. [PCX V
     pcx_rgb_palette_entry_t pal[256]; // 256 RGB entries
 } pcx_pal256_t;
 
+#define PCX_INDEX_SIG "PCXI"   // signature at the start of an index sidecar file
+#define PCX_INDEX_VERSION (1)
+
+typedef struct { // header of an index sidecar file, followed by one entry for each line
+    char sig[4];        // "PCXI"
+    uint8_t version;    // 1
+    uint8_t RESERVED[3];
+    uint32_t width;     // width of the image in pixels
+    uint32_t height;    // height of the image in pixels, and the number of entries
+    uint32_t stride;    // decoded bytes per line, all planes including padding
+    uint64_t size;      // size of the PCX file that was indexed
+} pcx_index_header_t;
+
+typedef struct { // where the RLE data for a line starts
+    uint32_t offset;    // offset of the first byte of RLE data for the line from the start of the file
+    uint8_t val;        // value of a run carried over from the previous line
+    uint8_t count;      // number of bytes of the carried over run, normally 0
+} pcx_index_entry_t;
+
 #pragma pack(pop)
 
+/// @brief checks the header to make sure the PCX is in a format we can work with
+/// @param pcx pointer to the header read from the file
+/// @return 0 if the PCX is supported, otherwise an error code
+int pcx_check_header(const pcx_header_t *pcx);
+
+/// @brief reads the header of a PCX from a stream and fills in everything but a 256 colour
+///        palette, which is at the end of the file (see pcx_read_palette())
+/// @param io pointer to the image_io_t to read from
+/// @param pcx pointer to receive the header read from the file
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int pcx_read_header(image_io_t *io, pcx_header_t *pcx, image_info_t *info);
+
+/// @brief seeks to the end of a PCX file and reads the 256 colour palette from there
+/// @param io pointer to the image_io_t to read from, which must be able to seek
+/// @param start position of the start of the file in the stream, or -1 if unknown
+/// @param info pointer to the image_info_t to put the palette in
+/// @return 0 on success, otherwise an error code
+int pcx_read_palette(image_io_t *io, int64_t start, image_info_t *info);
+
+/// @brief index of where each line of a PCX file starts, so lines can be decoded without
+///        decoding all of the lines before them
+struct pcx_index {
+    pcx_index_header_t hdr;   // details of the file that was indexed
+    pcx_index_entry_t *line;  // one entry for each line of the image
+};
+
+/// @brief the part of a run that didn't fit in the scanline being decoded, PCX encoders
+///        are not meant to let runs cross scanlines but not all of them keep to that
+typedef struct {
+    uint8_t val; // value of the run
+    int count;   // number of bytes of the run still to be output
+} pcx_run_t;
+
+/// @brief decodes exactly one scanline (all planes, including padding) of PCX RLE data
+/// @param dst pointer to receive the decoded scanline
+/// @param len length of the scanline in bytes, bytes_per_line * num_planes
+/// @param src pointer to a memstream holding the RLE data, advanced past what was used
+/// @param run pointer to the carry over state, zeroed before the first line
+/// @return 0 on success, EFAULT if the RLE data ran out
+int pcx_rle_decode_line(uint8_t *dst, size_t len, memstream_buf_t *src, pcx_run_t *run);
+
+/// @brief moves past exactly one scanline of PCX RLE data without decoding it
+/// @param len length of the scanline in bytes, bytes_per_line * num_planes
+/// @param src pointer to a memstream holding the RLE data, advanced past what was used
+/// @param run pointer to the carry over state, as for pcx_rle_decode_line()
+/// @return 0 on success, EFAULT if the RLE data ran out
+int pcx_rle_skip_line(size_t len, memstream_buf_t *src, pcx_run_t *run);
+
+/// @brief converts one decoded scanline to one byte per pixel, unpacking 4 bit pixels 
+///        or combining the 4 bit planes as needed
+/// @param pcx pointer to the header of the file
+/// @param dst pointer to receive width pixels
+/// @param src pointer to the decoded scanline
+/// @param width number of pixels in the line
+void pcx_unpack_line(const pcx_header_t *pcx, uint8_t *dst, const uint8_t *src, int width);
+
+/// @brief fills in the header for a single plane 4 bit (16 colour) or 8 bit (more than 16 colour) PCX
+/// @param pcx pointer to the header to fill in
+/// @param width width of the image in pixels
+/// @param height height of the image in pixels
+/// @param colours number of colours in the palette
+/// @param pal pointer to the palette, only used for a 16 colour image
+void pcx_make_header(pcx_header_t *pcx, uint32_t width, uint32_t height, int colours, const img_pal_entry_t *pal);
+
+/// @brief converts one line of pixels, one byte per pixel, to a line in the layout of the
+///        header, ready to be RLE encoded. Any padding is left as it was
+/// @param pcx pointer to the header of the file
+/// @param dst pointer to receive bytes_per_line bytes
+/// @param src pointer to width pixels
+/// @param width number of pixels in the line
+void pcx_pack_line(const pcx_header_t *pcx, uint8_t *dst, const uint8_t *src, int width);
+
+/// @brief performes the PCX RLE compression on the input stream on a line by line basis
+/// @param bpl bytes per line for the input data, the input buffer must be a multiple of this
+/// @param dst pointer to a memstream buffer holding the RLE compressed result data 
+/// @param src pointer to a memstream buffer for holding the decompressed source data
+/// @return 0 on success, ENOBUFS if dst ran out of room, otherwise an error code
+int pcx_rle_encode(int bpl, memstream_buf_t *dst, memstream_buf_t *src);
+
 #endif
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <string.h>
+#include "pcx_priv.h"
+#include "../io/io_priv.h"
+#include <image_pcx.h>
+#include <stdbool.h>
+#include <errno.h>
+
+int probe_pcx(const char *fn, image_info_t *info) {
+    if((NULL == fn) || (NULL == info)) return EBADF;
+    return io_probe_file(fn, info, probe_pcx_io);
+}
+
+int probe_pcx_io(image_io_t *io, image_info_t *info) {
+    int rval = 0;
+    pcx_header_t pcx;
+
+    if((NULL == io) || (NULL == info)) return EBADF;
+
+    // where the file starts, so we can report the data offset relative to it
+    int64_t start = io_seek(io, 0, SEEK_CUR);
+
+    if(0 != (rval = pcx_read_header(io, &pcx, info))) {
+        return rval;
+    }
+
+    if(256 == info->colours) {
+        rval = pcx_read_palette(io, start, info);
+    }
+    return rval;
+}
+
+int pcx_read_header(image_io_t *io, pcx_header_t *pcx, image_info_t *info) {
+    int rval = 0;
+
+    if(0 != io_read_exact(io, pcx, sizeof(pcx_header_t))) {
+        return EBADF; // too short to be a PCX file
+    }
+
+    // make sure it's in a format we can work with
+    if(0 != (rval = pcx_check_header(pcx))) {
+        return rval;
+    }
+
+    int max_colours = (1UL << (pcx->bits_per_pixel * pcx->num_planes));
+
+    memset(info, 0, sizeof(image_info_t));
+    info->format = IMAGE_FMT_PCX;
+    info->width = pcx->x_end - pcx->x_start + 1;
+    info->height = pcx->y_end - pcx->y_start + 1;
+    info->bits_per_pixel = pcx->bits_per_pixel * pcx->num_planes;
+    info->colours = max_colours;
+    info->transparent = -1; // PCX has no transparency
+    info->pixel_offset = sizeof(pcx_header_t);
+
+    if(16 == max_colours) {
+        memcpy(info->pal, pcx->pal_ega, 16 * sizeof(pcx_rgb_palette_entry_t));
+    }
+
+    return 0;
+}
+
+int pcx_read_palette(image_io_t *io, int64_t start, image_info_t *info) {
+    // the 256 colour palette is the last 769 bytes in the file
+    pcx_pal256_t pal_vga;
+    int64_t end = io_seek(io, -(int64_t)sizeof(pcx_pal256_t), SEEK_END);
+    if(0 > end) {
+        return errno; // need to be able to seek to get to the palette
+    }
+    if((0 <= start) && (end < (start + (int64_t)sizeof(pcx_header_t)))) {
+        return EINVAL; // not enough room for the palette
+    }
+    if(0 != io_read_exact(io, &pal_vga, sizeof(pcx_pal256_t))) {
+        return EINVAL;
+    }
+
+    // check to see that it is there
+    if(PCX_PAL_MAGIC != pal_vga.marker) {
+        return EINVAL;
+    }
+
+    // we caan get away with memcpy here because the PCX palette format is the same as our internal one
+    memcpy(info->pal, pal_vga.pal, 256 * sizeof(pcx_rgb_palette_entry_t));
+    return 0;
+}
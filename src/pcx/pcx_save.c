@@ -1,195 +1,252 @@
 #include <stdio.h>
 #include <string.h>
 #include "pcx_priv.h"
+#include "../io/io_priv.h"
 #include <image_pcx.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <memstream.h>
 
-static int pcx_rle_encode(int bpl, memstream_buf_t *dst, memstream_buf_t *src);
+/// @brief encodes an image as a 4 bit or 8 bit PCX into a list of pieces to be written
+/// @param img pointer to the pal_image_t structure containing the image
+/// @param segs pointer to an empty segment list to receive the pieces of the PCX file
+/// @return 0 on success otherwise an error value
+static int pcx_encode(pal_image_t *img, io_segs_t *segs);
 
 /// @brief saves an image as a 4 bit or 8 bit PCX image, always as single-plane image
 /// @param fn pointer to the name of the file to save the image as
 /// @param img pointer to the pal_image_t structure containing the image
 /// @return 0 on success otherwise an error value
 int save_pcx(const char *fn, pal_image_t *img) {
-    int rval = ENOTSUP;
-    FILE *fp = NULL;
-    pcx_pal256_t *pal = NULL;
-    uint8_t *pcx_buf = NULL;
+    io_segs_t segs = {0};
 
     if((NULL == img) || (NULL == fn)) return EBADF;
 
-    if((0 == img->width) || (0 == img->height) || (0 == img->colours)) return EINVAL;
+    // build the file, then send it out in one go
+    int rval = pcx_encode(img, &segs);
+    if(0 == rval) {
+        rval = io_write_file(fn, &segs);
+    }
 
-    // we support 16 and 256 colour modes. Anything greater than 16 is considered 256
-    if(img->colours < 16) return EINVAL;
+    io_segs_free(&segs);
+    return rval;
+}
 
-    // try to open/create output file
-    if(NULL == (fp = fopen(fn,"wb"))) {
-        rval = errno;  // can't open/create output file
-        goto CLEANUP;
-    }
+/// @brief saves an image as a 4 bit or 8 bit PCX image to a stream, always as single-plane image
+/// @param io pointer to the image_io_t to write the PCX to
+/// @param img pointer to the pal_image_t structure containing the image
+/// @return 0 on success otherwise an error value
+int save_pcx_io(image_io_t *io, pal_image_t *img) {
+    io_segs_t segs = {0};
 
-    pcx_header_t pcx;
-    memset(&pcx, 0, sizeof(pcx_header_t));
+    if((NULL == img) || (NULL == io)) return EBADF;
 
-    pcx.magic = PCX_MAGIC;
-    pcx.version = PCX_V5;
-    pcx.encoding = PCX_RLE;
+    // build the file, then send it out in one go
+    int rval = pcx_encode(img, &segs);
+    if(0 == rval) {
+        rval = io_write_segs(io, &segs);
+    }
 
-    // currently we only encode at 1 plane, and 4 or 8 bits epr pixel
-    if(img->colours == 16) {
-        pcx.bits_per_pixel = 4;
-        pcx.bytes_per_line = (img->width + 1) / 2; // we pack 2 pixels per byte
+    io_segs_free(&segs);
+    return rval;
+}
 
-        // copy the palette in
-        // we caan get away with memcpy here because the PCX palette format is the same as our internal one
-        memcpy(pcx.pal_bytes, img->pal, sizeof(pcx_rgb_palette_entry_t) * 16);
+/// @brief encodes an image as a 4 bit or 8 bit PCX image in memory, always as single-plane image
+/// @param img pointer to the pal_image_t structure containing the image
+/// @param buf pointer to receive the allocated buffer holding the PCX file, release with free()
+/// @param len pointer to receive the length of the PCX file in bytes
+/// @return 0 on success otherwise an error value
+int save_pcx_mem(pal_image_t *img, uint8_t **buf, size_t *len) {
+    io_segs_t segs = {0};
 
-    } else {
-        pcx.bits_per_pixel = 8;
-        pcx.bytes_per_line = img->width;
-        // palette is appended after the image data
+    if((NULL == img) || (NULL == buf) || (NULL == len)) return EBADF;
+
+    int rval = pcx_encode(img, &segs);
+    if(0 == rval) {
+        rval = io_segs_flatten(&segs, buf, len);
     }
-    pcx.num_planes = 1;
-    if(pcx.bytes_per_line & 1) pcx.bytes_per_line++; // bytes per line must be even
-    
-    // set the resolution
-    pcx.x_start = 0;
-    pcx.y_start = 0;
-    pcx.x_end = img->width-1;
-    pcx.y_end = img->height-1;
-    pcx.horiz_dpi = img->width;
-    pcx.vert_dpi = img->height;
 
-    // write the header
-    int nw = fwrite(&pcx, sizeof(pcx_header_t), 1, fp);
-    if(1 != nw) {
-        rval = errno;  // can't write file
+    io_segs_free(&segs);
+    return rval;
+}
+
+static int pcx_encode(pal_image_t *img, io_segs_t *segs) {
+    int rval = ENOTSUP;
+    uint8_t *fbuf = NULL;
+    uint8_t *line = NULL;
+
+    if((0 == img->width) || (0 == img->height) || (0 == img->colours)) return EINVAL;
+
+    // we support 16 and 256 colour modes. Anything greater than 16 is considered 256
+    if((img->colours < 16) || (img->colours > 256)) return EINVAL;
+
+    pcx_header_t pcx;
+    pcx_make_header(&pcx, img->width, img->height, img->colours, img->pal);
+
+    // size the buffer for the worst case, where every byte of every line encodes as a 2 byte run
+    size_t palsz = (img->colours > 16) ? sizeof(pcx_pal256_t) : 0;
+    size_t fsz = sizeof(pcx_header_t) + ((size_t)pcx.bytes_per_line * 2 * img->height) + palsz;
+    if(NULL == (fbuf = io_scratch_calloc(1, fsz))) {
+        rval = errno;  // unable to allocate mem
         goto CLEANUP;
     }
 
+    // write the header
+    memcpy(fbuf, &pcx, sizeof(pcx_header_t));
+
     // now we need to repackage the image data according to our configuration
-    // create a buffer based on the bytes per line value + some headroom
-    pcx_buf = calloc(img->height + 32, pcx.bytes_per_line);
-    if(NULL == pcx_buf) {
+    // we do this a line at a time, so we only need a single line of scratch space
+    if(NULL == (line = io_scratch_calloc(1, pcx.bytes_per_line))) {
         rval = errno;  // unable to allocate mem
         goto CLEANUP;
     }
 
-    uint8_t *sp = img->pixels;
-    uint8_t *dp = pcx_buf + (pcx.bytes_per_line * 32);
-    if(pcx.bytes_per_line == img->width) { // we have a 1:1, just copy it
-        memcpy(dp, sp, img->image_size);
-    } else if(pcx.bits_per_pixel == 8) { // we have 1 byte per pixel, but padding at the end of each line
-        for(int y = 0; y < img->height; y++) {
-            memcpy(dp, sp, img->width);
-            sp += img->width;
-            dp += pcx.bytes_per_line;
-        }
-    } else { // must be a 4 bit image, pack it 2:1
-        for(int y = 0; y < img->height; y++) {
-            for(int x = 0; x < img->width; x++) {
-                uint8_t px = 0;
-                px |= (*sp++) & 0x0f;
-                px <<= 4;
-                px |= (*sp++) & 0x0f;
-                dp[x] = px;
-            }
-            dp += pcx.bytes_per_line;
-        }
-    }
-
-    // now we can RLE encode the data
-    memstream_buf_t dst = {.pos = 0, .len = (img->height + 32) * pcx.bytes_per_line, .data = pcx_buf};
-    memstream_buf_t src = {.pos = 0, .len = pcx.bytes_per_line * img->height, .data = pcx_buf + (pcx.bytes_per_line * 32)};
+    memstream_buf_t dst = {.pos = sizeof(pcx_header_t), .len = fsz - palsz, .data = fbuf};
+    memstream_buf_t src = {.pos = 0, .len = pcx.bytes_per_line, .data = line};
 
-    rval = pcx_rle_encode(pcx.bytes_per_line, &dst, &src);
-    if(rval != 0) {
-        goto CLEANUP;
-    }
+    for(int y = 0; y < img->height; y++) {
+        uint8_t *sp = &img->pixels[(size_t)y * img->width];
+        if((pcx.bits_per_pixel == 8) && (pcx.bytes_per_line == img->width)) { // we have a 1:1, encode straight from the image
+            src.data = sp;
+        } else { // pack it 2:1, or we have 1 byte per pixel, but padding at the end of the line
+            pcx_pack_line(&pcx, line, sp, img->width);
+        }
 
-    nw = fwrite(dst.data, dst.pos, 1, fp);
-    if(nw != 1) {
-        rval = errno;  // can't write file
-        goto CLEANUP;
+        // now we can RLE encode the line
+        src.pos = 0;
+        rval = pcx_rle_encode(pcx.bytes_per_line, &dst, &src);
+        if(rval != 0) {
+            goto CLEANUP;
+        }
     }
 
-    // write the 256 colour palette if necessary
+    // append the 256 colour palette if necessary
     if(img->colours > 16) {
-        pal = calloc(img->colours, sizeof(pcx_pal256_t));
-        if(NULL == pal) {
-            rval = errno;  // unable to allocate mem
-            goto CLEANUP;
-        }
+        pcx_pal256_t *pal = (pcx_pal256_t *)&fbuf[dst.pos];
         pal->marker = PCX_PAL_MAGIC;
         // we caan get away with memcpy here because the PCX palette format is the same as our internal one
         memcpy(pal->pal, img->pal, img->colours * sizeof(pcx_rgb_palette_entry_t));
-
-        // write the palette
-        nw = fwrite(pal, sizeof(pcx_pal256_t), 1, fp);
-        if(nw != 1) {
-            rval = errno;  // can't write file
-            goto CLEANUP;
-        }
+        dst.pos += sizeof(pcx_pal256_t);
     }
 
-    rval = 0;
+    // give back what the worst case sizing didn't need
+    uint8_t *shrunk = io_realloc(fbuf, dst.pos);
+    if(NULL != shrunk) fbuf = shrunk;
+
+    // the RLE data has to be built, so the whole file is a single piece
+    segs->buf = fbuf;
+    fbuf = NULL;
+    rval = io_segs_add(segs, segs->buf, dst.pos);
+
+    free_s(line);
+    return rval;
 CLEANUP:
-    free_s(pcx_buf); 
-    free_s(pal);
-    fclose_s(fp);
+    free_s(line);
+    free_s(fbuf);
     return rval;
 }
 
-/// @brief performes the PCX RLE compression on the input stream on a line by line basis
-/// @param bpl bytes per line for the input data, the input buffer must be a multiple of this
-/// @param dst pointer to a memstream buffer holding the RLE compressed result data 
-/// @param src pointer to a memstream buffer for holding the decompressed source data
-/// @return 
-static int pcx_rle_encode(int bpl, memstream_buf_t *dst, memstream_buf_t *src) {
+int pcx_rle_encode(int bpl, memstream_buf_t *dst, memstream_buf_t *src) {
     if(0 != (src->len % bpl)) return EINVAL;
     int lines = src->len / bpl;
 
     for(int y = 0; y < lines; y++) {
-        if(src->pos == src->len) return EFAULT;
-        uint8_t count = 1;
-        uint8_t last = src->data[src->pos++];
-        for(int x = 1; x < bpl; x++) {
-            if(src->pos == src->len) return EFAULT;
-            uint8_t cur = src->data[src->pos++];
-            if(cur == last) { // we're in a run
-                count++;
-                if(count == 64) {
-                    if((dst->pos+2) > dst->len) return ENOBUFS;
-                    dst->data[dst->pos++] = 0xff; // 0xC0 + 63
-                    dst->data[dst->pos++] = cur;
-                    count = 1; // we retained 1 to continue
+        if((src->len - src->pos) < (size_t)bpl) return EFAULT;
+        const uint8_t *p = &src->data[src->pos];
+        src->pos += bpl;
+
+        size_t x = 0;
+        while(x < (size_t)bpl) {
+            size_t left = bpl - x;
+            uint8_t val = p[x];
+
+            // a stretch of bytes that don't start a run goes out as literals, apart from any that need
+            // escaping as a run of 1. Its length is found in bulk, and it is written without branches
+            if((1 == left) || (val != p[x + 1])) {
+                size_t n = io_span_distinct(&p[x], left);
+                size_t room = dst->len - dst->pos;
+                if(room < (n * 2)) { // it might not fit, so work out exactly what it needs
+                    size_t need = n;
+                    for(size_t i = 0; i < n; i++) need += (0xc0 <= p[x + i]);
+                    if(need > room) return ENOBUFS;
                 }
-            } else { // we reached the end of a run
-                if((count == 1) && (last < 0xc0)) { // encode as a single literal
-                    if((dst->pos + 1) > dst->len) return ENOBUFS;
-                    dst->data[dst->pos++] = last;
-                } else { // encode the run
-                    if((dst->pos+2) > dst->len) return ENOBUFS;
-                    dst->data[dst->pos++] = 0xc0 + count; 
-                    dst->data[dst->pos++] = last;
+
+                uint8_t *d = &dst->data[dst->pos];
+                for(size_t i = 0; i < n; i++) {
+                    uint8_t v = p[x + i];
+                    size_t esc = (0xc0 <= v);
+                    d[0] = esc ? 0xc1 : v;
+                    d[esc] = v;
+                    d += 1 + esc;
                 }
-                last = cur;
-                count = 1;
+                dst->pos = d - dst->data;
+                x += n;
+                continue;
+            }
+
+            // otherwise it is a run of at least 2, its length is found in bulk too
+            size_t n = io_span_eq(&p[x], left);
+            x += n;
+            size_t full = (n - 1) / 63; // runs longer than 63 are split, keeping at least 1 for the end
+            n -= full * 63;
+            size_t need = (full * 2) + (((1 == n) && (val < 0xc0)) ? 1 : 2);
+            if((dst->pos + need) > dst->len) return ENOBUFS;
+
+            uint8_t *d = &dst->data[dst->pos];
+            dst->pos += need;
+            for(size_t i = 0; i < full; i++) {
+                *d++ = 0xff; // 0xC0 + 63
+                *d++ = val;
+            }
+            if((1 == n) && (val < 0xc0)) { // the end of a long run, encode as a single literal
+                *d = val;
+            } else {
+                *d++ = 0xc0 + (uint8_t)n;
+                *d = val;
             }
-        }
-        // encode what remains
-        if((count == 1) && (last < 0xc0)) { // encode as a single literal
-            if((dst->pos + 1) > dst->len) return ENOBUFS;
-            dst->data[dst->pos++] = last;
-        } else { // encode the run
-            if((dst->pos+2) > dst->len) return ENOBUFS;
-            dst->data[dst->pos++] = 0xc0 + count; 
-            dst->data[dst->pos++] = last;
         }
     }
 
     return 0;
 }
+
+void pcx_make_header(pcx_header_t *pcx, uint32_t width, uint32_t height, int colours, const img_pal_entry_t *pal) {
+    memset(pcx, 0, sizeof(pcx_header_t));
+
+    pcx->magic = PCX_MAGIC;
+    pcx->version = PCX_V5;
+    pcx->encoding = PCX_RLE;
+
+    // currently we only encode at 1 plane, and 4 or 8 bits epr pixel
+    if(colours == 16) {
+        pcx->bits_per_pixel = 4;
+        pcx->bytes_per_line = (width + 1) / 2; // we pack 2 pixels per byte
+
+        // copy the palette in
+        // we caan get away with memcpy here because the PCX palette format is the same as our internal one
+        memcpy(pcx->pal_bytes, pal, sizeof(pcx_rgb_palette_entry_t) * 16);
+
+    } else {
+        pcx->bits_per_pixel = 8;
+        pcx->bytes_per_line = width;
+        // palette is appended after the image data
+    }
+    pcx->num_planes = 1;
+    if(pcx->bytes_per_line & 1) pcx->bytes_per_line++; // bytes per line must be even
+    
+    // set the resolution
+    pcx->x_start = 0;
+    pcx->y_start = 0;
+    pcx->x_end = width-1;
+    pcx->y_end = height-1;
+    pcx->horiz_dpi = width;
+    pcx->vert_dpi = height;
+}
+
+void pcx_pack_line(const pcx_header_t *pcx, uint8_t *dst, const uint8_t *src, int width) {
+    if(pcx->bits_per_pixel == 4) { // must be a 4 bit image, pack it 2:1
+        io_pack4(dst, src, width);
+    } else { // we have 1 byte per pixel, but padding at the end of the line
+        memcpy(dst, src, width);
+    }
+}
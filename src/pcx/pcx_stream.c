@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcx_priv.h"
+#include "../io/io_priv.h"
+#include <image_pcx.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <memstream.h>
+
+int load_pcx_scanlines(image_io_t *io, image_row_fn row, void *user) {
+    int rval = 0;
+    io_reader_t rd = {0};
+    uint8_t *line = NULL;
+    uint8_t *px = NULL;
+    pcx_header_t pcx;
+    image_info_t info;
+
+    if((NULL == io) || (NULL == row)) return EBADF;
+
+    int64_t start = io_seek(io, 0, SEEK_CUR);
+
+    if(0 != (rval = pcx_read_header(io, &pcx, &info))) {
+        return rval;
+    }
+
+    // each line is decoded on its own, an RLE line is never more than twice its decoded size
+    size_t stride = (size_t)pcx.bytes_per_line * pcx.num_planes;
+    size_t need = stride * 2;
+
+    if(256 == info.colours) {
+        if(0 <= start) { // fetch the palette from the end, then come back for the image data
+            if(0 != (rval = pcx_read_palette(io, start, &info))) {
+                return rval;
+            }
+            if(0 > io_seek(io, start + sizeof(pcx_header_t), SEEK_SET)) {
+                return errno;
+            }
+        } else { // no way to get to the palette without reading everything before it
+            uint8_t *buf = NULL;
+            size_t len = 0;
+            if(0 != (rval = io_read_all(io, &buf, &len))) {
+                return rval;
+            }
+            if((len < sizeof(pcx_pal256_t)) || (PCX_PAL_MAGIC != buf[len - sizeof(pcx_pal256_t)])) {
+                free_s(buf);
+                return EINVAL;
+            }
+            memcpy(info.pal, &buf[len - sizeof(pcx_pal256_t) + 1], 256 * sizeof(pcx_rgb_palette_entry_t));
+
+            // the buffered data stands in for the stream from here on
+            rd.io = io;
+            rd.ms = (memstream_buf_t){.pos = 0, .len = len - sizeof(pcx_pal256_t), .data = buf};
+            rd.cap = len;
+            rd.eof = true;
+        }
+    }
+
+    if((NULL == rd.ms.data) && (0 != (rval = io_reader_init(&rd, io, need)))) {
+        goto CLEANUP;
+    }
+
+    if((NULL == (line = io_scratch_alloc(stride))) || (NULL == (px = io_scratch_alloc(info.width + 1)))) {
+        rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+
+    pcx_run_t run = {0};
+    for(uint32_t y = 0; y < info.height; y++) {
+        if(0 != (rval = io_reader_fill(&rd, need))) goto CLEANUP;
+        if(0 != (rval = pcx_rle_decode_line(line, stride, &rd.ms, &run))) goto CLEANUP;
+        pcx_unpack_line(&pcx, px, line, info.width);
+        if(0 != (rval = row(user, &info, y, px))) goto CLEANUP;
+    }
+
+CLEANUP:
+    free_s(px);
+    free_s(line);
+    io_reader_free(&rd);
+    return rval;
+}
+
+/// @brief the state of a PCX being written a few rows at a time
+typedef struct {
+    image_writer_t w;    // must be first
+    pcx_header_t pcx;    // header of the file being written
+    uint8_t *line;       // one line packed for encoding
+    memstream_buf_t out; // RLE data waiting to be written
+} pcx_writer_t;
+
+static int pcx_writer_rows(image_writer_t *w, const uint8_t *pixels, uint32_t count) {
+    pcx_writer_t *pw = (pcx_writer_t *)w;
+    int rval = 0;
+    size_t bpl = pw->pcx.bytes_per_line;
+
+    for(uint32_t i = 0; i < count; i++) {
+        // make sure the worst case for the line will fit, every byte encoding as a 2 byte run
+        if((pw->out.len - pw->out.pos) < (bpl * 2)) {
+            if(0 != (rval = io_write_all(w->io, pw->out.data, pw->out.pos))) return rval;
+            pw->out.pos = 0;
+        }
+
+        pcx_pack_line(&pw->pcx, pw->line, &pixels[(size_t)i * w->info.width], w->info.width);
+        memstream_buf_t src = {.pos = 0, .len = bpl, .data = pw->line};
+        if(0 != (rval = pcx_rle_encode(bpl, &pw->out, &src))) return rval;
+    }
+    return 0;
+}
+
+static int pcx_writer_finish(image_writer_t *w, bool complete) {
+    pcx_writer_t *pw = (pcx_writer_t *)w;
+    int rval = 0;
+
+    if(complete) {
+        // append the 256 colour palette if necessary, making room for it first
+        if(w->info.colours > 16) {
+            if((pw->out.len - pw->out.pos) < sizeof(pcx_pal256_t)) {
+                rval = io_write_all(w->io, pw->out.data, pw->out.pos);
+                pw->out.pos = 0;
+            }
+            pcx_pal256_t *pal = (pcx_pal256_t *)&pw->out.data[pw->out.pos];
+            pal->marker = PCX_PAL_MAGIC;
+            memset(pal->pal, 0, sizeof(pal->pal));
+            // we caan get away with memcpy here because the PCX palette format is the same as our internal one
+            memcpy(pal->pal, w->info.pal, w->info.colours * sizeof(pcx_rgb_palette_entry_t));
+            pw->out.pos += sizeof(pcx_pal256_t);
+        }
+        if(0 == rval) rval = io_write_all(w->io, pw->out.data, pw->out.pos);
+    }
+
+    free_s(pw->out.data);
+    free_s(pw->line);
+    io_free(pw);
+    return rval;
+}
+
+image_writer_t *save_pcx_begin(image_io_t *io, const image_info_t *info) {
+    int rval = 0;
+    pcx_writer_t *pw = NULL;
+
+    // we support 16 and 256 colour modes. Anything greater than 16 is considered 256
+    if((NULL != info) && ((info->colours < 16) || (info->colours > 256))) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(NULL == (pw = io_writer_new(sizeof(pcx_writer_t), io, info))) {
+        return NULL;
+    }
+    pw->w.rows = pcx_writer_rows;
+    pw->w.finish = pcx_writer_finish;
+
+    pcx_make_header(&pw->pcx, info->width, info->height, info->colours, info->pal);
+    size_t bpl = pw->pcx.bytes_per_line;
+
+    // the encoded lines are collected into a band sized buffer before being written, with 
+    // room for the header at the start
+    size_t cap = IO_BAND_SIZE + (bpl * 2);
+    if((NULL == (pw->line = io_calloc(1, bpl))) || (NULL == (pw->out.data = io_malloc(cap)))) {
+        rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+    pw->out.len = cap;
+
+    memcpy(pw->out.data, &pw->pcx, sizeof(pcx_header_t));
+    pw->out.pos = sizeof(pcx_header_t);
+
+    return &pw->w;
+CLEANUP:
+    free_s(pw->out.data);
+    free_s(pw->line);
+    io_free(pw);
+    errno = rval;
+    return NULL;
+}
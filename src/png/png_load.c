@@ -1,13 +1,42 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <image_png.h>
 #include "png_priv.h"
+#include "../io/io_priv.h"
 #include <stdbool.h>
 #include <errno.h>
 #include <png.h>
+#include <memstream.h>
 
 #define PNG_BPP (1)
 pal_image_t *read_png(FILE *fp);
 
+/// @brief decodes a PNG using the supplied source into an image, reusing the storage of the
+///        image it is given when that is large enough
+/// @param dst pointer to the image to decode into, may point to NULL to allocate a new one
+/// @param io pointer to the source, a FILE * if read_fn is NULL, otherwise passed to read_fn
+/// @param read_fn libpng read callback, or NULL to use stdio
+/// @return 0 on success, otherwise an errno value
+static int png_decode(pal_image_t **dst, void *io, png_rw_ptr read_fn);
+
+/// @brief decodes into a newly allocated image, for the loaders that return one
+/// @return pointer to a pal_image_t structure containing the image, or null on error (errno is set)
+static pal_image_t *png_decode_new(void *io, png_rw_ptr read_fn);
+
+/// @brief libpng allocation callback, everything libpng allocates for a decode is released
+///        before the decode returns, so it can come from the scratch region
+static png_voidp png_scratch_alloc(png_structp png, png_alloc_size_t size);
+
+/// @brief libpng release callback, for memory from png_scratch_alloc()
+static void png_scratch_free(png_structp png, png_voidp ptr);
+
+/// @brief libpng read callback that pulls data from a memstream buffer
+static void png_mem_read(png_structp png, png_bytep data, size_t len);
+
+/// @brief libpng read callback that pulls data from an image_io_t stream
+static void png_io_read(png_structp png, png_bytep data, size_t len);
+
 pal_image_t *load_png(const char *fn) {
     int rval = 0;
     pal_image_t *img = NULL;
@@ -37,16 +66,111 @@ CLEANUP:
     return NULL;
 }
 
+pal_image_t *load_png_mem(const uint8_t *buf, size_t len) {
+    if(NULL == buf) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    // the decoder only ever reads from the source buffer
+    memstream_buf_t src = {.pos = 0, .len = len, .data = (uint8_t *)buf};
+    return png_decode_new(&src, png_mem_read);
+}
+
+pal_image_t *load_png_io(image_io_t *io) {
+    if((NULL == io) || (NULL == io->read)) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    // PNG is read strictly front to back, so the stream can be decoded as it arrives
+    return png_decode_new(io, png_io_read);
+}
+
 pal_image_t *read_png(FILE *fp) {
+    if(NULL == fp) {
+        errno = EBADF;
+        return NULL;
+    }
+    return png_decode_new(fp, NULL);
+}
+
+int load_png_into(pal_image_t **dst, const char *fn) {
+    FILE *fp = NULL;
+
+    if((NULL == dst) || (NULL == fn)) return EBADF;
+
+    // try to open input file
+    if(NULL == (fp = fopen(fn,"rb"))) {
+        return errno;  // can't open input file
+    }
+
+    int rval = png_decode(dst, fp, NULL);
+    fclose_s(fp);
+    return rval;
+}
+
+int load_png_mem_into(pal_image_t **dst, const uint8_t *buf, size_t len) {
+    if((NULL == dst) || (NULL == buf)) return EBADF;
+
+    // the decoder only ever reads from the source buffer
+    memstream_buf_t src = {.pos = 0, .len = len, .data = (uint8_t *)buf};
+    return png_decode(dst, &src, png_mem_read);
+}
+
+static pal_image_t *png_decode_new(void *io, png_rw_ptr read_fn) {
+    pal_image_t *img = NULL;
+
+    int rval = png_decode(&img, io, read_fn);
+    if(0 != rval) {
+        io_image_drop(img);
+        errno = rval;
+        return NULL;
+    }
+    return img;
+}
+
+static png_voidp png_scratch_alloc(png_structp png, png_alloc_size_t size) {
+    (void)png;
+    return io_scratch_alloc(size);
+}
+
+static void png_scratch_free(png_structp png, png_voidp ptr) {
+    (void)png;
+    io_free(ptr);
+}
+
+static void png_mem_read(png_structp png, png_bytep data, size_t len) {
+    memstream_buf_t *src = (memstream_buf_t *)png_get_io_ptr(png);
+    uint8_t *p = io_take(src, len);
+    if(NULL == p) {
+        png_error(png, "read past end of data");
+    }
+    memcpy(data, p, len);
+}
+
+static void png_io_read(png_structp png, png_bytep data, size_t len) {
+    image_io_t *io = (image_io_t *)png_get_io_ptr(png);
+    // streams may hand back less than we asked for, so keep reading until we have it all
+    while(0 < len) {
+        int64_t nr = io->read(io->user, data, len);
+        if(0 >= nr) {
+            png_error(png, "read error or unexpected end of stream");
+        }
+        data += nr;
+        len -= nr;
+    }
+}
+
+static int png_decode(pal_image_t **dst, void *io, png_rw_ptr read_fn) {
     int rval = 0;
     pal_image_t *img = NULL;
     png_structp png = NULL;
     png_infop info = NULL;
     png_bytep *row_pointers = NULL;
 
-    if(NULL == (png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL))) {
-        errno = ENOMEM; 
-        return NULL;
+    if(NULL == (png = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL, NULL, png_scratch_alloc, png_scratch_free))) {
+        return ENOMEM;
     }
 
     if(NULL == (info = png_create_info_struct(png))) {
@@ -61,7 +185,11 @@ pal_image_t *read_png(FILE *fp) {
         goto CLEANUP;
     }
 
-    png_init_io(png, fp);
+    if(NULL == read_fn) {
+        png_init_io(png, (FILE *)io);
+    } else {
+        png_set_read_fn(png, io, read_fn);
+    }
     png_read_info(png, info);
 
     if(PNG_COLOR_TYPE_PALETTE != png_get_color_type(png, info)) {
@@ -77,22 +205,22 @@ pal_image_t *read_png(FILE *fp) {
     size_t height = png_get_image_height(png, info);
     size_t width = png_get_image_width(png, info);
 
-    // allocate an image buffer, assuming a full 256 colour palette
-    if(NULL == (img = image_alloc(width, height, 256, 0))) {
-        rval = errno;
-        goto CLEANUP;
-    }
-
     int colours = 0;
     png_colorp palette = NULL;
-    png_get_PLTE(png, info, &palette, &colours);
+    if((0 == png_get_PLTE(png, info, &palette, &colours)) || (0 == colours)) {
+        rval = EINVAL; // a paletted image has to have a palette
+        goto CLEANUP;
+    }
 
-    for(int i = 0; i < colours; i++) {
-        img->pal[i].r = palette[i].red;
-        img->pal[i].g = palette[i].green;
-        img->pal[i].b = palette[i].blue;
+    // size the image to the palette we actually have, so a reused image with the
+    // same palette size is a match
+    if(0 != (rval = io_image_reuse(dst, width, height, colours))) {
+        goto CLEANUP;
     }
-    img->colours = colours; // update the colours value to reflect valid entries
+    img = *dst;
+
+    // png_color is laid out the same as our internal palette, so it's a straight copy
+    memcpy(img->pal, palette, colours * sizeof(png_color));
 
     // process tRNS here when transparency support is added to image
     png_bytep trans = NULL;
@@ -129,13 +257,172 @@ pal_image_t *read_png(FILE *fp) {
 
     png_free(png, row_pointers); // free the row pointers
     png_destroy_read_struct(&png, &info, NULL); // free the read and info contexts
-    return img;
+    return 0;
 CLEANUP:
-    image_free(img);
     if(NULL != png) {
         if(NULL != row_pointers) png_free(png, row_pointers); // free the row pointers
         png_destroy_read_struct(&png, &info, NULL); // finally free the png and info contexts
     }
+    return rval;
+}
+
+int load_png_scanlines(image_io_t *io, image_row_fn row, void *user) {
+    int rval = 0;
+    png_structp png = NULL;
+    png_infop info = NULL;
+    png_bytep volatile line = NULL;          // volatile, as they are changed after the setjmp
+    png_bytep * volatile row_pointers = NULL; // and freed after the longjmp
+    image_info_t ii;
+
+    if((NULL == io) || (NULL == io->read) || (NULL == row)) return EBADF;
+
+    if(NULL == (png = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL, NULL, png_scratch_alloc, png_scratch_free))) {
+        return ENOMEM;
+    }
+
+    if(NULL == (info = png_create_info_struct(png))) {
+        rval = ENOMEM;
+        goto CLEANUP;
+    }
+
+    // we didn't register callbacks, so we need to set up a point for
+    // for longjmp to land on error.
+    if (setjmp(png_jmpbuf(png))) {
+        rval = EFAULT;
+        goto CLEANUP;
+    }
+
+    png_set_read_fn(png, io, png_io_read);
+    png_read_info(png, info);
+
+    if(PNG_COLOR_TYPE_PALETTE != png_get_color_type(png, info)) {
+        rval = ENOTSUP;
+        goto CLEANUP;
+    }
+
+    if(8 != png_get_bit_depth(png, info)) {
+        rval = ENOTSUP;
+        goto CLEANUP;
+    }
+
+    memset(&ii, 0, sizeof(image_info_t));
+    ii.format = IMAGE_FMT_PNG;
+    ii.width = png_get_image_width(png, info);
+    ii.height = png_get_image_height(png, info);
+    ii.bits_per_pixel = 8;
+    ii.transparent = -1;
+
+    png_colorp palette = NULL;
+    if((0 == png_get_PLTE(png, info, &palette, &ii.colours)) || (0 == ii.colours)) {
+        rval = EINVAL; // a paletted image has to have a palette
+        goto CLEANUP;
+    }
+    memcpy(ii.pal, palette, ii.colours * sizeof(png_color)); // same layout as our palette
+
+    // find the FIRST fully transparent colour, as png_decode() does
+    png_bytep trans = NULL;
+    png_color_16p pngcol = NULL;
+    int tcols = 0;
+    if(PNG_INFO_tRNS == png_get_tRNS(png, info, &trans, &tcols, &pngcol)) {
+        for(int i = 0; i < tcols; i++) {
+            if(0 == trans[i]) {
+                ii.transparent = i;
+                break;
+            }
+        }
+    }
+
+    size_t width = ii.width * PNG_BPP;
+    if(PNG_INTERLACE_NONE == png_get_interlace_type(png, info)) {
+        // each row is final as soon as it is read, so one line is all we need
+        if(NULL == (line = png_malloc(png, width + 1))) {
+            rval = ENOMEM;
+            goto CLEANUP;
+        }
+        for(uint32_t y = 0; y < ii.height; y++) {
+            png_read_row(png, line, NULL);
+            if(0 != (rval = row(user, &ii, y, line))) goto CLEANUP;
+        }
+    } else {
+        // rows of an interlaced image aren't finished until the last pass, so we need all of them
+        if((NULL == (line = png_malloc(png, (width * ii.height) + 1))) ||
+           (NULL == (row_pointers = (png_bytep *)png_calloc(png, ii.height * sizeof(png_bytep))))) {
+            rval = ENOMEM;
+            goto CLEANUP;
+        }
+        for(uint32_t y = 0; y < ii.height; y++) {
+            row_pointers[y] = &line[y * width];
+        }
+        png_read_image(png, row_pointers);
+        for(uint32_t y = 0; y < ii.height; y++) {
+            if(0 != (rval = row(user, &ii, y, row_pointers[y]))) goto CLEANUP;
+        }
+    }
+
+    png_read_end(png, NULL);
+
+CLEANUP:
+    if(NULL != png) {
+        if(NULL != row_pointers) png_free(png, row_pointers); // free the row pointers
+        if(NULL != line) png_free(png, line);                 // free the line buffer
+        png_destroy_read_struct(&png, &info, NULL); // finally free the png and info contexts
+    }
+    return rval;
+}
+
+/// @brief the image being built by a scaled decode
+typedef struct {
+    pal_image_t *img; // the scaled image, allocated when the first line arrives
+    uint32_t scale;   // the image is 1/scale of the full size
+} png_scaled_t;
+
+/// @brief row callback for a scaled decode, keeps every scale'th pixel of every scale'th line
+static int png_scaled_row(void *user, const image_info_t *info, uint32_t y, const uint8_t *pixels) {
+    png_scaled_t *ps = (png_scaled_t *)user;
+    uint32_t ow = IO_SCALED(info->width, ps->scale);
+
+    if(NULL == ps->img) {
+        int rval = io_image_reuse(&ps->img, ow, IO_SCALED(info->height, ps->scale), info->colours);
+        if(0 != rval) return rval;
+        memcpy(ps->img->pal, info->pal, info->colours * sizeof(img_pal_entry_t));
+        ps->img->transparent = info->transparent;
+    }
+
+    if(0 == (y % ps->scale)) {
+        io_pick(&ps->img->pixels[(size_t)(y / ps->scale) * ow], pixels, ow, ps->scale);
+    }
+    return 0;
+}
+
+pal_image_t *load_png_scaled(const char *fn, int scale) {
+    int rval = 0;
+    io_file_t f = {.fp = NULL, .fd = -1};
+    png_scaled_t ps = {.img = NULL, .scale = scale};
+
+    if(NULL == fn) {
+        rval = EBADF;
+        goto CLEANUP;
+    }
+    if(!io_scale_ok(scale)) {
+        rval = EINVAL;
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = io_open_file(fn, &f))) {
+        goto CLEANUP;
+    }
+
+    // every row has to be inflated to get to the next, so it is only the full size 
+    // image that is saved. Rows are decoded one at a time into the same line
+    if(0 != (rval = load_png_scanlines(&f.io, png_scaled_row, &ps))) {
+        goto CLEANUP;
+    }
+
+    io_close_file(&f);
+    return ps.img;
+CLEANUP:
+    io_close_file(&f);
+    io_image_drop(ps.img);
     errno = rval;
     return NULL;
 }
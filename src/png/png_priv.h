@@ -12,10 +12,10 @@
 #define CA_IMG_PNG_INTERNAL
 
 #define fclose_s(A) if(A) fclose(A); A=NULL
-#define free_s(A) if(A) free(A); A=NULL
+#define free_s(A) if(A) io_free(A); A=NULL
 
 #define PNG_SIG "PNG"
-#define PNG_FULL_SIG "\x89PNG\x0d\x0a\xa1\x0a"
+#define PNG_FULL_SIG "\x89PNG\x0d\x0a\x1a\x0a"
 
 // these are the chunk identifiers we are intersted in
 // for the images we work with They must appear in the 
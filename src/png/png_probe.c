@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <string.h>
+#include <image_png.h>
+#include "png_priv.h"
+#include "../io/io_priv.h"
+#include <stdbool.h>
+#include <errno.h>
+
+#define PNG_COLOUR_PALETTE (3) // colour type for paletted images
+
+/// @brief converts a big endian (network order) 32 bit value
+static uint32_t png_be32(const void *p) {
+    const uint8_t *b = (const uint8_t *)p;
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+int probe_png(const char *fn, image_info_t *info) {
+    if((NULL == fn) || (NULL == info)) return EBADF;
+    return io_probe_file(fn, info, probe_png_io);
+}
+
+int probe_png_io(image_io_t *io, image_info_t *info) {
+    uint8_t buf[256 * sizeof(png_palette_entry_t)];
+
+    if((NULL == io) || (NULL == info)) return EBADF;
+
+    png_header_t sig;
+    if((0 != io_read_exact(io, &sig, sizeof(png_header_t))) ||
+       (0 != memcmp(&sig, PNG_FULL_SIG, sizeof(png_header_t)))) {
+        return EINVAL; // not a PNG file
+    }
+
+    memset(info, 0, sizeof(image_info_t));
+    info->format = IMAGE_FMT_PNG;
+    info->transparent = -1;
+    uint64_t pos = sizeof(png_header_t);
+
+    // walk the chunks until we reach the image data, we only need to look inside
+    // IHDR, PLTE and tRNS, everything else is skipped over
+    bool have_ihdr = false;
+    while(true) {
+        png_chunk_t chunk;
+        if(0 != io_read_exact(io, &chunk, sizeof(png_chunk_t))) {
+            return EINVAL; // ran out before the image data
+        }
+        uint32_t len = png_be32(&chunk.length);
+        pos += sizeof(png_chunk_t);
+
+        if(0 == memcmp(chunk.type_id, PNG_IDAT, 4)) {
+            if(!have_ihdr) return EINVAL;
+            info->pixel_offset = pos;
+            return 0;
+        }
+
+        if(0 == memcmp(chunk.type_id, PNG_IHDR, 4)) {
+            png_ihdr_t ihdr;
+            if((sizeof(png_ihdr_t) != len) || (0 != io_read_exact(io, &ihdr, sizeof(png_ihdr_t)))) {
+                return EINVAL;
+            }
+
+            // we only support 8 bit paletted images
+            if((PNG_COLOUR_PALETTE != ihdr.colour_type) || (8 != ihdr.bit_depth)) {
+                return ENOTSUP;
+            }
+
+            info->width = png_be32(&ihdr.width);
+            info->height = png_be32(&ihdr.height);
+            info->bits_per_pixel = ihdr.bit_depth;
+            have_ihdr = true;
+        } else if((0 == memcmp(chunk.type_id, PNG_PLTE, 4)) && (len <= sizeof(buf)) && (0 == (len % 3))) {
+            if(0 != io_read_exact(io, buf, len)) {
+                return EINVAL;
+            }
+            // PLTE entries are RGB, laid out the same as our internal palette
+            info->colours = len / 3;
+            memcpy(info->pal, buf, len);
+        } else if((0 == memcmp(chunk.type_id, PNG_tRNS, 4)) && (len <= 256)) {
+            if(0 != io_read_exact(io, buf, len)) {
+                return EINVAL;
+            }
+            // scan and find FIRST fully transparent colour
+            for(uint32_t i = 0; i < len; i++) {
+                if(0 == buf[i]) {
+                    info->transparent = i;
+                    break;
+                }
+            }
+        } else { // not interested, skip the data
+            if(!have_ihdr) return EINVAL; // IHDR must be the first chunk
+            if(0 > io_seek(io, len, SEEK_CUR)) {
+                return errno;
+            }
+        }
+
+        // skip the CRC
+        if(0 > io_seek(io, 4, SEEK_CUR)) {
+            return errno;
+        }
+        pos += len + 4;
+    }
+}
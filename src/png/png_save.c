@@ -1,12 +1,42 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <image_png.h>
 #include "png_priv.h"
+#include "../io/io_priv.h"
 #include <stdbool.h>
 #include <errno.h>
 #include <png.h>
+#include <memstream.h>
 
 int write_png(FILE *fp, pal_image_t *img);
 
+/// @brief encodes a PNG to the supplied destination
+/// @param io pointer to the destination, a FILE * if write_fn is NULL, otherwise passed to write_fn
+/// @param write_fn libpng write callback, or NULL to use stdio
+/// @param img pointer to the pal_image_t structure containing the image
+/// @return 0 on success otherwise an error value
+static int png_encode(void *io, png_rw_ptr write_fn, pal_image_t *img);
+
+/// @brief libpng allocation callback for a whole image encoded in one call, where everything
+///        libpng allocates is released before the call returns
+static png_voidp png_scratch_alloc(png_structp png, png_alloc_size_t size);
+
+/// @brief libpng allocation callback for a writer, which keeps its memory between calls
+static png_voidp png_heap_alloc(png_structp png, png_alloc_size_t size);
+
+/// @brief libpng release callback, for memory from either of the allocation callbacks
+static void png_heap_free(png_structp png, png_voidp ptr);
+
+/// @brief libpng write callback that appends data to a growable memstream buffer
+static void png_mem_write(png_structp png, png_bytep data, size_t len);
+
+/// @brief libpng write callback that sends data to an image_io_t stream
+static void png_io_write(png_structp png, png_bytep data, size_t len);
+
+/// @brief libpng flush callback, nothing to do for memory or image_io_t streams
+static void png_mem_flush(png_structp png);
+
 int save_png(const char *fn, pal_image_t *img) {
     int rval = 0;
     FILE *fp = NULL;
@@ -23,14 +53,92 @@ int save_png(const char *fn, pal_image_t *img) {
 
     rval = write_png(fp, img);
 
-    rval = 0;
 CLEANUP:
     fclose_s(fp);
     return rval;
 }
 
-#define PNG_BPP (1)
+int save_png_mem(pal_image_t *img, uint8_t **buf, size_t *len) {
+    if((NULL == img) || (NULL == buf) || (NULL == len)) return EBADF;
+
+    if((0 == img->width) || (0 == img->height) || (0 == img->colours)) return EINVAL;
+
+    // start with a guess of the raw image size, it will grow if the compression is poor
+    memstream_buf_t dst = {.pos = 0, .len = (size_t)img->width * img->height + 1024, .data = NULL};
+    if(NULL == (dst.data = malloc(dst.len))) {
+        return errno;  // unable to allocate mem
+    }
+
+    int rval = png_encode(&dst, png_mem_write, img);
+    if(0 != rval) {
+        free(dst.data); // the buffer is for the caller, so it comes from malloc()
+        return rval;
+    }
+
+    *buf = dst.data;
+    *len = dst.pos;
+    return 0;
+}
+
+int save_png_io(image_io_t *io, pal_image_t *img) {
+    if((NULL == img) || (NULL == io) || (NULL == io->write)) return EBADF;
+
+    if((0 == img->width) || (0 == img->height) || (0 == img->colours)) return EINVAL;
+
+    return png_encode(io, png_io_write, img);
+}
+
 int write_png(FILE *fp, pal_image_t *img) {
+    // make sure we have an open file
+    if(NULL == fp) {
+        return EBADF;
+    }
+    return png_encode(fp, NULL, img);
+}
+
+static png_voidp png_scratch_alloc(png_structp png, png_alloc_size_t size) {
+    (void)png;
+    return io_scratch_alloc(size);
+}
+
+static png_voidp png_heap_alloc(png_structp png, png_alloc_size_t size) {
+    (void)png;
+    return io_malloc(size);
+}
+
+static void png_heap_free(png_structp png, png_voidp ptr) {
+    (void)png;
+    io_free(ptr);
+}
+
+static void png_mem_write(png_structp png, png_bytep data, size_t len) {
+    memstream_buf_t *dst = (memstream_buf_t *)png_get_io_ptr(png);
+    if(len > (dst->len - dst->pos)) { // need to grow the buffer
+        size_t nlen = dst->len * 2;
+        if(nlen < (dst->pos + len)) nlen = dst->pos + len;
+        uint8_t *ndata = realloc(dst->data, nlen);
+        if(NULL == ndata) {
+            png_error(png, "out of memory");
+        }
+        dst->data = ndata;
+        dst->len = nlen;
+    }
+    memcpy(&dst->data[dst->pos], data, len);
+    dst->pos += len;
+}
+
+static void png_io_write(png_structp png, png_bytep data, size_t len) {
+    if(0 != io_write_all((image_io_t *)png_get_io_ptr(png), data, len)) {
+        png_error(png, "write error");
+    }
+}
+
+static void png_mem_flush(png_structp png) {
+    (void)png;
+}
+
+#define PNG_BPP (1)
+static int png_encode(void *io, png_rw_ptr write_fn, pal_image_t *img) {
     int rval = 0;
     png_structp png = NULL;
     png_infop   info = NULL;
@@ -38,13 +146,8 @@ int write_png(FILE *fp, pal_image_t *img) {
     png_bytep   trans = NULL;
     png_bytep   *row_pointers = NULL;
 
-    // make sure we have an open file
-    if(NULL == fp) {
-        return EBADF;
-    }
-
     // initialize the PNG stuct
-    if(NULL == (png = png_create_write_struct(PNG_LIBPNG_VER_STRING,NULL,NULL,NULL))) {
+    if(NULL == (png = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL, NULL, png_scratch_alloc, png_heap_free))) {
         return ENOMEM;
     }
 
@@ -61,8 +164,11 @@ int write_png(FILE *fp, pal_image_t *img) {
         goto CLEANUP;
     }
 
-    // use stdio stream
-    png_init_io(png, fp);
+    if(NULL == write_fn) { // use stdio stream
+        png_init_io(png, (FILE *)io);
+    } else {
+        png_set_write_fn(png, io, write_fn, png_mem_flush);
+    }
 
     // set the image info here
     png_set_IHDR(png, info, img->width, img->height, 8,
@@ -75,11 +181,8 @@ int write_png(FILE *fp, pal_image_t *img) {
         goto CLEANUP;
     }
     
-    for(int i=0; i<img->colours; i++) {
-        palette[i].red = img->pal[i].r;
-        palette[i].green = img->pal[i].g;
-        palette[i].blue = img->pal[i].b;
-    }
+    // png_color is laid out the same as our internal palette, so it's a straight copy
+    memcpy(palette, img->pal, img->colours * sizeof(png_color));
 
     png_set_PLTE(png, info, palette, img->colours);
 
@@ -129,3 +232,106 @@ CLEANUP:
     }
     return rval;
 }
+
+/// @brief the state of a PNG being written a few rows at a time
+typedef struct {
+    image_writer_t w;  // must be first
+    png_structp png;   // libpng write state
+    png_infop   pinfo; // libpng image info
+} png_writer_t;
+
+static int png_writer_rows(image_writer_t *w, const uint8_t *pixels, uint32_t count) {
+    png_writer_t *pw = (png_writer_t *)w;
+
+    if(setjmp(png_jmpbuf(pw->png))) {
+        return EFAULT;
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        png_write_row(pw->png, (png_const_bytep)&pixels[(size_t)i * w->info.width * PNG_BPP]);
+    }
+    return 0;
+}
+
+/// @brief writes the end of the PNG, kept apart so nothing local lives across the setjmp
+static int png_writer_end(png_writer_t *pw) {
+    if(setjmp(png_jmpbuf(pw->png))) {
+        return EFAULT;
+    }
+
+    png_write_end(pw->png, pw->pinfo);
+    return 0;
+}
+
+static int png_writer_finish(image_writer_t *w, bool complete) {
+    png_writer_t *pw = (png_writer_t *)w;
+    int rval = complete ? png_writer_end(pw) : 0;
+
+    png_destroy_write_struct(&pw->png, &pw->pinfo);
+    io_free(pw);
+    return rval;
+}
+
+image_writer_t *save_png_begin(image_io_t *io, const image_info_t *info) {
+    int rval = 0;
+    png_writer_t *pw = NULL;
+    png_color palette[256];
+    png_byte  trans[256];
+
+    if((NULL != info) && (info->colours > 256)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(NULL == (pw = io_writer_new(sizeof(png_writer_t), io, info))) {
+        return NULL;
+    }
+    pw->w.rows = png_writer_rows;
+    pw->w.finish = png_writer_finish;
+
+    // initialize the PNG stuct
+    if(NULL == (pw->png = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL, NULL, png_heap_alloc, png_heap_free))) {
+        rval = ENOMEM;
+        goto CLEANUP;
+    }
+
+    // allocate+initialize the info struct
+    if(NULL == (pw->pinfo = png_create_info_struct(pw->png))) {
+        rval = ENOMEM;
+        goto CLEANUP;
+    }
+
+    // each call that goes into libpng sets its own landing point
+    if(setjmp(png_jmpbuf(pw->png))) {
+        rval = EFAULT;
+        goto CLEANUP;
+    }
+
+    png_set_write_fn(pw->png, io, png_io_write, png_mem_flush);
+
+    // set the image info here
+    png_set_IHDR(pw->png, pw->pinfo, info->width, info->height, 8,
+        PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+
+    // libpng takes its own copy of the palette and transparency
+    memcpy(palette, info->pal, info->colours * sizeof(png_color));
+    png_set_PLTE(pw->png, pw->pinfo, palette, info->colours);
+
+    if((0 <= info->transparent) && (info->transparent < info->colours)) {
+        for(int i = 0; i < info->colours; i++) {
+            trans[i] = (i == info->transparent)?0:255;
+        }
+        // only need to store up to (and including) the transparent colour
+        png_set_tRNS(pw->png, pw->pinfo, trans, info->transparent + 1, NULL);
+    }
+
+    png_write_info(pw->png, pw->pinfo);
+
+    return &pw->w;
+CLEANUP:
+    if(NULL != pw->png) png_destroy_write_struct(&pw->png, &pw->pinfo);
+    io_free(pw);
+    errno = rval;
+    return NULL;
+}
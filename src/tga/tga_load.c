@@ -1,132 +1,365 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "tga_priv.h"
+#include "../io/io_priv.h"
 #include <image_tga.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <memstream.h>
+
+/// @brief decodes a TGA file held in memory into an image, reusing the storage of the
+///        image it is given when that is large enough
+/// @param dst pointer to the image to decode into, may point to NULL to allocate a new one
+/// @param buf pointer to the start of the TGA file data
+/// @param len length of the TGA file data in bytes
+/// @return 0 on success, otherwise an errno value
+static int tga_decode(pal_image_t **dst, const uint8_t *buf, size_t len);
 
 pal_image_t *load_tga(const char *fn) {
     int rval = 0;
+    io_file_t f = {.fp = NULL, .fd = -1};
+    tga_header_t tga;
+    image_info_t info;
     pal_image_t *img = NULL;
-    FILE *fp = NULL;
-    tga_palette_entry_t *pal = NULL;
 
     if(NULL == fn) {
         rval = EBADF;
         goto CLEANUP;
     }
 
-    // try to open input file
-    if(NULL == (fp = fopen(fn,"rb"))) {
-        rval = errno;  // can't open input file
+    if(0 != (rval = io_open_file(fn, &f))) {
         goto CLEANUP;
     }
 
-    // read the footer from the end of the file to check the signature
-    tga_footer_t tgaf;
-    memset(&tgaf, 0, sizeof(tga_footer_t));
+    // check the signature in the footer, then read the header and palette from the start
+    if((0 != (rval = tga_check_footer(&f.io))) || (0 != (rval = tga_read_header(&f.io, &tga, &info)))) {
+        goto CLEANUP;
+    }
 
-    fseek(fp, -sizeof(tga_footer_t), SEEK_END);
-    int nr = fread(&tgaf, sizeof(tga_footer_t), 1, fp);
-    if(1 != nr) {
+    if(NULL == (img = io_image_new(info.width, info.height, info.colours))) {
         rval = errno;
         goto CLEANUP;
     }
+    memcpy(img->pal, info.pal, info.colours * sizeof(img_pal_entry_t));
+    img->transparent = info.transparent;
 
-    if(0 != strncmp(tgaf.sig, TGA_SIG, 18)) {
-        rval = EINVAL;
+    // the image follows the palette, and is read straight into the pixels. The footer has
+    // to come after it, otherwise it was read as part of a truncated image
+    int64_t pos = 0;
+    if((0 != io_read_rows(&f.io, img, info.width, false)) || (0 > (pos = io_seek(&f.io, 0, SEEK_CUR))) ||
+       ((pos + (int64_t)sizeof(tga_footer_t)) > io_seek(&f.io, 0, SEEK_END))) {
+        rval = EINVAL; // truncated image
         goto CLEANUP;
     }
 
-    // go back to the start of the file and read in the header
-    tga_header_t tga;
-    memset(&tga, 0, sizeof(tga_header_t));
+    io_close_file(&f);
+    return img;
+CLEANUP:
+    io_close_file(&f);
+    if(NULL != img) io_image_drop(img);
+    errno = rval;
+    return NULL;
+}
 
-    fseek(fp, 0, SEEK_SET);
-    nr = fread(&tga, sizeof(tga_header_t), 1, fp);
-    if(1 != nr) {
-        rval = errno;
+pal_image_t *load_tga_io(image_io_t *io) {
+    int rval = 0;
+    pal_image_t *img = NULL;
+    uint8_t *buf = NULL;
+    size_t len = 0;
+
+    if(NULL == io) {
+        rval = EBADF;
         goto CLEANUP;
     }
 
-    // must be a paletteted image
-    if((1 != tga.colour_map_type) || (1 != tga.image_type)) {
-        rval = ENOTSUP;
+    // the stream may not be able to seek, so buffer all of it up front
+    if(0 != (rval = io_read_all(io, &buf, &len))) {
         goto CLEANUP;
     }
 
-    // we only accept 8 bit palettes
-    if(256 < (tga.cmap.colour_map_start + tga.cmap.colour_map_length)) {
-        rval = ENOTSUP;
+    if(NULL == (img = load_tga_mem(buf, len))) {
+        rval = errno;
         goto CLEANUP;
     }
 
-    // we only accept 24 and 32 bit colour maps (RGB and ARGB)
-    if((24 != tga.cmap.colour_map_depth) && (32 != tga.cmap.colour_map_depth)) {
-        rval = ENOTSUP;
+    free_s(buf);
+    return img;
+CLEANUP:
+    free_s(buf);
+    errno = rval;
+    return NULL;
+}
+
+pal_image_t *load_tga_mmap(const char *fn) {
+    int rval = 0;
+    pal_image_t *img = NULL;
+    io_map_t map = {NULL, 0, 0};
+
+    if(NULL == fn) {
+        rval = EBADF;
         goto CLEANUP;
     }
 
-    if(NULL == (img = image_alloc(tga.image.width, tga.image.height, tga.cmap.colour_map_start + tga.cmap.colour_map_length, 0))) {
+    // map the file, the header and palette are checked in place and the 
+    // pixels are copied straight out of the mapped pages
+    if(0 != (rval = io_map_file(fn, &map))) {
+        goto CLEANUP;
+    }
+
+    if(NULL == (img = load_tga_mem(map.data, map.len))) {
         rval = errno;
         goto CLEANUP;
     }
 
-    // seek past any additional id data that may be after the header
-    fseek(fp, sizeof(tga_header_t) + tga.id_length, SEEK_SET);
+    io_unmap_file(&map);
+    return img;
+CLEANUP:
+    io_unmap_file(&map);
+    errno = rval;
+    return NULL;
+}
 
-    // allocate the palette buffer
-    int pal_entry_size = tga.cmap.colour_map_depth / 8;
-    if(NULL == (pal = calloc(tga.cmap.colour_map_length, pal_entry_size))) {
-        rval = errno;
+pal_image_t *load_tga_mem(const uint8_t *buf, size_t len) {
+    pal_image_t *img = NULL;
+
+    int rval = tga_decode(&img, buf, len);
+    if(0 != rval) {
+        io_image_drop(img);
+        errno = rval;
+        return NULL;
+    }
+    return img;
+}
+
+int load_tga_into(pal_image_t **dst, const char *fn) {
+    int rval = 0;
+    io_map_t map = {NULL, 0, 0};
+
+    if((NULL == dst) || (NULL == fn)) return EBADF;
+
+    // map rather than read, so there is no file buffer to allocate for each frame
+    if(0 != (rval = io_map_file(fn, &map))) return rval;
+    rval = tga_decode(dst, map.data, map.len);
+    io_unmap_file(&map);
+    return rval;
+}
+
+int load_tga_mem_into(pal_image_t **dst, const uint8_t *buf, size_t len) {
+    if(NULL == dst) return EBADF;
+    return tga_decode(dst, buf, len);
+}
+
+pal_image_t *load_tga_rect(const char *fn, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    int rval = 0;
+    io_file_t f = {.fp = NULL, .fd = -1};
+    tga_header_t tga;
+    image_info_t info;
+    pal_image_t *img = NULL;
+
+    if(NULL == fn) {
+        rval = EBADF;
         goto CLEANUP;
     }
 
-    // read the palette
-    nr = fread(pal, pal_entry_size, tga.cmap.colour_map_length, fp);
-    if(nr != tga.cmap.colour_map_length) {
-        rval = errno;  // can't read file
+    if(0 != (rval = io_open_file(fn, &f))) {
         goto CLEANUP;
     }
 
-    if(3 == pal_entry_size) { // RGB data
-        tga_rgb_palette_entry_t *ipal = &pal->rgb;
-        for(int i = 0; i < tga.cmap.colour_map_length; i++) {
-            img->pal[tga.cmap.colour_map_start + i].r = ipal[i].r;
-            img->pal[tga.cmap.colour_map_start + i].g = ipal[i].g;
-            img->pal[tga.cmap.colour_map_start + i].b = ipal[i].b;
-        }
-    } else { // ARGB data
-        tga_argb_palette_entry_t *ipal = &pal->argb;
-        int first_trans = tga.cmap.colour_map_length;
-        for(int i = 0; i < tga.cmap.colour_map_length; i++) {
-            img->pal[tga.cmap.colour_map_start + i].r = ipal[i].r;
-            img->pal[tga.cmap.colour_map_start + i].g = ipal[i].g;
-            img->pal[tga.cmap.colour_map_start + i].b = ipal[i].b;
-            if((0 == ipal[i].a) && (i < first_trans)) first_trans = i; // capture the first transparent value
-        }
-        if(first_trans == tga.cmap.colour_map_length) { // no fully transparent entry found
-            first_trans = -1;
-        } else { // we have an index
-            first_trans += tga.cmap.colour_map_start; // correct for the start offset
+    if((0 != (rval = tga_check_footer(&f.io))) || (0 != (rval = tga_read_header(&f.io, &tga, &info)))) {
+        goto CLEANUP;
+    }
+
+    // the rectangle has to be inside the image
+    if((0 == w) || (0 == h) || (x >= info.width) || (y >= info.height) || 
+       (w > (info.width - x)) || (h > (info.height - y))) {
+        rval = EINVAL;
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = io_image_reuse(&img, w, h, info.colours))) {
+        goto CLEANUP;
+    }
+    memcpy(img->pal, info.pal, info.colours * sizeof(img_pal_entry_t));
+    img->transparent = info.transparent;
+
+    // the lines have no padding and are in the same order load_tga() gives them, 
+    // so each one is a single seek and read straight into the image
+    for(uint32_t i = 0; i < h; i++) {
+        int64_t pos = (int64_t)info.pixel_offset + ((int64_t)(y + i) * info.width) + x;
+        if((0 > io_seek(&f.io, pos, SEEK_SET)) || (0 != io_read_exact(&f.io, &img->pixels[(size_t)i * w], w))) {
+            rval = EINVAL; // truncated image
+            goto CLEANUP;
         }
-        img->transparent = first_trans;
     }
 
-    // read the image
-    nr = fread(img->pixels, img->width, img->height, fp);
-    if(nr != img->height) {
-        rval = errno;  // can't read file
+    io_close_file(&f);
+    return img;
+CLEANUP:
+    io_close_file(&f);
+    if(NULL != img) io_image_drop(img);
+    errno = rval;
+    return NULL;
+}
+
+pal_image_t *load_tga_scaled(const char *fn, int scale) {
+    int rval = 0;
+    io_file_t f = {.fp = NULL, .fd = -1};
+    tga_header_t tga;
+    image_info_t info;
+    pal_image_t *img = NULL;
+    uint8_t *line = NULL;
+
+    if(NULL == fn) {
+        rval = EBADF;
+        goto CLEANUP;
+    }
+    if(!io_scale_ok(scale)) {
+        rval = EINVAL;
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = io_open_file(fn, &f))) {
+        goto CLEANUP;
+    }
+
+    if((0 != (rval = tga_check_footer(&f.io))) || (0 != (rval = tga_read_header(&f.io, &tga, &info)))) {
+        goto CLEANUP;
+    }
+
+    uint32_t ow = IO_SCALED(info.width, scale);
+    uint32_t oh = IO_SCALED(info.height, scale);
+
+    // only read as far into each line as the last pixel we pick
+    uint32_t nbytes = ((ow - 1) * scale) + 1;
+    if(NULL == (line = io_scratch_alloc(nbytes))) {
+        rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = io_image_reuse(&img, ow, oh, info.colours))) {
         goto CLEANUP;
     }
+    memcpy(img->pal, info.pal, info.colours * sizeof(img_pal_entry_t));
+    img->transparent = info.transparent;
 
-    free_s(pal);
-    fclose_s(fp);
+    // the lines have no padding, so the ones we skip are never read
+    for(uint32_t i = 0; i < oh; i++) {
+        int64_t pos = (int64_t)info.pixel_offset + ((int64_t)i * scale * info.width);
+        if((0 > io_seek(&f.io, pos, SEEK_SET)) || (0 != io_read_exact(&f.io, line, nbytes))) {
+            rval = EINVAL; // truncated image
+            goto CLEANUP;
+        }
+        io_pick(&img->pixels[(size_t)i * ow], line, ow, scale);
+    }
+
+    free_s(line);
+    io_close_file(&f);
     return img;
 CLEANUP:
-    fclose_s(fp);
-    image_free(img);
-    free_s(pal);
+    free_s(line);
+    io_close_file(&f);
+    if(NULL != img) io_image_drop(img);
     errno = rval;
     return NULL;
 }
+
+static int tga_decode(pal_image_t **dst, const uint8_t *buf, size_t len) {
+    int rval = 0;
+    pal_image_t *img = NULL;
+
+    if(NULL == buf) {
+        rval = EBADF;
+        goto CLEANUP;
+    }
+
+    if(len < (sizeof(tga_header_t) + sizeof(tga_footer_t))) {
+        rval = EINVAL; // too short to be a TGA file
+        goto CLEANUP;
+    }
+
+    // the decoder only ever reads from the source buffer
+    memstream_buf_t src = {.pos = 0, .len = len, .data = (uint8_t *)buf};
+
+    // check the signature in the footer at the end of the file
+    tga_footer_t tgaf;
+    memcpy(&tgaf, &buf[len - sizeof(tga_footer_t)], sizeof(tga_footer_t));
+
+    if(0 != strncmp(tgaf.sig, TGA_SIG, 18)) {
+        rval = EINVAL;
+        goto CLEANUP;
+    }
+
+    // the footer isn't part of the image data
+    src.len -= sizeof(tga_footer_t);
+
+    // read in the header from the start of the file
+    tga_header_t tga;
+    memcpy(&tga, io_take(&src, sizeof(tga_header_t)), sizeof(tga_header_t));
+
+    // make sure it's in a format we can work with
+    if(0 != (rval = tga_check_header(&tga))) {
+        goto CLEANUP;
+    }
+
+    // skip past any additional id data that may be after the header
+    if(NULL == io_take(&src, tga.id_length)) {
+        rval = EINVAL;
+        goto CLEANUP;
+    }
+
+    // the palette follows the id data
+    int pal_entry_size = tga.cmap.colour_map_depth / 8;
+    tga_palette_entry_t *pal = (tga_palette_entry_t *)io_take(&src, (size_t)pal_entry_size * tga.cmap.colour_map_length);
+    if(NULL == pal) {
+        rval = EINVAL; // truncated palette
+        goto CLEANUP;
+    }
+
+    // and the image follows the palette
+    uint8_t *pixels = io_take(&src, (size_t)tga.image.width * tga.image.height);
+    if(NULL == pixels) {
+        rval = EINVAL; // truncated image
+        goto CLEANUP;
+    }
+
+    if(0 != (rval = io_image_reuse(dst, tga.image.width, tga.image.height, tga.cmap.colour_map_start + tga.cmap.colour_map_length))) {
+        goto CLEANUP;
+    }
+    img = *dst;
+
+    if(3 == pal_entry_size) { // RGB data
+        image_pal_from_bgr(&img->pal[tga.cmap.colour_map_start], (const uint8_t *)pal, tga.cmap.colour_map_length);
+    } else { // ARGB data, capturing the first transparent value
+        int first_trans = image_pal_from_bgra(&img->pal[tga.cmap.colour_map_start], (const uint8_t *)pal, tga.cmap.colour_map_length);
+        if(0 <= first_trans) { // we have an index
+            first_trans += tga.cmap.colour_map_start; // correct for the start offset
+        }
+        img->transparent = first_trans;
+    }
+
+    // copy the image
+    memcpy(img->pixels, pixels, (size_t)img->width * img->height);
+
+CLEANUP:
+    return rval;
+}
+
+int tga_check_header(const tga_header_t *tga) {
+    // must be a paletteted image
+    if((1 != tga->colour_map_type) || (1 != tga->image_type)) {
+        return ENOTSUP;
+    }
+
+    // we only accept 8 bit palettes
+    if(256 < (tga->cmap.colour_map_start + tga->cmap.colour_map_length)) {
+        return ENOTSUP;
+    }
+
+    // we only accept 24 and 32 bit colour maps (RGB and ARGB)
+    if((24 != tga->cmap.colour_map_depth) && (32 != tga->cmap.colour_map_depth)) {
+        return ENOTSUP;
+    }
+
+    return 0;
+}
@@ -12,7 +12,7 @@
 #define CA_IMG_TGA_INTERNAL
 
 #define fclose_s(A) if(A) fclose(A); A=NULL
-#define free_s(A) if(A) free(A); A=NULL
+#define free_s(A) if(A) io_free(A); A=NULL
 
 /**
  * TGA Notes:
@@ -103,4 +103,40 @@ typedef struct {
 
 #pragma pack(pop)
 
+/// @brief checks the header to make sure the TGA is in a format we can work with
+/// @param tga pointer to the header read from the file
+/// @return 0 if the TGA is supported, otherwise an error code
+int tga_check_header(const tga_header_t *tga);
+
+/// @brief checks the signature in the footer at the end of a TGA file, then returns the
+///        stream to where it was
+/// @param io pointer to the image_io_t to read from, which must be able to seek
+/// @return 0 if the signature is there, otherwise an error code
+int tga_check_footer(image_io_t *io);
+
+/// @brief reads the header, id and palette of a TGA from a stream, leaving the stream at
+///        the start of the image data
+/// @param io pointer to the image_io_t to read from
+/// @param tga pointer to receive the header read from the file
+/// @param info pointer to an image_info_t to fill in
+/// @return 0 on success, otherwise an error code
+int tga_read_header(image_io_t *io, tga_header_t *tga, image_info_t *info);
+
+// largest header we write, a header followed by a 256 entry 32 bit palette
+#define TGA_HDR_MAX (sizeof(tga_header_t) + (256 * sizeof(tga_argb_palette_entry_t)))
+
+/// @brief builds the header and palette for an 8 bit colour mapped TGA
+/// @param buf pointer to receive the header and palette, at least TGA_HDR_MAX bytes
+/// @param width width of the image in pixels
+/// @param height height of the image in pixels
+/// @param colours number of palette entries
+/// @param transparent index of the transparent colour, or -1 if none
+/// @param pal pointer to the palette
+/// @return number of bytes of buf used
+size_t tga_write_header(uint8_t *buf, uint16_t width, uint16_t height, int colours, int transparent, const img_pal_entry_t *pal);
+
+/// @brief builds the footer with the version 2 signature
+/// @param buf pointer to receive the footer, at least sizeof(tga_footer_t) bytes
+void tga_write_footer(uint8_t *buf);
+
 #endif
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+#include "tga_priv.h"
+#include "../io/io_priv.h"
+#include <image_tga.h>
+#include <stdbool.h>
+#include <errno.h>
+
+int probe_tga(const char *fn, image_info_t *info) {
+    if((NULL == fn) || (NULL == info)) return EBADF;
+    return io_probe_file(fn, info, probe_tga_io);
+}
+
+int probe_tga_io(image_io_t *io, image_info_t *info) {
+    int rval = 0;
+    tga_header_t tga;
+
+    if((NULL == io) || (NULL == info)) return EBADF;
+
+    if(0 != (rval = tga_check_footer(io))) {
+        return rval;
+    }
+    return tga_read_header(io, &tga, info);
+}
+
+int tga_check_footer(image_io_t *io) {
+    // where the file starts, so we can come back to it after checking the footer
+    int64_t start = io_seek(io, 0, SEEK_CUR);
+    if(0 > start) {
+        return errno; // need to be able to seek to get to the footer
+    }
+
+    // read the footer from the end of the file to check the signature
+    tga_footer_t tgaf;
+    if(0 > io_seek(io, -(int64_t)sizeof(tga_footer_t), SEEK_END)) {
+        return EINVAL; // too short to have a footer
+    }
+    if(0 != io_read_exact(io, &tgaf, sizeof(tga_footer_t))) {
+        return EINVAL;
+    }
+
+    if(0 != strncmp(tgaf.sig, TGA_SIG, 18)) {
+        return EINVAL;
+    }
+
+    // go back to the start of the file
+    if(0 > io_seek(io, start, SEEK_SET)) {
+        return errno;
+    }
+    return 0;
+}
+
+int tga_read_header(image_io_t *io, tga_header_t *tga, image_info_t *info) {
+    int rval = 0;
+    tga_palette_entry_t pal[256];
+
+    // read in the header
+    if(0 != io_read_exact(io, tga, sizeof(tga_header_t))) {
+        return EINVAL;
+    }
+
+    // make sure it's in a format we can work with
+    if(0 != (rval = tga_check_header(tga))) {
+        return rval;
+    }
+
+    // skip past any additional id data that may be after the header
+    if(0 != io_skip(io, tga->id_length)) {
+        return EINVAL;
+    }
+
+    // read the palette
+    int pal_entry_size = tga->cmap.colour_map_depth / 8;
+    if(0 != io_read_exact(io, pal, (size_t)pal_entry_size * tga->cmap.colour_map_length)) {
+        return EINVAL; // truncated palette
+    }
+
+    memset(info, 0, sizeof(image_info_t));
+    info->format = IMAGE_FMT_TGA;
+    info->width = tga->image.width;
+    info->height = tga->image.height;
+    info->bits_per_pixel = tga->image.pixel_depth;
+    info->colours = tga->cmap.colour_map_start + tga->cmap.colour_map_length;
+    info->transparent = -1;
+    info->pixel_offset = sizeof(tga_header_t) + tga->id_length + ((size_t)pal_entry_size * tga->cmap.colour_map_length);
+
+    if(3 == pal_entry_size) { // RGB data
+        image_pal_from_bgr(&info->pal[tga->cmap.colour_map_start], (const uint8_t *)pal, tga->cmap.colour_map_length);
+    } else { // ARGB data, capturing the first transparent value
+        int first_trans = image_pal_from_bgra(&info->pal[tga->cmap.colour_map_start], (const uint8_t *)pal, tga->cmap.colour_map_length);
+        if(0 <= first_trans) info->transparent = tga->cmap.colour_map_start + first_trans;
+    }
+
+    return 0;
+}
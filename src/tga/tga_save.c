@@ -1,29 +1,104 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "tga_priv.h"
+#include "../io/io_priv.h"
 #include <image_tga.h>
 #include <stdbool.h>
 #include <errno.h>
 
+/// @brief encodes an image as an 8 bit TGA into a list of pieces to be written
+/// @param img pointer to the pal_image_t structure containing the image
+/// @param segs pointer to an empty segment list to receive the pieces of the TGA file
+/// @return 0 on success otherwise an error value
+static int tga_encode(pal_image_t *img, io_segs_t *segs);
+
 /// @brief saves an image as an 8 bit TGA image
 /// @param fn pointer to the name of the file to save the image as
 /// @param img pointer to the pal_image_t structure containing the image
 /// @return 0 on success otherwise an error value
 int save_tga(const char *fn, pal_image_t *img) {
-    int rval = 0;
-    FILE *fp = NULL;
-    tga_palette_entry_t *pal = NULL;
+    io_segs_t segs = {0};
 
     if((NULL == img) || (NULL == fn)) return EBADF;
 
+    // build the pieces of the file, then send them out in one go
+    int rval = tga_encode(img, &segs);
+    if(0 == rval) {
+        rval = io_write_file(fn, &segs);
+    }
+
+    io_segs_free(&segs);
+    return rval;
+}
+
+/// @brief saves an image as an 8 bit TGA image to a stream
+/// @param io pointer to the image_io_t to write the TGA to
+/// @param img pointer to the pal_image_t structure containing the image
+/// @return 0 on success otherwise an error value
+int save_tga_io(image_io_t *io, pal_image_t *img) {
+    io_segs_t segs = {0};
+
+    if((NULL == img) || (NULL == io)) return EBADF;
+
+    // build the pieces of the file, then send them out in one go
+    int rval = tga_encode(img, &segs);
+    if(0 == rval) {
+        rval = io_write_segs(io, &segs);
+    }
+
+    io_segs_free(&segs);
+    return rval;
+}
+
+/// @brief encodes an image as an 8 bit TGA image in memory
+/// @param img pointer to the pal_image_t structure containing the image
+/// @param buf pointer to receive the allocated buffer holding the TGA file, release with free()
+/// @param len pointer to receive the length of the TGA file in bytes
+/// @return 0 on success otherwise an error value
+int save_tga_mem(pal_image_t *img, uint8_t **buf, size_t *len) {
+    io_segs_t segs = {0};
+
+    if((NULL == img) || (NULL == buf) || (NULL == len)) return EBADF;
+
+    int rval = tga_encode(img, &segs);
+    if(0 == rval) {
+        rval = io_segs_flatten(&segs, buf, len);
+    }
+
+    io_segs_free(&segs);
+    return rval;
+}
+
+static int tga_encode(pal_image_t *img, io_segs_t *segs) {
+    int rval = 0;
+
     if((0 == img->width) || (0 == img->height) || (0 == img->colours)) return EINVAL;
 
-    // try to open/create output file
-    if(NULL == (fp = fopen(fn,"wb"))) {
-        rval = errno;  // can't open/create output file
+    // the header is built in a buffer with room for at most a 256 entry palette
+    if(256 < img->colours) return EINVAL;
+
+    // the header, palette and footer are built in the scratch buffer, 
+    // the pixels need no conversion so they go straight from the image
+    size_t imgsz = (size_t)img->width * img->height;
+    if(NULL == (segs->buf = io_scratch_calloc(1, TGA_HDR_MAX + sizeof(tga_footer_t)))) {
+        rval = errno;  // unable to allocate mem
         goto CLEANUP;
     }
 
+    size_t hdrsz = tga_write_header(segs->buf, img->width, img->height, img->colours, img->transparent, img->pal);
+    tga_write_footer(&segs->buf[hdrsz]);
+
+    // header and palette, then the image, then the footer
+    if(0 != (rval = io_segs_add(segs, segs->buf, hdrsz))) goto CLEANUP;
+    if(0 != (rval = io_segs_add(segs, img->pixels, imgsz))) goto CLEANUP;
+    if(0 != (rval = io_segs_add(segs, &segs->buf[hdrsz], sizeof(tga_footer_t)))) goto CLEANUP;
+
+CLEANUP:
+    return rval;
+}
+
+size_t tga_write_header(uint8_t *buf, uint16_t width, uint16_t height, int colours, int transparent, const img_pal_entry_t *pal) {
     tga_header_t tga;
     memset(&tga, 0, sizeof(tga_header_t));
 
@@ -31,74 +106,32 @@ int save_tga(const char *fn, pal_image_t *img) {
     tga.image_type = TGA_PALETTED;
 
     tga.cmap.colour_map_start  = 0;
-    tga.cmap.colour_map_length = img->colours;
-    tga.cmap.colour_map_depth  = (0 > img->transparent)?24:32; // 24 or 32 if we have transparency
+    tga.cmap.colour_map_length = colours;
+    tga.cmap.colour_map_depth  = (0 > transparent)?24:32; // 24 or 32 if we have transparency
 
-    tga.image.width = img->width;
-    tga.image.height = img->height;
+    tga.image.width = width;
+    tga.image.height = height;
     tga.image.pixel_depth = 8;
 
-    // write the header
-    int nw = fwrite(&tga, sizeof(tga_header_t), 1, fp);
-    if(1 != nw) {
-        rval = errno;  // can't write file
-        goto CLEANUP;
-    }
-
     int pal_entry_size = tga.cmap.colour_map_depth / 8; // should result in 3 or 4
+    size_t palsz = (size_t)pal_entry_size * colours;
 
-    pal = calloc(img->colours, pal_entry_size);
-    if(NULL == pal) {
-        rval = errno;  // unable to allocate mem
-        goto CLEANUP;
-    }
+    // write the header
+    memcpy(buf, &tga, sizeof(tga_header_t));
 
     // copy the external RGB palette to the TGA BGR(A) palette
-    if(0 > img->transparent) { // no transparency, use RGB
-        tga_rgb_palette_entry_t *ipal = &pal->rgb;
-        for(int i = 0; i < img->colours; i++) {
-            ipal[i].r = img->pal[i].r;
-            ipal[i].g = img->pal[i].g;
-            ipal[i].b = img->pal[i].b;
-        }
+    if(0 > transparent) { // no transparency, use RGB
+        image_pal_to_bgr(&buf[sizeof(tga_header_t)], pal, colours);
     } else { // has transparency, use ARGB
-        tga_argb_palette_entry_t *ipal = &pal->argb;
-        for(int i = 0; i < img->colours; i++) {
-            ipal[i].r = img->pal[i].r;
-            ipal[i].g = img->pal[i].g;
-            ipal[i].b = img->pal[i].b;
-            ipal[i].a = (i == img->transparent)?0:255;
-        }
+        image_pal_to_bgra(&buf[sizeof(tga_header_t)], pal, colours, 255, transparent);
     }
 
-    // write the palette
-    nw = fwrite(pal, pal_entry_size, img->colours, fp);
-    if(nw != img->colours) {
-        rval = errno;  // can't write file
-        goto CLEANUP;
-    }
-
-    // write the image
-    nw = fwrite(img->pixels, img->width, img->height, fp);
-    if(nw != img->height) {
-        rval = errno;  // can't write file
-        goto CLEANUP;
-    }
+    return sizeof(tga_header_t) + palsz;
+}
 
+void tga_write_footer(uint8_t *buf) {
     tga_footer_t tgaf;
     memset(&tgaf, 0, sizeof(tga_footer_t));
     strncpy(tgaf.sig, TGA_SIG, 18);
-
-    // write the footer
-    nw = fwrite(&tgaf, sizeof(tga_footer_t), 1, fp);
-    if(1 != nw) {
-        rval = errno;  // can't write file
-        goto CLEANUP;
-    }
-
-    rval = 0;
-CLEANUP:
-    free_s(pal);
-    fclose_s(fp);
-    return rval;
+    memcpy(buf, &tgaf, sizeof(tga_footer_t));
 }
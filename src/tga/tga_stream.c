@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tga_priv.h"
+#include "../io/io_priv.h"
+#include <image_tga.h>
+#include <stdbool.h>
+#include <errno.h>
+
+int load_tga_scanlines(image_io_t *io, image_row_fn row, void *user) {
+    int rval = 0;
+    uint8_t *band = NULL;
+    tga_header_t tga;
+    image_info_t info;
+
+    if((NULL == io) || (NULL == row)) return EBADF;
+
+    // the signature is at the end of the file, we can only check it if we can seek to it
+    if((0 <= io_seek(io, 0, SEEK_CUR)) && (0 != (rval = tga_check_footer(io)))) {
+        return rval;
+    }
+
+    if(0 != (rval = tga_read_header(io, &tga, &info))) {
+        return rval;
+    }
+
+    // the lines have no padding and are stored in the same order load_tga() gives them,
+    // so they can be handed on a band at a time as they are read
+    uint32_t lw = info.width;
+    uint32_t lh = info.height;
+    uint32_t nband = (0 == lw) ? lh : (IO_BAND_SIZE / lw);
+    if(nband > lh) nband = lh;
+    if(0 == nband) nband = 1;
+
+    if(NULL == (band = io_scratch_alloc((size_t)nband * lw + 1))) {
+        rval = errno;  // unable to allocate mem
+        goto CLEANUP;
+    }
+
+    uint32_t y = 0;
+    while(y < lh) {
+        uint32_t n = ((lh - y) < nband) ? (lh - y) : nband;
+        if(0 != io_read_exact(io, band, (size_t)n * lw)) {
+            rval = EINVAL; // truncated image
+            goto CLEANUP;
+        }
+        for(uint32_t i = 0; i < n; i++) {
+            if(0 != (rval = row(user, &info, y + i, &band[(size_t)i * lw]))) goto CLEANUP;
+        }
+        y += n;
+    }
+
+CLEANUP:
+    free_s(band);
+    return rval;
+}
+
+static int tga_writer_rows(image_writer_t *w, const uint8_t *pixels, uint32_t count) {
+    // the lines go out in the same order and layout they are given in
+    return io_write_all(w->io, pixels, (size_t)count * w->info.width);
+}
+
+static int tga_writer_finish(image_writer_t *w, bool complete) {
+    int rval = 0;
+
+    if(complete) {
+        uint8_t ftr[sizeof(tga_footer_t)];
+        tga_write_footer(ftr);
+        rval = io_write_all(w->io, ftr, sizeof(ftr));
+    }
+
+    io_free(w);
+    return rval;
+}
+
+image_writer_t *save_tga_begin(image_io_t *io, const image_info_t *info) {
+    int rval = 0;
+    image_writer_t *w = NULL;
+    uint8_t hdr[TGA_HDR_MAX];
+
+    // the dimensions have to fit in the 16 bit header fields
+    if((NULL != info) && ((info->width > UINT16_MAX) || (info->height > UINT16_MAX) || (info->colours > 256))) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(NULL == (w = io_writer_new(sizeof(image_writer_t), io, info))) {
+        return NULL;
+    }
+    w->rows = tga_writer_rows;
+    w->finish = tga_writer_finish;
+
+    size_t hdrsz = tga_write_header(hdr, info->width, info->height, info->colours, info->transparent, info->pal);
+    if(0 != (rval = io_write_all(io, hdr, hdrsz))) {
+        goto CLEANUP;
+    }
+
+    return w;
+CLEANUP:
+    io_free(w);
+    errno = rval;
+    return NULL;
+}
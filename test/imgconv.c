@@ -0,0 +1,497 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <image.h>
+#include <imageio.h>
+#include <utils.h>
+
+#define fclose_s(A) if(A) fclose(A); A=NULL
+#define free_s(A) if(A) free(A); A=NULL
+
+#define QUEUE_DEPTH (16) // default number of files that can wait between two stages
+
+/// @brief one file on its way through the pipeline
+typedef struct job {
+    char *src;          // name of the file to convert
+    char *dst;          // name of the file to write
+    uint8_t *buf;       // the encoded file, read in or waiting to be written
+    size_t len;         // length of buf in bytes
+    pal_image_t *img;   // the decoded image
+    struct job *next;   // next job in the queue
+} job_t;
+
+/// @brief a bounded queue between two stages, a stage waits when the next one falls behind
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    job_t *head;
+    job_t *tail;
+    int count;      // number of jobs waiting
+    int depth;      // most jobs that can wait
+    int producers;  // number of threads still putting jobs in, closed when it reaches 0
+} queue_t;
+
+/// @brief the names of the files to be written, so two sources with the same name apart from
+///        their extension aren't both written to the same file
+typedef struct {
+    char **slot;  // open addressed, NULL for an empty slot
+    size_t size;  // number of slots, a power of 2
+    size_t used;  // number of names in the set
+} name_set_t;
+
+/// @brief everything the stages share
+typedef struct {
+    const char *src_root;
+    const char *dst_root;
+    dev_t dst_dev;          // identity of the destination directory, so the walk can skip it
+    ino_t dst_ino;          //   when it is inside the source tree
+    image_format_t format;  // format to convert to
+    const char *ext;        // extension for the converted files
+    name_set_t dst_names;   // files the walk has queued to be written, only used by the reader
+    queue_t read_q;         // read -> decode
+    queue_t decode_q;       // decode -> encode
+    queue_t encode_q;       // encode -> write
+    pthread_mutex_t lock;   // protects the counters
+    uint64_t files;         // files converted
+    uint64_t failed;        // files that couldn't be converted
+    uint64_t bytes_in;      // size of the source files
+    uint64_t bytes_out;     // size of the converted files
+} conv_t;
+
+static void queue_init(queue_t *q, int depth, int producers) {
+    memset(q, 0, sizeof(queue_t));
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    q->depth = depth;
+    q->producers = producers;
+}
+
+static void queue_free(queue_t *q) {
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->lock);
+}
+
+static void queue_put(queue_t *q, job_t *job) {
+    pthread_mutex_lock(&q->lock);
+    while(q->count >= q->depth) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    job->next = NULL;
+    if(NULL == q->tail) {
+        q->head = job;
+    } else {
+        q->tail->next = job;
+    }
+    q->tail = job;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/// @brief takes the next job, waiting for one if need be
+/// @return the job, or NULL once the queue is empty and all of its producers are done
+static job_t *queue_get(queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    while((0 == q->count) && (0 < q->producers)) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    job_t *job = q->head;
+    if(NULL != job) {
+        q->head = job->next;
+        if(NULL == q->head) q->tail = NULL;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+/// @brief called by each producer when it has nothing more to put in the queue
+static void queue_done(queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    if(0 == --q->producers) {
+        pthread_cond_broadcast(&q->not_empty);
+    }
+    pthread_mutex_unlock(&q->lock);
+}
+
+static uint64_t name_hash(const char *name) {
+    uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+    while('\0' != *name) {
+        h = (h ^ (uint8_t)*name++) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/// @brief adds a copy of a name to a set, growing the set when it is half full
+/// @return 0 if it was added, EEXIST if it was already there, or ENOMEM
+static int name_add(name_set_t *set, const char *name) {
+    if((set->used * 2) >= set->size) {
+        size_t size = (0 == set->size) ? 256 : (set->size * 2);
+        char **slot = calloc(size, sizeof(char *));
+        if(NULL == slot) return ENOMEM;
+        for(size_t i = 0; i < set->size; i++) {
+            if(NULL == set->slot[i]) continue;
+            size_t j = name_hash(set->slot[i]) & (size - 1);
+            while(NULL != slot[j]) j = (j + 1) & (size - 1);
+            slot[j] = set->slot[i];
+        }
+        free_s(set->slot);
+        set->slot = slot;
+        set->size = size;
+    }
+
+    size_t i = name_hash(name) & (set->size - 1);
+    for(; NULL != set->slot[i]; i = (i + 1) & (set->size - 1)) {
+        if(0 == strcmp(set->slot[i], name)) return EEXIST;
+    }
+    if(NULL == (set->slot[i] = strdup(name))) return ENOMEM;
+    set->used++;
+    return 0;
+}
+
+static void name_set_free(name_set_t *set) {
+    for(size_t i = 0; i < set->size; i++) {
+        free_s(set->slot[i]);
+    }
+    free_s(set->slot);
+    memset(set, 0, sizeof(name_set_t));
+}
+
+static void job_free(job_t *job) {
+    if(NULL == job) return;
+    free_s(job->src);
+    free_s(job->dst);
+    free_s(job->buf);
+    if(NULL != job->img) image_free(job->img);
+    free(job);
+}
+
+/// @brief drops a job that couldn't be converted
+static void job_fail(conv_t *cv, job_t *job, const char *what, int err) {
+    fprintf(stderr, "Unable to %s '%s': %s\n", what, job->src, strerror(err));
+    pthread_mutex_lock(&cv->lock);
+    cv->failed++;
+    pthread_mutex_unlock(&cv->lock);
+    job_free(job);
+}
+
+/// @brief joins two parts of a path, with a new extension in place of the old one if ext is given
+static char *path_join(const char *dir, const char *name, const char *ext) {
+    size_t nlen = strlen(name);
+    if(NULL != ext) {
+        const char *dot = strrchr(name, '.');
+        if(NULL != dot) nlen = dot - name;
+    }
+    size_t len = strlen(dir) + 1 + nlen + ((NULL != ext) ? (strlen(ext) + 1) : 0) + 1;
+    char *path = malloc(len);
+    if(NULL == path) return NULL;
+    if(NULL != ext) {
+        snprintf(path, len, "%s/%.*s.%s", dir, (int)nlen, name, ext);
+    } else {
+        snprintf(path, len, "%s/%s", dir, name);
+    }
+    return path;
+}
+
+/// @brief creates every directory leading up to a file
+static int make_dirs(const char *fn) {
+    char *path = strdup(fn);
+    if(NULL == path) return errno;
+    for(char *p = strchr(path + 1, '/'); NULL != p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if((0 != mkdir(path, 0777)) && (EEXIST != errno)) {
+            int rval = errno;
+            free(path);
+            return rval;
+        }
+        *p = '/';
+    }
+    free(path);
+    return 0;
+}
+
+/// @brief reads an entire file into a newly allocated buffer
+static int read_file(const char *fn, uint8_t **buf, size_t *len) {
+    int rval = 0;
+    FILE *fp = NULL;
+    uint8_t *data = NULL;
+
+    if(NULL == (fp = fopen(fn, "rb"))) {
+        return errno;
+    }
+    if(0 != fseek(fp, 0, SEEK_END)) {
+        rval = errno;
+        goto CLEANUP;
+    }
+    long fsz = ftell(fp);
+    if((0 > fsz) || (0 != fseek(fp, 0, SEEK_SET))) {
+        rval = errno;
+        goto CLEANUP;
+    }
+    if(NULL == (data = malloc(fsz + 1))) {
+        rval = errno;
+        goto CLEANUP;
+    }
+    if((0 < fsz) && (1 != fread(data, fsz, 1, fp))) {
+        rval = EIO;
+        goto CLEANUP;
+    }
+
+    fclose_s(fp);
+    *buf = data;
+    *len = fsz;
+    return 0;
+CLEANUP:
+    fclose_s(fp);
+    free_s(data);
+    return rval;
+}
+
+/// @brief walks a directory tree, reading each image file found into the read queue. Links
+///        aren't followed, so a loop can't keep the walk going forever
+/// @param rel path of the directory relative to the source root, "" for the root itself
+static void walk(conv_t *cv, const char *rel) {
+    char *dir = ('\0' == *rel) ? strdup(cv->src_root) : path_join(cv->src_root, rel, NULL);
+    DIR *dp = (NULL != dir) ? opendir(dir) : NULL;
+    if(NULL == dp) {
+        fprintf(stderr, "Unable to open directory '%s'\n", (NULL != dir) ? dir : rel);
+        free_s(dir);
+        return;
+    }
+
+    struct dirent *de;
+    while(NULL != (de = readdir(dp))) {
+        if(('.' == de->d_name[0]) && (('\0' == de->d_name[1]) || (('.' == de->d_name[1]) && ('\0' == de->d_name[2])))) {
+            continue;
+        }
+
+        char *name = ('\0' == *rel) ? strdup(de->d_name) : path_join(rel, de->d_name, NULL);
+        char *src = path_join(cv->src_root, name, NULL);
+        struct stat st;
+        if((NULL == name) || (NULL == src) || (0 != lstat(src, &st)) || S_ISLNK(st.st_mode)) {
+            free_s(name);
+            free_s(src);
+            continue;
+        }
+
+        if(S_ISDIR(st.st_mode)) {
+            // don't convert what has already been converted
+            if((st.st_dev != cv->dst_dev) || (st.st_ino != cv->dst_ino)) {
+                walk(cv, name);
+            }
+        } else if(S_ISREG(st.st_mode) && (IMAGE_FMT_UNKNOWN != image_format_from_name(name))) {
+            job_t *job = calloc(1, sizeof(job_t));
+            if(NULL != job) {
+                job->src = src;
+                src = NULL;
+                job->dst = path_join(cv->dst_root, name, cv->ext);
+                int rval = (NULL == job->dst) ? ENOMEM : name_add(&cv->dst_names, job->dst);
+                if(EEXIST == rval) { // such as a.bmp and a.pcx, only the first one found is converted
+                    fprintf(stderr, "'%s' converts to the same file as another, '%s'\n", job->src, job->dst);
+                    job_fail(cv, job, "convert", rval);
+                } else if((0 == rval) && (0 == (rval = read_file(job->src, &job->buf, &job->len)))) {
+                    queue_put(&cv->read_q, job);
+                } else {
+                    job_fail(cv, job, "read", rval);
+                }
+            }
+        }
+        free_s(name);
+        free_s(src);
+    }
+    closedir(dp);
+    free(dir);
+}
+
+static void *read_stage(void *arg) {
+    conv_t *cv = (conv_t *)arg;
+    walk(cv, "");
+    queue_done(&cv->read_q);
+    return NULL;
+}
+
+static void *decode_stage(void *arg) {
+    conv_t *cv = (conv_t *)arg;
+    job_t *job;
+    while(NULL != (job = queue_get(&cv->read_q))) {
+        if(NULL == (job->img = load_image_mem(job->buf, job->len))) {
+            job_fail(cv, job, "decode", errno);
+            continue;
+        }
+        pthread_mutex_lock(&cv->lock);
+        cv->bytes_in += job->len;
+        pthread_mutex_unlock(&cv->lock);
+        free_s(job->buf);
+        queue_put(&cv->decode_q, job);
+    }
+    queue_done(&cv->decode_q);
+    return NULL;
+}
+
+static void *encode_stage(void *arg) {
+    conv_t *cv = (conv_t *)arg;
+    job_t *job;
+    while(NULL != (job = queue_get(&cv->decode_q))) {
+        int rval = save_image_mem(job->img, cv->format, &job->buf, &job->len);
+        if(0 != rval) {
+            job_fail(cv, job, "encode", rval);
+            continue;
+        }
+        image_free(job->img);
+        job->img = NULL;
+        queue_put(&cv->encode_q, job);
+    }
+    queue_done(&cv->encode_q);
+    return NULL;
+}
+
+static void *write_stage(void *arg) {
+    conv_t *cv = (conv_t *)arg;
+    job_t *job;
+    while(NULL != (job = queue_get(&cv->encode_q))) {
+        FILE *fp = NULL;
+        int rval = make_dirs(job->dst);
+        if((0 == rval) && (NULL == (fp = fopen(job->dst, "wb")))) rval = errno;
+        if((0 == rval) && (0 < job->len) && (1 != fwrite(job->buf, job->len, 1, fp))) rval = EIO;
+        if((NULL != fp) && (0 != fclose(fp)) && (0 == rval)) rval = errno;
+        if(0 != rval) {
+            job_fail(cv, job, "write", rval);
+            continue;
+        }
+        pthread_mutex_lock(&cv->lock);
+        cv->files++;
+        cv->bytes_out += job->len;
+        pthread_mutex_unlock(&cv->lock);
+        job_free(job);
+    }
+    return NULL;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void usage(const char *prog) {
+    printf("USAGE: %s [-j threads] [-q depth] [bmp|pcx|tga|png] [source dir] [destination dir]\n", filename(prog));
+    printf("  converts every image under the source directory to the given format, keeping the tree\n");
+    printf("  -j number of decode and of encode threads (default one for each processor)\n");
+    printf("  -q number of files that can wait between each stage (default %d)\n", QUEUE_DEPTH);
+}
+
+int main(int argc, char *argv[]) {
+    int threads = 0;
+    int depth = QUEUE_DEPTH;
+    int opt;
+    conv_t cv;
+
+    printf("ca-imageio batch converter\n");
+
+    while(-1 != (opt = getopt(argc, argv, "j:q:"))) {
+        switch(opt) {
+            case 'j': threads = atoi(optarg); break;
+            case 'q': depth = atoi(optarg); break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+
+    if((argc - optind) < 3) {
+        printf("Error: format, source and destination required\n");
+        usage(argv[0]);
+        return -1;
+    }
+
+    memset(&cv, 0, sizeof(conv_t));
+    cv.ext = argv[optind];
+    char probe[16];
+    snprintf(probe, sizeof(probe), "x.%s", cv.ext);
+    if(IMAGE_FMT_UNKNOWN == (cv.format = image_format_from_name(probe))) {
+        printf("Error: unknown format '%s'\n", cv.ext);
+        usage(argv[0]);
+        return -1;
+    }
+    cv.src_root = argv[optind + 1];
+    cv.dst_root = argv[optind + 2];
+
+    // the destination is made now, rather than by the writer, so the walk knows to skip it
+    struct stat st;
+    if((0 != make_dirs(cv.dst_root)) || ((0 != mkdir(cv.dst_root, 0777)) && (EEXIST != errno)) ||
+       (0 != stat(cv.dst_root, &st)) || !S_ISDIR(st.st_mode)) {
+        printf("Error: unable to create '%s'\n", cv.dst_root);
+        return -1;
+    }
+    cv.dst_dev = st.st_dev;
+    cv.dst_ino = st.st_ino;
+
+    if(0 >= threads) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (0 < n) ? (int)n : 1;
+    }
+    if(0 >= depth) depth = 1;
+
+    // one reader and one writer keep the disk busy, while the decoding and encoding
+    // is spread over the processors
+    pthread_mutex_init(&cv.lock, NULL);
+    queue_init(&cv.read_q, depth, 1);
+    queue_init(&cv.decode_q, depth, threads);
+    queue_init(&cv.encode_q, depth, threads);
+
+    pthread_t reader, writer;
+    pthread_t *decoders = calloc(threads, sizeof(pthread_t));
+    pthread_t *encoders = calloc(threads, sizeof(pthread_t));
+    if((NULL == decoders) || (NULL == encoders)) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+
+    // the stages are started from the writer back, so a stage that can't be started never has
+    // anything in front of it waiting to be drained. Each producer that didn't start is marked
+    // as done, so the stages after it still finish, and fewer workers than asked for will do
+    double start = now();
+    int nenc = 0;
+    int ndec = 0;
+    bool writing = (0 == pthread_create(&writer, NULL, write_stage, &cv));
+    while(writing && (nenc < threads) && (0 == pthread_create(&encoders[nenc], NULL, encode_stage, &cv))) nenc++;
+    for(int t = nenc; t < threads; t++) queue_done(&cv.encode_q);
+    while((0 < nenc) && (ndec < threads) && (0 == pthread_create(&decoders[ndec], NULL, decode_stage, &cv))) ndec++;
+    for(int t = ndec; t < threads; t++) queue_done(&cv.decode_q);
+    bool reading = (0 < ndec) && (0 == pthread_create(&reader, NULL, read_stage, &cv));
+    if(!reading) queue_done(&cv.read_q);
+
+    if(reading) pthread_join(reader, NULL);
+    for(int t = 0; t < ndec; t++) pthread_join(decoders[t], NULL);
+    for(int t = 0; t < nenc; t++) pthread_join(encoders[t], NULL);
+    if(writing) pthread_join(writer, NULL);
+    if(!reading) {
+        printf("Error: unable to start the conversion threads\n");
+        return -1;
+    }
+    double secs = now() - start;
+    if(0 >= secs) secs = 1e-9;
+
+    printf("Converted %llu files (%llu failed) in %.3fs\n", (unsigned long long)cv.files, (unsigned long long)cv.failed, secs);
+    printf("  %.1f files/s, %.2f MB/s in, %.2f MB/s out\n", cv.files / secs,
+        (cv.bytes_in / 1e6) / secs, (cv.bytes_out / 1e6) / secs);
+
+    free(encoders);
+    free(decoders);
+    queue_free(&cv.encode_q);
+    queue_free(&cv.decode_q);
+    queue_free(&cv.read_q);
+    name_set_free(&cv.dst_names);
+    pthread_mutex_destroy(&cv.lock);
+    return (0 == cv.failed) ? 0 : -1;
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <image.h>
+#include <image_pcx.h>
+#include <utils.h>
+#include "../src/pcx/pcx_priv.h" // for timing the RLE encoder on its own
+
+#define BENCH_WIDTH (1024)
+#define BENCH_HEIGHT (768)
+#define PCX_HEADER_SIZE (128) // size of the header in front of the RLE data
+#define PCX_PAL_SIZE (769)    // marker and palette at the end of a 256 colour file
+
+/// @brief the byte at a time decoder, kept here as the baseline to measure against
+static int ref_rle_decode(uint8_t *dst, size_t len, const uint8_t *src, size_t slen) {
+    size_t sp = 0;
+    size_t dp = 0;
+    while(sp < slen) {
+        uint8_t val = src[sp++];
+        int n = 1;
+        uint8_t col = val;
+        if(0xc0 < val) {
+            if(sp == slen) return -1;
+            col = src[sp++];
+            n = val & 0x3f;
+        }
+        if((dp + n) > len) return -1;
+        for(int i = 0; i < n; i++) {
+            dst[dp++] = col;
+        }
+    }
+    return (dp == len) ? 0 : -1;
+}
+
+/// @brief the byte at a time encoder, kept here as the baseline to measure against
+/// @return number of bytes written to dst, which must have room for the worst case
+static size_t ref_rle_encode(uint8_t *dst, const uint8_t *src, int bpl, int lines) {
+    size_t dp = 0;
+    for(int y = 0; y < lines; y++) {
+        const uint8_t *p = &src[(size_t)y * bpl];
+        uint8_t count = 1;
+        uint8_t last = p[0];
+        for(int x = 1; x < bpl; x++) {
+            uint8_t cur = p[x];
+            if(cur == last) {
+                count++;
+                if(count == 64) {
+                    dst[dp++] = 0xff;
+                    dst[dp++] = cur;
+                    count = 1;
+                }
+            } else {
+                if((count == 1) && (last < 0xc0)) {
+                    dst[dp++] = last;
+                } else {
+                    dst[dp++] = 0xc0 + count;
+                    dst[dp++] = last;
+                }
+                last = cur;
+                count = 1;
+            }
+        }
+        if((count == 1) && (last < 0xc0)) {
+            dst[dp++] = last;
+        } else {
+            dst[dp++] = 0xc0 + count;
+            dst[dp++] = last;
+        }
+    }
+    return dp;
+}
+
+/// @brief fills an image with test content
+/// @param img image to fill
+/// @param noisy true for random pixels, otherwise wide bands of flat colour
+static void fill_image(pal_image_t *img, bool noisy) {
+    for(int i = 0; i < 256; i++) {
+        img->pal[i].r = i;
+        img->pal[i].g = 255 - i;
+        img->pal[i].b = i ^ 0x55;
+    }
+    for(int y = 0; y < img->height; y++) {
+        for(int x = 0; x < img->width; x++) {
+            img->pixels[(size_t)y * img->width + x] = noisy ? (uint8_t)rand() : (uint8_t)((x / 200) + (y / 64) * 7);
+        }
+    }
+}
+
+static double seconds(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/// @brief times both decoders, and both encoders, on one image and prints the result
+static int bench(const char *name, bool noisy, int loops) {
+    int rval = -1;
+    pal_image_t *img = NULL;
+    pal_image_t *out = NULL;
+    uint8_t *buf = NULL;
+    uint8_t *ref = NULL;
+    size_t len = 0;
+
+    if(NULL == (img = image_alloc(BENCH_WIDTH, BENCH_HEIGHT, 256, 0))) goto CLEANUP;
+    fill_image(img, noisy);
+    if(0 != save_pcx_mem(img, &buf, &len)) {
+        printf("Error encoding the %s image\n", name);
+        goto CLEANUP;
+    }
+
+    size_t px = (size_t)BENCH_WIDTH * BENCH_HEIGHT;
+    if(NULL == (ref = malloc(px * 2))) goto CLEANUP; // room for the worst case encoding
+    const uint8_t *rle = &buf[PCX_HEADER_SIZE];
+    size_t rle_len = len - PCX_HEADER_SIZE - PCX_PAL_SIZE;
+
+    // check both agree before timing anything
+    if((rle_len != ref_rle_encode(ref, img->pixels, BENCH_WIDTH, BENCH_HEIGHT)) || (0 != memcmp(ref, rle, rle_len))) {
+        printf("Error: %s image did not encode correctly\n", name);
+        goto CLEANUP;
+    }
+    if((0 != ref_rle_decode(ref, px, rle, rle_len)) || (0 != load_pcx_mem_into(&out, buf, len)) ||
+       (0 != memcmp(ref, out->pixels, px)) || (0 != memcmp(ref, img->pixels, px))) {
+        printf("Error: %s image did not decode correctly\n", name);
+        goto CLEANUP;
+    }
+
+    clock_t start = clock();
+    for(int i = 0; i < loops; i++) {
+        ref_rle_decode(ref, px, rle, rle_len);
+    }
+    double t_ref = seconds(start);
+
+    start = clock();
+    for(int i = 0; i < loops; i++) {
+        load_pcx_mem_into(&out, buf, len);
+    }
+    double t_new = seconds(start);
+
+    double mb = ((double)px * loops) / (1024.0 * 1024.0);
+    printf("%-6s %7zu bytes RLE  decode byte at a time: %8.1f MB/s  load_pcx_mem:   %8.1f MB/s  (%.1fx)\n",
+           name, rle_len, mb / t_ref, mb / t_new, t_ref / t_new);
+
+    start = clock();
+    for(int i = 0; i < loops; i++) {
+        ref_rle_encode(ref, img->pixels, BENCH_WIDTH, BENCH_HEIGHT);
+    }
+    t_ref = seconds(start);
+
+    start = clock();
+    for(int i = 0; i < loops; i++) {
+        memstream_buf_t dst = {.pos = 0, .len = px * 2, .data = ref};
+        memstream_buf_t src = {.pos = 0, .len = px, .data = img->pixels};
+        pcx_rle_encode(BENCH_WIDTH, &dst, &src);
+    }
+    t_new = seconds(start);
+
+    printf("%-6s %7zu bytes RLE  encode byte at a time: %8.1f MB/s  pcx_rle_encode: %8.1f MB/s  (%.1fx)\n",
+           name, rle_len, mb / t_ref, mb / t_new, t_ref / t_new);
+
+    rval = 0;
+CLEANUP:
+    free(ref);
+    free(buf);
+    image_free(out);
+    image_free(img);
+    return rval;
+}
+
+int main(int argc, char *argv[]) {
+    int loops = 50;
+
+    printf("ca-imageio PCX RLE benchmark\n");
+
+    if(argc > 1) {
+        loops = atoi(argv[1]);
+        if(0 >= loops) {
+            printf("USAGE: %s [loops]\n", filename(argv[0]));
+            return -1;
+        }
+    }
+
+    printf("%dx%d 8 bit image, %d decodes and encodes each\n", BENCH_WIDTH, BENCH_HEIGHT, loops);
+    srand(1);
+    if(0 != bench("flat", false, loops)) return -1;
+    if(0 != bench("noisy", true, loops)) return -1;
+
+    printf("Done\n");
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include <image.h>
+#include <image_pcx.h>
+#include "../src/pcx/pcx_priv.h" // for building files with unusual headers
+
+#define PCX_HEADER_SIZE (128) // size of the header in front of the RLE data
+#define PCX_PAL_SIZE (769)    // marker and palette at the end of a 256 colour file
+
+/// @brief checks that an image whose lines carry far more padding than pixels decodes without
+///        the padding spilling out of the image
+/// @return 0 on success, otherwise -1
+static int check_padded(void) {
+    int rval = -1;
+    pal_image_t *img = NULL;
+    pal_image_t *out = NULL;
+    uint8_t *buf = NULL;
+    uint8_t *pad = NULL;
+    size_t len = 0;
+
+    if(NULL == (img = image_alloc(2, 2, 256, 0))) goto CLEANUP;
+    for(int i = 0; i < 256; i++) {
+        img->pal[i].r = i;
+        img->pal[i].g = 255 - i;
+        img->pal[i].b = i ^ 0x55;
+    }
+    for(int i = 0; i < 4; i++) img->pixels[i] = 0x10 + i; // below the run marker, so stored as is
+    if(0 != save_pcx_mem(img, &buf, &len)) goto CLEANUP;
+
+    // the same image, with each line padded out to 200 bytes by a run of 198 zeros
+    uint16_t bpl = 200;
+    const uint8_t fill[] = {0xff, 0, 0xff, 0, 0xff, 0, 0xc9, 0};
+    size_t plen = PCX_HEADER_SIZE + (2 * (2 + sizeof(fill))) + PCX_PAL_SIZE;
+    if(NULL == (pad = malloc(plen))) goto CLEANUP;
+    memcpy(pad, buf, PCX_HEADER_SIZE);
+    memcpy(&pad[offsetof(pcx_header_t, bytes_per_line)], &bpl, sizeof(bpl));
+    uint8_t *dp = &pad[PCX_HEADER_SIZE];
+    for(int y = 0; y < 2; y++) {
+        *dp++ = img->pixels[y * 2];
+        *dp++ = img->pixels[(y * 2) + 1];
+        memcpy(dp, fill, sizeof(fill));
+        dp += sizeof(fill);
+    }
+    memcpy(dp, &buf[len - PCX_PAL_SIZE], PCX_PAL_SIZE);
+
+    if((NULL == (out = load_pcx_mem(pad, plen))) || (0 != memcmp(out->pixels, img->pixels, 4))) {
+        printf("Error: padded image did not decode correctly\n");
+        goto CLEANUP;
+    }
+
+    rval = 0;
+CLEANUP:
+    free(pad);
+    free(buf);
+    image_free(out);
+    image_free(img);
+    return rval;
+}
+
+int main(void) {
+    int rval = 0;
+
+    printf("ca-imageio PCX decoder checks\n");
+
+    if(0 != check_padded()) rval = -1;
+
+    printf("%s\n", (0 == rval) ? "Done" : "Failed");
+    return rval;
+}